@@ -0,0 +1,48 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <string>
+
+#include "cnn.h"
+
+//-------------------------------------------------------------AUTOTUNER------------------------------------------------------//
+
+// CONV_TUNED runs each fused conv + pool stage with its own algorithm and im2col cache block, and the FC layers
+// of forwardBatch as one GEMM from a batch size of its own, all taken from Params.tuning. The best choice
+// differs between layer 1 (3 -> 16 channels over 128x128 pixels) and layer 5 (32 -> 64 over 8x8) and between
+// CPUs, so autotune measures the candidates on the host and the winners are cached in a text file, one line per
+// CPU model and kernel ISA:
+//   <cpu model><TAB><isa><TAB>layer_1_2=nchwc layer_3_4=gemm:16 layer_5_6=winograd fc_batch=6
+// gemm:B is CONV_FUSED_GEMM lowering B pooled pixels per cache block. Lines starting with # are ignored.
+// loadEngine copies the plan it is given into the engine's Params, so engines in one process may run different
+// plans and nothing changes under a running forward pass.
+
+#define DEFAULT_TUNING_CACHE "lenet_tuning.txt"
+
+// CONV_FUSED_GEMM with the compile time blocking, what loadParams and mapModel give a model
+void defaultTuningPlan(TuningPlan& plan);
+
+// Largest im2col block of a stage whose lowered panels fit the Workspace col_buffer
+int maxStageBlock(int stage);
+
+// The cache key of this host: its CPU model and the active kernel ISA, tab separated
+std::string tuningKey();
+
+std::string formatTuningPlan(const TuningPlan& plan);
+
+// Parses formatTuningPlan's text, returns false unless every stage and fc_batch is present and valid
+bool parseTuningPlan(const char* text, TuningPlan& plan);
+
+// The plan cached for key, false if the file or the entry doesn't exist. A malformed entry is reported.
+bool loadTuning(const char* cachePath, const std::string& key, TuningPlan& plan);
+
+// Adds or replaces the entry of key, keeping those of other hosts. The file is replaced by a rename, so a run
+// starting meanwhile reads the old cache or the new one
+bool saveTuning(const char* cachePath, const std::string& key, const TuningPlan& plan);
+
+// Times the candidates of every stage and the FC batch sizes on a synthetic image with param's weights, which must
+// have been loaded for CONV_TUNED. Takes a few seconds, Winograd is only a candidate if allow_winograd (see
+// Engine.winograd_error). param itself is left untouched, the candidates run on a copy.
+bool autotune(const Params& param, bool allow_winograd, TuningPlan& plan);
+
+#endif // AUTOTUNE_H
@@ -7,19 +7,24 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <string>
+#include <vector>
+
 #include <opencv4/opencv2/opencv.hpp>
 
+#include "gemm.h"
+#include "nchwc.h"
+#include "network.h"
+#include "winograd.h"
+
 #define MAX_PATH_LENGTH 256
 const float STD = (255 * 0.5f);  // 0.5
 const float MEAN = (255 * 0.5f); // 0.5
 
 //-------------------------------------------------------------MACROS/GLOBALS---------------------------------------------------//
 
-#define MAX_LINE_SIZE 2000000
 #define DECIMAL_PLACE_FACTOR 1000
 
-#define COMPUTE_OUTPUT_SIZE(N_in, padding, filter_size, stride) (N_in + 2 * padding - filter_size) / stride + 1
-
 inline float relu(float x) {
     return (x > 0) ? x : 0;
 }
@@ -28,106 +33,155 @@ float relu(float x);
 
 //------------------------------------------------------------Lenet-Configuration------------------------------//
 
+// The network itself is described by the layer types in network.h, these are shorthands for the sizes of
+// the ImageData / Params buffers. PADDING_N is the padding of layer N's input.
+
 // Layer 1 - convolution + relu
-#define INPUT_FILTERS_1 3
-#define INPUT_ROWS_1 128
-#define INPUT_COLS_1 128
-#define KERNEL_SIZE_1 3
-#define STRIDE_1 2
-#define PADDING_1 1
-#define NUM_FILTERS_1 16
+#define INPUT_FILTERS_1 InputImage::filters
+#define INPUT_ROWS_1 InputImage::rows
+#define INPUT_COLS_1 InputImage::cols
+#define KERNEL_SIZE_1 Layer1Conv::kernel_size
+#define STRIDE_1 Layer1Conv::stride
+#define PADDING_1 InputImage::padding
+#define NUM_FILTERS_1 Layer1Conv::Output::filters
 
 // Layer 2 - Max pooling
-#define INPUT_FILTERS_2 NUM_FILTERS_1
-#define INPUT_ROWS_2 COMPUTE_OUTPUT_SIZE(INPUT_ROWS_1, PADDING_1, KERNEL_SIZE_1, STRIDE_1)
-#define INPUT_COLS_2 COMPUTE_OUTPUT_SIZE(INPUT_COLS_1, PADDING_1, KERNEL_SIZE_1, STRIDE_1)
-#define KERNEL_SIZE_2 2
-#define STRIDE_2 2
-#define PADDING_2 0
-#define NUM_FILTERS_2 INPUT_FILTERS_2
+#define INPUT_FILTERS_2 Layer2Pool::Input::filters
+#define INPUT_ROWS_2 Layer2Pool::Input::rows
+#define INPUT_COLS_2 Layer2Pool::Input::cols
+#define KERNEL_SIZE_2 Layer2Pool::kernel_size
+#define STRIDE_2 Layer2Pool::stride
+#define PADDING_2 Layer2Pool::Input::padding
+#define NUM_FILTERS_2 Layer2Pool::Output::filters
 
 // Layer 3 - convolution + relu
-#define INPUT_FILTERS_3 NUM_FILTERS_2
-#define INPUT_ROWS_3 COMPUTE_OUTPUT_SIZE(INPUT_ROWS_2, PADDING_2, KERNEL_SIZE_2, STRIDE_2)
-#define INPUT_COLS_3 COMPUTE_OUTPUT_SIZE(INPUT_COLS_2, PADDING_2, KERNEL_SIZE_2, STRIDE_2)
-#define KERNEL_SIZE_3 3
-#define STRIDE_3 2
-#define PADDING_3 1
-#define NUM_FILTERS_3 32
+#define INPUT_FILTERS_3 Layer3Conv::Input::filters
+#define INPUT_ROWS_3 Layer3Conv::Input::rows
+#define INPUT_COLS_3 Layer3Conv::Input::cols
+#define KERNEL_SIZE_3 Layer3Conv::kernel_size
+#define STRIDE_3 Layer3Conv::stride
+#define PADDING_3 Layer3Conv::Input::padding
+#define NUM_FILTERS_3 Layer3Conv::Output::filters
 
 // Layer 4 - Max pooling
-#define INPUT_FILTERS_4 NUM_FILTERS_3
-#define INPUT_ROWS_4 COMPUTE_OUTPUT_SIZE(INPUT_ROWS_3, PADDING_3, KERNEL_SIZE_3, STRIDE_3)
-#define INPUT_COLS_4 COMPUTE_OUTPUT_SIZE(INPUT_COLS_3, PADDING_3, KERNEL_SIZE_3, STRIDE_3)
-#define KERNEL_SIZE_4 2
-#define STRIDE_4 2
-#define PADDING_4 0
-#define NUM_FILTERS_4 INPUT_FILTERS_4
+#define INPUT_FILTERS_4 Layer4Pool::Input::filters
+#define INPUT_ROWS_4 Layer4Pool::Input::rows
+#define INPUT_COLS_4 Layer4Pool::Input::cols
+#define KERNEL_SIZE_4 Layer4Pool::kernel_size
+#define STRIDE_4 Layer4Pool::stride
+#define PADDING_4 Layer4Pool::Input::padding
+#define NUM_FILTERS_4 Layer4Pool::Output::filters
 
 // Layer 5 - convolution + relu
-#define INPUT_FILTERS_5 NUM_FILTERS_4
-#define INPUT_ROWS_5 COMPUTE_OUTPUT_SIZE(INPUT_ROWS_4, PADDING_4, KERNEL_SIZE_4, STRIDE_4)
-#define INPUT_COLS_5 COMPUTE_OUTPUT_SIZE(INPUT_COLS_4, PADDING_4, KERNEL_SIZE_4, STRIDE_4)
-#define KERNEL_SIZE_5 3
-#define STRIDE_5 1
-#define PADDING_5 1
-#define NUM_FILTERS_5 64
+#define INPUT_FILTERS_5 Layer5Conv::Input::filters
+#define INPUT_ROWS_5 Layer5Conv::Input::rows
+#define INPUT_COLS_5 Layer5Conv::Input::cols
+#define KERNEL_SIZE_5 Layer5Conv::kernel_size
+#define STRIDE_5 Layer5Conv::stride
+#define PADDING_5 Layer5Conv::Input::padding
+#define NUM_FILTERS_5 Layer5Conv::Output::filters
 
 // Layer 6 - Max pooling
-#define INPUT_FILTERS_6 NUM_FILTERS_5
-#define INPUT_ROWS_6 COMPUTE_OUTPUT_SIZE(INPUT_ROWS_5, PADDING_5, KERNEL_SIZE_5, STRIDE_5)
-#define INPUT_COLS_6 COMPUTE_OUTPUT_SIZE(INPUT_COLS_5, PADDING_5, KERNEL_SIZE_5, STRIDE_5)
-#define KERNEL_SIZE_6 2
-#define STRIDE_6 2
-#define PADDING_6 0
-#define NUM_FILTERS_6 INPUT_FILTERS_6
+#define INPUT_FILTERS_6 Layer6Pool::Input::filters
+#define INPUT_ROWS_6 Layer6Pool::Input::rows
+#define INPUT_COLS_6 Layer6Pool::Input::cols
+#define KERNEL_SIZE_6 Layer6Pool::kernel_size
+#define STRIDE_6 Layer6Pool::stride
+#define PADDING_6 Layer6Pool::Input::padding
+#define NUM_FILTERS_6 Layer6Pool::Output::filters
 
 // NOTE: We will flatten feature map
 
 // Layer 7 - Fully Connected Layer + relu
-#define INPUT_COLS_7 NUM_FILTERS_6 * 4 * 4
-#define WEIGHT_ROWS_7 100
-#define WEIGHT_COLS_7 NUM_FILTERS_6 * 4 * 4
-#define NUM_FILTERS_7 100
+#define INPUT_COLS_7 Layer7Fc::inputs
+#define WEIGHT_ROWS_7 Layer7Fc::outputs
+#define WEIGHT_COLS_7 Layer7Fc::inputs
+#define NUM_FILTERS_7 Layer7Fc::outputs
 
 // Layer 8 - Fully Connected Layer + relu
-#define INPUT_COLS_8 WEIGHT_ROWS_7
-#define WEIGHT_ROWS_8 50
-#define WEIGHT_COLS_8 NUM_FILTERS_7
-#define NUM_FILTERS_8 50
+#define INPUT_COLS_8 Layer8Fc::inputs
+#define WEIGHT_ROWS_8 Layer8Fc::outputs
+#define WEIGHT_COLS_8 Layer8Fc::inputs
+#define NUM_FILTERS_8 Layer8Fc::outputs
 
 // Layer 9 - Fully Connected Layer
-#define INPUT_COLS_9 WEIGHT_ROWS_8
-#define WEIGHT_ROWS_9 10
-#define WEIGHT_COLS_9 NUM_FILTERS_8
-#define NUM_FILTERS_9 10
+#define INPUT_COLS_9 Layer9Fc::inputs
+#define WEIGHT_ROWS_9 Layer9Fc::outputs
+#define WEIGHT_COLS_9 Layer9Fc::inputs
+#define NUM_FILTERS_9 Layer9Fc::outputs
 
 // Layer 10 - Output layer
-#define TOTAL_CLASSES 10
-
+#define TOTAL_CLASSES Layer9Fc::outputs
+
+// im2col scratch for one GEMM_NC block of the conv with the largest reduction dimension (layer 5)
+#define COL_BUFFER_SIZE (INPUT_FILTERS_5 * KERNEL_SIZE_5 * KERNEL_SIZE_5 * GEMM_NC)
+
+// Algorithm used by the layer_N_conv functions
+enum ConvAlgorithm {
+    CONV_DIRECT = 0,     // naive sliding window
+    CONV_IM2COL_GEMM,    // im2col + blocked SGEMM over weights packed by loadParams
+    CONV_FUSED_GEMM,     // CONV_IM2COL_GEMM with the following max pool fused in, see layer_1_2_conv_pool
+    CONV_FUSED_WINOGRAD, // CONV_FUSED_GEMM with the stride 1 layer 5 computed by Winograd F(2x2, 3x3)
+    CONV_NCHWC,          // fused conv + pool on NCHWc blocked activations, see nchwc.h
+    CONV_TUNED           // each fused stage with the algorithm and blocking autotune picked for it, see autotune.h
+};
+
+// How CONV_TUNED runs the fused conv + pool stages and the batched FC layers, see autotune.h
+#define TUNING_STAGES 3 // fused stages: layers 1 + 2, 3 + 4, 5 + 6
+
+typedef struct StageTuning {
+    int algorithm; // CONV_FUSED_GEMM, CONV_NCHWC or, for the last stage, CONV_FUSED_WINOGRAD
+    int block;     // pooled pixels per im2col block of CONV_FUSED_GEMM, a multiple of GEMM_POOL_NR
+} StageTuning;
+
+typedef struct TuningPlan {
+    StageTuning stages[TUNING_STAGES];
+    int fc_batch_min; // smallest batch whose FC layers forwardBatch runs as GEMMs
+} TuningPlan;
+
+// Every tensor is 64-byte aligned so a mapped binary model (see model_format.h) can be used in place
 typedef struct Params {
-    float weights1[NUM_FILTERS_1][INPUT_FILTERS_1][KERNEL_SIZE_1][KERNEL_SIZE_1];
-    float biases1[NUM_FILTERS_1];
-    float weights2[NUM_FILTERS_3][INPUT_FILTERS_3][KERNEL_SIZE_3][KERNEL_SIZE_3];
-    float biases2[NUM_FILTERS_3];
-    float weights3[NUM_FILTERS_5][INPUT_FILTERS_5][KERNEL_SIZE_5][KERNEL_SIZE_5];
-    float biases3[NUM_FILTERS_5];
-    float weights4[WEIGHT_ROWS_7][WEIGHT_COLS_7];
-    float biases4[NUM_FILTERS_7];
-    float weights5[WEIGHT_ROWS_8][WEIGHT_COLS_8];
-    float biases5[NUM_FILTERS_8];
-    float weights6[WEIGHT_ROWS_9][WEIGHT_COLS_9];
-    float biases6[NUM_FILTERS_9];
+    alignas(64) float weights1[NUM_FILTERS_1][INPUT_FILTERS_1][KERNEL_SIZE_1][KERNEL_SIZE_1];
+    alignas(64) float biases1[NUM_FILTERS_1];
+    alignas(64) float weights2[NUM_FILTERS_3][INPUT_FILTERS_3][KERNEL_SIZE_3][KERNEL_SIZE_3];
+    alignas(64) float biases2[NUM_FILTERS_3];
+    alignas(64) float weights3[NUM_FILTERS_5][INPUT_FILTERS_5][KERNEL_SIZE_5][KERNEL_SIZE_5];
+    alignas(64) float biases3[NUM_FILTERS_5];
+    alignas(64) float weights4[WEIGHT_ROWS_7][WEIGHT_COLS_7];
+    alignas(64) float biases4[NUM_FILTERS_7];
+    alignas(64) float weights5[WEIGHT_ROWS_8][WEIGHT_COLS_8];
+    alignas(64) float biases5[NUM_FILTERS_8];
+    alignas(64) float weights6[WEIGHT_ROWS_9][WEIGHT_COLS_9];
+    alignas(64) float biases6[NUM_FILTERS_9];
+
+    // Conv weights repacked into GEMM_MR panels at load time
+    alignas(64) float packed1[PACKED_WEIGHTS_SIZE(NUM_FILTERS_1, INPUT_FILTERS_1, KERNEL_SIZE_1)];
+    alignas(64) float packed2[PACKED_WEIGHTS_SIZE(NUM_FILTERS_3, INPUT_FILTERS_3, KERNEL_SIZE_3)];
+    alignas(64) float packed3[PACKED_WEIGHTS_SIZE(NUM_FILTERS_5, INPUT_FILTERS_5, KERNEL_SIZE_5)];
+
+    // FC weights packed the same way (kernel_size 1) for the batched GEMM path
+    alignas(64) float packed4[PACKED_WEIGHTS_SIZE(WEIGHT_ROWS_7, WEIGHT_COLS_7, 1)];
+    alignas(64) float packed5[PACKED_WEIGHTS_SIZE(WEIGHT_ROWS_8, WEIGHT_COLS_8, 1)];
+    alignas(64) float packed6[PACKED_WEIGHTS_SIZE(WEIGHT_ROWS_9, WEIGHT_COLS_9, 1)];
+
+    // Layer 5 weights in the Winograd domain, see winogradTransformWeights
+    alignas(64) float winograd3[WINOGRAD_WEIGHTS_SIZE(NUM_FILTERS_5, INPUT_FILTERS_5)];
+
+    // Conv weights packed for NCHWc inputs, layer 1 reads the planar image as blocks of 1 channel
+    alignas(64) float blocked1[BLOCKED_WEIGHTS_SIZE(NUM_FILTERS_1, INPUT_FILTERS_1, KERNEL_SIZE_1)];
+    alignas(64) float blocked2[BLOCKED_WEIGHTS_SIZE(NUM_FILTERS_3, INPUT_FILTERS_3, KERNEL_SIZE_3)];
+    alignas(64) float blocked3[BLOCKED_WEIGHTS_SIZE(NUM_FILTERS_5, INPUT_FILTERS_5, KERNEL_SIZE_5)];
+
+    // Set at load time, they share the padding after the last tensor so the size and the file layout don't change
+    int conv_algorithm;
+    TuningPlan tuning; // the plan of CONV_TUNED
 } Params;
 
+// Per image state: the input and the flattened FC activations, which the batched FC layers read across a
+// whole ImageBatch. The conv stack intermediates live in the Workspace of the worker running the pass.
 typedef struct ImageData {
     // float image[MAX_IMAGE_HEIGHT][MAX_IMAGE_WIDTH][MAX_IMAGE_CHANNELS][MAX_IMAGE_FILTERS];
     float image[INPUT_FILTERS_1][INPUT_ROWS_1 + 2 * PADDING_1][INPUT_COLS_1 + 2 * PADDING_1];
-    float layer_1[INPUT_FILTERS_2][INPUT_ROWS_2 + 2 * PADDING_2][INPUT_COLS_2 + 2 * PADDING_2];
-    float layer_2[INPUT_FILTERS_3][INPUT_ROWS_3 + 2 * PADDING_3][INPUT_COLS_3 + 2 * PADDING_3];
-    float layer_3[INPUT_FILTERS_4][INPUT_ROWS_4 + 2 * PADDING_4][INPUT_COLS_4 + 2 * PADDING_4];
-    float layer_4[INPUT_FILTERS_5][INPUT_ROWS_5 + 2 * PADDING_5][INPUT_COLS_5 + 2 * PADDING_5];
-    float layer_5[INPUT_FILTERS_6][INPUT_ROWS_6 + 2 * PADDING_6][INPUT_COLS_6 + 2 * PADDING_6];
     float layer_6[INPUT_COLS_7];
     float layer_7[INPUT_COLS_8];
     float layer_8[INPUT_COLS_9];
@@ -137,31 +191,158 @@ typedef struct ImageData {
     int height;
 } ImageData;
 
-int forwardPass(ImageData& inputData, Params& param);
+// Conv stack working set of one worker, allocated once by allocateWorkspace and reused for every image.
+// A layer's input is dead once its output is written, so activations share buffers by liveness:
+// layer_1, layer_3 and layer_5 are each consumed by the pool right after them and are never live together.
+// layer_2 and layer_4 keep their own buffers since the fused layers go from one straight to the other,
+// which also leaves both intact after a pass.
+typedef struct Workspace {
+    union {
+        alignas(64) float layer_1[INPUT_FILTERS_2][INPUT_ROWS_2 + 2 * PADDING_2][INPUT_COLS_2 + 2 * PADDING_2];
+        float layer_3[INPUT_FILTERS_4][INPUT_ROWS_4 + 2 * PADDING_4][INPUT_COLS_4 + 2 * PADDING_4];
+        float layer_5[INPUT_FILTERS_6][INPUT_ROWS_6 + 2 * PADDING_6][INPUT_COLS_6 + 2 * PADDING_6];
+    };
+    alignas(64) float layer_2[INPUT_FILTERS_3][INPUT_ROWS_3 + 2 * PADDING_3][INPUT_COLS_3 + 2 * PADDING_3];
+    alignas(64) float layer_4[INPUT_FILTERS_5][INPUT_ROWS_5 + 2 * PADDING_5][INPUT_COLS_5 + 2 * PADDING_5];
+    alignas(64) float col_buffer[COL_BUFFER_SIZE];
+} Workspace;
+
+// A runtime-sized batch of preprocessed images, see allocateBatch
+typedef struct ImageBatch {
+    int capacity;
+    int size;
+    ImageData* images;
+    int* labels;               // class index of each image, -1 if unknown
+    float* packed_activations; // FC input panels, ROUND_UP(capacity, GEMM_NR) * INPUT_COLS_7 floats
+    Workspace* workspace;      // shared by the images, their conv stacks run one after the other
+} ImageBatch;
+
+// An image path and its class index, from the folder it was found in or its manifest line (-1 if unknown)
+typedef struct DatasetEntry {
+    std::string path;
+    int label;
+} DatasetEntry;
+
+// Called for every image found by walkDataset, returning false stops the scan
+typedef bool (*ImageVisitor)(const char* imagePath, int label, void* context);
+
+int forwardPass(ImageData& inputData, Workspace& workspace, const Params& param);
+
+// Layers 1-6 with param.conv_algorithm, leaving the flattened feature map in layer_6
+void convStack(ImageData& inputData, Workspace& workspace, const Params& param);
+
+// Index of the highest of the TOTAL_CLASSES scores
+int predictedClass(const float* scores);
+
+// Compares the Winograd layer 5 against the direct convolution on a pseudo-random input, returns the
+// largest absolute difference relative to the largest output magnitude
+float winogradError(Params& param);
+
+// Runs the network over batch.size images, the FC layers as matrix-matrix products over the whole batch
+void forwardBatch(ImageBatch& batch, const Params& param, int* predictions);
+
+// The FC layers of forwardBatch on images whose layer_6 is filled: one GEMM per layer over the batch if gemm,
+// otherwise image by image
+void fcLayersBatch(ImageBatch& batch, const Params& param, bool gemm);
+
+void allocateBatch(ImageBatch& batch, int capacity);
+
+void freeBatch(ImageBatch& batch);
+
+// A zeroed, 64-byte aligned Workspace, one per thread running forward passes
+Workspace* allocateWorkspace();
+
+void freeWorkspace(Workspace* workspace);
+
+// Each layer reads the activation of the layer before it and sets inputData's shape to the one it wrote,
+// every size comes from the layer types in network.h
+void layer_1_conv(ImageData& inputData, Workspace& workspace, const Params& param);
+
+void layer_2_max_pool(ImageData& inputData, Workspace& workspace);
+
+void layer_3_conv(ImageData& inputData, Workspace& workspace, const Params& param);
+
+void layer_4_max_pool(ImageData& inputData, Workspace& workspace);
+
+void layer_5_conv(ImageData& inputData, Workspace& workspace, const Params& param);
+
+void layer_6_max_pool_flatten(ImageData& inputData, Workspace& workspace);
+
+// Fused conv + relu + 2x2 max pool: layer_1_2 writes layer_2, layer_3_4 writes layer_4 and layer_5_6 writes the
+// flattened layer_6 straight from the GEMM accumulators, layer_1, layer_3 and layer_5 are never written.
+// With CONV_NCHWC layer_2 and layer_4 hold NCHWc blocked tensors (same size, the filter counts are whole blocks).
+void layer_1_2_conv_pool(ImageData& inputData, Workspace& workspace, const Params& param);
+
+void layer_3_4_conv_pool(ImageData& inputData, Workspace& workspace, const Params& param);
+
+void layer_5_6_conv_pool_flatten(ImageData& inputData, Workspace& workspace, const Params& param);
+
+void layer_7_fc(ImageData& inputData, const Params& param);
+
+void layer_8_fc(ImageData& inputData, const Params& param);
+
+void layer_9_fc(ImageData& inputData, const Params& param);
+
+// test_set_size counts every image scored, unlabelled_cases the ones in no class folder, which have no right answer
+void loadDataset(const char* folderPath, ImageData& imageData, int& test_set_size, int padding, const Params& param, cv::Mat& image,
+                 int& correct_cases, int& unlabelled_cases);
+
+// Same as loadDataset but scores images batch.capacity at a time through forwardBatch
+void loadDatasetBatched(const char* folderPath, ImageBatch& batch, int& test_set_size, int padding, const Params& param, cv::Mat& image,
+                        int& correct_cases, int& unlabelled_cases);
+
+// Same as loadDatasetBatched but spreads the images over num_threads workers (0 = one per hardware thread),
+// each with its own ImageBatch of batch_size images, all sharing param read-only
+void loadDatasetParallel(const char* folderPath, int& test_set_size, int padding, const Params& param, int& correct_cases,
+                         int& unlabelled_cases, int num_threads, int batch_size);
+
+// folderPath is a folder of class subfolders or a manifest file, see dataset_scan.h. Images that can't be read
+// are reported on stderr and left out of test_set_size.
+void walkDataset(const char* folderPath, ImageVisitor visit, void* context);
+
+// Appends every image below folderPath (or listed in a manifest) to entries, sorted by path
+void listDataset(const char* folderPath, std::vector<DatasetEntry>& entries);
+
+// Decodes, resizes, normalizes and pads one image into imageData.image, returns false if it can't be read
+bool preprocessImage(const char* imagePath, ImageData& imageData, cv::Mat& image, int padding);
+
+// Resizes, normalizes and pads an already decoded BGR image into imageData.image
+void preprocessMat(cv::Mat& image, ImageData& imageData, int padding);
+
+// The steps of preprocessImage. decodeImage leaves a BGR image at least as large as the network input,
+// resizeImage brings it to INPUT_ROWS_1 x INPUT_COLS_1, normalizeImage scales it into imageData.image
+bool decodeImage(const char* imagePath, cv::Mat& image);
 
-void layer_1_conv(ImageData& inputData, Params& param, int padding, int further_padding, int stride, int kernel_size, int out_filters,
-                  int in_filters);
+void resizeImage(cv::Mat& image);
 
-void layer_2_max_pool(ImageData& inputData, int padding, int further_padding, int stride, int kernel_size, int in_filters);
+void normalizeImage(const cv::Mat& image, ImageData& imageData, int padding);
 
-void layer_3_conv(ImageData& inputData, Params& param, int padding, int further_padding, int stride, int kernel_size, int out_filters,
-                  int in_filters);
+// Copies an INPUT_FILTERS_1 x INPUT_ROWS_1 x INPUT_COLS_1 tensor, normalized like normalizeImage, into imageData.image
+void tensorImage(const float* tensor, ImageData& imageData, int padding);
 
-void layer_4_max_pool(ImageData& inputData, int padding, int further_padding, int stride, int kernel_size, int in_filters);
+// Fills imageData with the same deterministic pixels in [-1, 1) every call, the range normalizeImage produces,
+// padded by PADDING_1. The input of the benchmarks and of autotune.
+void syntheticImage(ImageData& imageData);
 
-void layer_5_conv(ImageData& inputData, Params& param, int padding, int further_padding, int stride, int kernel_size, int out_filters,
-                  int in_filters);
+// Sets imageData's shape to the padded network input and zeroes its padding border
+void padImage(ImageData& imageData, int padding);
 
-void layer_6_max_pool_flatten(ImageData& inputData, int padding, int stride, int kernel_size, int out_filters, int in_filters);
+// Class names in the order of the layer_9 scores, also the folder names of the dataset
+extern const char* monkey_classes[];
 
-void layer_7_fc(ImageData& inputData, Params& param, int rows, int cols);
+// Index of className in monkey_classes, -1 if it isn't a known class
+int classIndex(const char* className);
 
-void layer_8_fc(ImageData& inputData, Params& param, int rows, int cols);
+// A zeroed, 64-byte aligned Params for weights that don't live in a static or a mapped model
+Params* allocateParams();
 
-void layer_9_fc(ImageData& inputData, Params& param, int rows, int cols);
+void freeParams(Params* params);
 
-void loadDataset(const char* folderPath, ImageData& imageData, int& test_set_size, int padding, Params& param, cv::Mat& image, int &correct_cases);
+// Parses the text parameter file, returns false if it can't be read or any line has the wrong number of values
+bool loadParams(const char* paramPath, Params& params);
 
-void loadParams(const char* paramPath, Params& params);
+// Fills the packed, Winograd and blocked copies from the plain weights and biases, and selects CONV_NCHWC with
+// the default tuning plan. loadParams ends with it.
+void packParams(Params& params);
 
 #endif // CNN_H
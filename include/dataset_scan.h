@@ -0,0 +1,42 @@
+#ifndef DATASET_SCAN_H
+#define DATASET_SCAN_H
+
+#include "cnn.h"
+
+//-------------------------------------------------------------DATASET SCAN---------------------------------------------------//
+
+// Streams the images of a dataset to any number of consumers while it is still being enumerated, so evaluation
+// starts on the first image instead of after a full walk of a tree that may hold millions.
+//
+// A source is either a folder of class subfolders, scanned by scan_threads threads that share a queue of
+// directories, or a manifest file listing one image per line:
+//   <path>[<TAB><label>]
+// where label is a class name of monkey_classes or its index. Without a label the image is labelled by the folder
+// it lives in, so `find <folder> -name '*.jpg' > manifest` is a valid manifest. Relative paths are relative to the
+// manifest's folder, blank lines and lines starting with # are ignored.
+//
+// Entries come out in no particular order. Unreadable folders, unknown file types and malformed manifest lines are
+// reported on stderr and skipped, they never end the scan.
+
+#define DEFAULT_SCAN_THREADS 4
+#define SCAN_QUEUE_CAPACITY 4096 // entries found ahead of the consumers before the scanners wait
+
+typedef struct DatasetScan DatasetScan;
+
+typedef struct ScanStats {
+    long directories; // folders read, or 1 for a manifest
+    long images;      // entries handed out or still queued
+    long errors;      // folders that couldn't be opened, entries that couldn't be stat'ed, malformed manifest lines
+} ScanStats;
+
+// Starts enumerating source on scan_threads threads (0 = DEFAULT_SCAN_THREADS, a manifest always uses one).
+// A source that is neither a folder nor a file is reported and yields no entries.
+DatasetScan* startDatasetScan(const char* source, int scan_threads);
+
+// Waits for the next entry, returns false once every entry has been handed out. Safe to call from many threads.
+bool nextDatasetEntry(DatasetScan& scan, DatasetEntry& entry);
+
+// Stops the scanners if entries are left, joins them and frees the scan. stats may be NULL.
+void finishDatasetScan(DatasetScan* scan, ScanStats* stats);
+
+#endif // DATASET_SCAN_H
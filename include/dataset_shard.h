@@ -0,0 +1,78 @@
+#ifndef DATASET_SHARD_H
+#define DATASET_SHARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cnn.h"
+
+//-------------------------------------------------------------DATASET SHARD--------------------------------------------------//
+
+// A test set packed once by pack_dataset so evaluation runs skip the directory walk, the JPEG decode and the resize.
+// File layout:
+//   ShardHeader | ShardEntry[capacity] | image names | zero fill up to data_offset (a page multiple) | records
+// Each record is one resized image in the planar channel order of ImageData.image, either as uint8 pixels or
+// already normalized floats. Records sit at fixed slots so the packer can write them in parallel, images that
+// failed to decode leave their slot unused and have no entry.
+
+#define SHARD_MAGIC "LNSHARD1"
+#define SHARD_VERSION 1
+#define SHARD_PAGE_SIZE 4096
+
+enum ShardDtype {
+    SHARD_DTYPE_U8 = 0,  // filters x rows x cols pixels, normalized on load
+    SHARD_DTYPE_FP32 = 1 // filters x rows x cols floats, (pixel - MEAN) / STD
+};
+
+typedef struct ShardHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t count;    // entries in the index
+    uint32_t capacity; // slots reserved for the index and the records
+    uint32_t filters;  // InputImage shape the records were resized to
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t record_bytes;
+    uint64_t data_offset; // first record
+    uint64_t file_size;
+    uint64_t checksum; // modelChecksum of everything after the header
+} ShardHeader;
+
+typedef struct ShardEntry {
+    uint64_t offset;      // of the record, from data_offset
+    int32_t label;        // class index in monkey_classes, -1 if the folder isn't a known class
+    uint32_t name_offset; // of the NUL terminated path relative to the packed folder, from the end of the index
+} ShardEntry;
+
+// A shard file mapped read-only into memory
+typedef struct MappedShard {
+    void* base;
+    size_t size;
+    const ShardHeader* header;
+    const ShardEntry* entries;
+    const char* names;
+    const uint8_t* data;
+} MappedShard;
+
+// Decodes and resizes every image below folderPath on num_threads threads (0 = one per hardware thread) and
+// writes them to path as dtype records, returns the number of images packed or -1 if the file can't be written
+int packDataset(const char* folderPath, const char* path, int dtype, int num_threads);
+
+// Maps a shard after validating its header and index against this build's input shape, and optionally its checksum
+bool mapShard(const char* path, MappedShard& shard, bool verify_checksum);
+
+void unmapShard(MappedShard& shard);
+
+// Relative path the image of entry i was packed from
+const char* shardName(const MappedShard& shard, uint32_t i);
+
+// Writes the image of entry i into imageData.image the way preprocessImage would
+void shardImage(const MappedShard& shard, uint32_t i, ImageData& imageData, int padding);
+
+// Same as loadDatasetParallel but streams the images of a shard file instead of decoding a folder,
+// returns false if the shard can't be mapped
+bool loadDatasetShard(const char* shardPath, int& test_set_size, int padding, const Params& param, int& correct_cases,
+                      int& unlabelled_cases, int num_threads, int batch_size);
+
+#endif // DATASET_SHARD_H
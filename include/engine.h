@@ -0,0 +1,70 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stddef.h>
+
+#include "cnn.h"
+#include "jpeg_decoder.h"
+#include "shared_model.h"
+
+//-------------------------------------------------------------EMBEDDING API--------------------------------------------------//
+
+// An Engine holds the weights and the tuning plan, which are never written once loadEngine returns, so any number of threads may
+// share one. Every buffer a forward pass writes belongs to a Session instead, each thread classifying on an
+// Engine needs its own. Sessions are cheap next to an Engine but not free: a Workspace, max_batch ImageData
+// and a JPEG decoder. lenet.h wraps this API for C callers.
+
+typedef struct Engine {
+    const Params* params;
+    Params* owned;        // a text parameter file is parsed into this, NULL for a mapped binary model
+    MappedModel model;    // the mapping of a binary model
+    SharedModel shared;   // the attachment of a shm:<name> model
+    float winograd_error; // winogradError of the weights, 0 unless a Winograd or the tuned algorithm was asked for
+} Engine;
+
+typedef struct Session {
+    const Engine* engine;
+    ImageBatch batch; // inputs and activations of up to batch.capacity images, plus the conv Workspace
+    int* predictions;
+    JpegDecoder* decoder;
+    cv::Mat image; // decoded image before preprocessMat
+} Session;
+
+typedef struct Classification {
+    int prediction;              // index in monkey_classes, -1 if the image couldn't be decoded
+    float scores[TOTAL_CLASSES]; // layer_9
+} Classification;
+
+// Loads a text parameter file, a binary model written by convert_params or, for shm:<name>, attaches to a model
+// published by publish_model (see shared_model.h). conv_algorithm < 0 keeps the model's default. tuning is copied
+// into the engine for CONV_TUNED, NULL keeps defaultTuningPlan. Winograd weights whose error exceeds
+// WINOGRAD_TOLERANCE fall back to CONV_FUSED_GEMM, for CONV_TUNED only in a Winograd last stage of the copied plan.
+// Returns NULL if the model can't be loaded.
+Engine* loadEngine(const char* modelPath, int conv_algorithm, const TuningPlan* tuning);
+
+// Every Session created on engine must be freed first
+void freeEngine(Engine* engine);
+
+// True if engine is attached to a shared model that has been published again since
+bool engineOutdated(const Engine& engine);
+
+// A new Engine on the current generation of engine's shared model with the same conv_algorithm and tuning plan,
+// NULL on failure
+Engine* reloadEngine(const Engine& engine);
+
+// A Session classifying up to max_batch images per forwardBatch call
+Session* createSession(const Engine& engine, int max_batch);
+
+void freeSession(Session* session);
+
+// Classifies one encoded image (JPEG, or anything cv::imdecode reads), returns false if it can't be decoded
+bool classifyImage(Session& session, const unsigned char* data, size_t size, Classification& result);
+
+// Classifies one INPUT_FILTERS_1 x INPUT_ROWS_1 x INPUT_COLS_1 tensor normalized like normalizeImage
+void classifyTensor(Session& session, const float* tensor, Classification& result);
+
+// Classifies count encoded images, batch.capacity at a time. Images that can't be decoded get prediction -1,
+// returns how many could.
+int classifyImages(Session& session, const unsigned char* const* data, const size_t* sizes, int count, Classification* results);
+
+#endif // ENGINE_H
@@ -0,0 +1,57 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <stddef.h>
+
+//-------------------------------------------------------------FILE READER----------------------------------------------------//
+
+// Reads whole files with up to depth reads in flight, so ingestion from a cold cache or a network volume is paced
+// by the bandwidth of the storage instead of the latency of one file at a time.
+//
+// The io_uring backend queues the opens and reads in the kernel from the calling thread, straight into buffers
+// registered once with the ring. Where io_uring isn't available (old kernel, disabled by sysctl or seccomp) depth
+// threads do blocking reads into the same buffers. A completed read is used in place, decodeImageBuffer decodes
+// straight from it, and its buffer goes back to the reader with releaseFileRead.
+//
+// submitFileRead and waitFileRead belong to one thread, releaseFileRead may be called from any.
+
+enum FileReaderBackend {
+    FILE_READER_AUTO = 0, // io_uring if the kernel allows it, threads otherwise
+    FILE_READER_URING,
+    FILE_READER_THREADS
+};
+
+#define FILE_READER_DEPTH 32
+#define FILE_READER_BUFFER_BYTES (256 << 10) // larger files are finished into a heap buffer of their own
+
+typedef struct FileReader FileReader;
+
+typedef struct FileRead {
+    const unsigned char* data; // valid until releaseFileRead
+    size_t size;
+    int error;  // errno of the failed open or read, 0 on success
+    int buffer; // to hand back with releaseFileRead
+    void* user; // as given to submitFileRead
+} FileRead;
+
+// A reader with buffers buffers of buffer_bytes (at least depth, the rest cover reads held by the consumers).
+// Returns NULL if backend is FILE_READER_URING and io_uring can't be set up.
+FileReader* createFileReader(int depth, int buffers, size_t buffer_bytes, int backend);
+
+// Every buffer must have been released
+void freeFileReader(FileReader* reader);
+
+// FILE_READER_URING or FILE_READER_THREADS
+int fileReaderBackend(const FileReader& reader);
+
+const char* fileReaderBackendName(int backend);
+
+// Queues a read of the whole file, returns false without queueing if depth reads are in flight or no buffer is free
+bool submitFileRead(FileReader& reader, const char* path, void* user);
+
+// Waits for the next completed read, returns false if none is in flight
+bool waitFileRead(FileReader& reader, FileRead& read);
+
+void releaseFileRead(FileReader& reader, int buffer);
+
+#endif // FILE_READER_H
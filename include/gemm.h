@@ -0,0 +1,28 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+//-------------------------------------------------------------IM2COL + SGEMM-------------------------------------------------//
+
+// Register tile of the SGEMM micro-kernel: GEMM_MR output filters x GEMM_NR output pixels
+#define GEMM_MR 8
+#define GEMM_NR 16
+
+// Output pixels lowered by im2col per cache block (must be a multiple of GEMM_NR)
+#define GEMM_NC 128
+
+// Pooled pixels per column panel / cache block of the fused conv + 2x2 max pool (4 conv pixels each)
+#define GEMM_POOL_NR (GEMM_NR / 4)
+#define GEMM_POOL_NC (GEMM_NC / 4)
+
+// Rounds n up to the next multiple of m
+#define ROUND_UP(n, m) ((((n) + (m)-1) / (m)) * (m))
+
+// Size (in floats) of a weight matrix packed into GEMM_MR row panels
+#define PACKED_WEIGHTS_SIZE(out_filters, in_filters, kernel_size)                                                                  \
+    (ROUND_UP(out_filters, GEMM_MR) * (in_filters) * (kernel_size) * (kernel_size))
+
+// Repacks a [out][in][k][k] weight tensor into GEMM_MR row panels laid out k-major,
+// so the micro-kernel reads GEMM_MR consecutive filters for each reduction step.
+void packConvWeights(const float* weights, float* packed, int out_filters, int in_filters, int kernel_size);
+
+#endif // GEMM_H
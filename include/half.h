@@ -0,0 +1,60 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cnn.h"
+
+//-------------------------------------------------------------16 BIT WEIGHTS-------------------------------------------------//
+
+// weights1-6 stored as 16 bit floats, half the bytes of Params for every layer to stream. The dot_f16 / dot_bf16
+// kernels widen them to fp32 in registers, products and sums stay fp32 so the only error is the weight rounding.
+// fp16 keeps 11 significant bits down to 6e-8 and overflows above 65504, bf16 keeps 8 over the whole fp32 range.
+
+enum HalfFormat {
+    HALF_FP16 = 0,
+    HALF_BF16
+};
+
+// Weights laid out [out][in * k * k] like QuantParams, biases stay fp32 so the half path never reads Params
+typedef struct HalfParams {
+    alignas(64) uint16_t weights1[NUM_FILTERS_1][INPUT_FILTERS_1 * KERNEL_SIZE_1 * KERNEL_SIZE_1];
+    alignas(64) uint16_t weights2[NUM_FILTERS_3][INPUT_FILTERS_3 * KERNEL_SIZE_3 * KERNEL_SIZE_3];
+    alignas(64) uint16_t weights3[NUM_FILTERS_5][INPUT_FILTERS_5 * KERNEL_SIZE_5 * KERNEL_SIZE_5];
+    alignas(64) uint16_t weights4[WEIGHT_ROWS_7][WEIGHT_COLS_7];
+    alignas(64) uint16_t weights5[WEIGHT_ROWS_8][WEIGHT_COLS_8];
+    alignas(64) uint16_t weights6[WEIGHT_ROWS_9][WEIGHT_COLS_9];
+    float biases1[NUM_FILTERS_1];
+    float biases2[NUM_FILTERS_3];
+    float biases3[NUM_FILTERS_5];
+    float biases4[NUM_FILTERS_7];
+    float biases5[NUM_FILTERS_8];
+    float biases6[NUM_FILTERS_9];
+    int format; // HalfFormat
+} HalfParams;
+
+// How far the 16 bit path drifts from fp32 over a dataset
+typedef struct HalfReport {
+    int images;
+    int fp32_correct;
+    int half_correct;
+    int agreement;         // images where both paths predict the same class
+    float max_logit_error; // largest |layer_9 difference| over the images
+    size_t fp32_bytes;     // of weights1-6 in Params
+    size_t half_bytes;     // of weights1-6 in HalfParams
+} HalfReport;
+
+// "fp16" or "bf16"
+const char* halfFormatName(int format);
+
+// Rounds weights1-6 to format (nearest even) and copies the biases, returns the largest rounding error
+float convertWeights(const Params& param, HalfParams& hparams, int format);
+
+// 16 bit weight counterpart of forwardPass, inputData.image must be preprocessed as for forwardPass
+int forwardPassHalf(ImageData& inputData, Workspace& workspace, const HalfParams& hparams);
+
+// Runs every image below folderPath through both paths
+void evaluateHalf(const char* folderPath, const Params& param, const HalfParams& hparams, int padding, HalfReport& report);
+
+#endif // HALF_H
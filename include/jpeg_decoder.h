@@ -0,0 +1,35 @@
+#ifndef JPEG_DECODER_H
+#define JPEG_DECODER_H
+
+#include <stddef.h>
+
+#include <opencv4/opencv2/opencv.hpp>
+
+//-------------------------------------------------------------SCALED JPEG DECODE---------------------------------------------//
+
+// libjpeg can run its inverse DCT at n/8 of the full size (n = 1..8), which skips most of the IDCT, upsampling
+// and colour conversion work a full decode spends on pixels cv::resize throws away. The decoders below pick the
+// smallest such scale that still covers min_rows x min_cols, so preprocessMat only has a short resize left.
+// A JpegDecoder keeps its libjpeg decompressor and scratch buffers between images, one per decoding thread.
+
+typedef struct JpegDecoder JpegDecoder;
+
+JpegDecoder* createJpegDecoder();
+
+void freeJpegDecoder(JpegDecoder* decoder);
+
+// The calling thread's decoder, created on first use and freed when the thread exits
+JpegDecoder& threadJpegDecoder();
+
+// Decodes a JPEG into a BGR image of at least min_rows x min_cols (the full image if it is smaller), with its
+// EXIF orientation applied as cv::imread does. Returns false if libjpeg can't decode it to BGR (not a JPEG,
+// CMYK, corrupt), the caller should then fall back to OpenCV.
+bool decodeJpeg(JpegDecoder& decoder, const unsigned char* data, size_t size, int min_rows, int min_cols, cv::Mat& image);
+
+// Same as decodeJpeg, reading the file at path
+bool decodeJpegFile(JpegDecoder& decoder, const char* path, int min_rows, int min_cols, cv::Mat& image);
+
+// decodeJpeg with the cv::imdecode fallback, for any encoded image held in memory. Returns false if neither can decode it.
+bool decodeImageBuffer(JpegDecoder& decoder, const unsigned char* data, size_t size, int min_rows, int min_cols, cv::Mat& image);
+
+#endif // JPEG_DECODER_H
@@ -0,0 +1,419 @@
+#ifndef LAYERS_H
+#define LAYERS_H
+
+#include "cnn.h"
+#include "simd.h"
+
+//-------------------------------------------------------------LAYER OPERATORS------------------------------------------------//
+
+// Operators instantiated per layer type from network.h, so every loop bound, stride and padding below is a
+// compile time constant. Activations are the [filters][height][width] planes of their Activation type,
+// padding ring included, or the NCHWc blocked equivalent where noted. Only the innermost ISA micro-kernels are
+// called through the KernelTable: it is chosen at run time, so they take their sizes as arguments.
+
+// Zeroes the padding ring of A, each pixel Block floats wide (1 for planes, NCHWC_BLOCK for blocked tensors)
+template <class A, int Block>
+void zeroPadding(float* planes) {
+    if (A::padding == 0) {
+        return;
+    }
+    for (int f = 0; f < A::filters / Block; f++) {
+        float* plane = planes + f * A::height * A::width * Block;
+        for (int i = 0; i < A::height; i++) {
+            bool border_row = i < A::padding || i >= A::height - A::padding;
+            for (int j = 0; j < A::width; j++) {
+                if (border_row || j < A::padding || j >= A::width - A::padding) {
+                    memset(plane + (i * A::width + j) * Block, 0, Block * sizeof(float));
+                }
+            }
+        }
+    }
+}
+
+// Sliding window conv + relu over [out][in][k][k] weights
+template <class L>
+void convDirect(const float* input, const float* weights, const float* biases, float* output) {
+    typedef typename L::Input In;
+    typedef typename L::Output Out;
+
+    for (int out_f = 0; out_f < Out::filters; out_f++) {
+        for (int row = 0; row < Out::rows; row++) {
+            for (int col = 0; col < Out::cols; col++) {
+                float sum = 0;
+                for (int in_f = 0; in_f < In::filters; in_f++) {
+                    const float* window = input + (in_f * In::height + L::stride * row) * In::width + L::stride * col;
+                    const float* w = weights + (out_f * In::filters + in_f) * L::kernel_size * L::kernel_size;
+                    for (int i = 0; i < L::kernel_size; i++) {
+                        for (int j = 0; j < L::kernel_size; j++) {
+                            sum += window[i * In::width + j] * w[i * L::kernel_size + j];
+                        }
+                    }
+                }
+                output[(out_f * Out::height + row + Out::padding) * Out::width + col + Out::padding] = relu(sum + biases[out_f]);
+            }
+        }
+    }
+}
+
+// Gathers the L receptive fields whose top-left corners are at offset[0, valid) into one GEMM_NR column panel,
+// k-major, zero filling the columns past valid
+template <class L>
+void lowerPanel(const float* input, const int* offset, int valid, float* dst) {
+    typedef typename L::Input In;
+
+    int k = 0;
+    for (int in_f = 0; in_f < In::filters; in_f++) {
+        for (int i = 0; i < L::kernel_size; i++) {
+            for (int j = 0; j < L::kernel_size; j++) {
+                const float* src = input + (in_f * In::height + i) * In::width + j;
+                for (int c = 0; c < valid; c++) {
+                    dst[k * GEMM_NR + c] = src[offset[c]];
+                }
+                for (int c = valid; c < GEMM_NR; c++) {
+                    dst[k * GEMM_NR + c] = 0;
+                }
+                k++;
+            }
+        }
+    }
+}
+
+// im2col + SGEMM conv + relu over weights packed by packConvWeights.
+// col_buffer must hold L::reduction * GEMM_NC floats.
+template <class L>
+void convGemm(const float* input, const float* packed_weights, const float* biases, float* output, float* col_buffer) {
+    typedef typename L::Input In;
+    typedef typename L::Output Out;
+    const int N = Out::rows * Out::cols;
+    const int m_panels = ROUND_UP(Out::filters, GEMM_MR) / GEMM_MR;
+    const KernelTable& kernels = activeKernels();
+    float acc[GEMM_MR][GEMM_NR];
+
+    for (int n0 = 0; n0 < N; n0 += GEMM_NC) {
+        int nc = (N - n0 < GEMM_NC) ? N - n0 : GEMM_NC;
+
+        // Lower output pixels [n0, n0 + nc) into GEMM_NR column panels, the tail panel zero filled
+        for (int np = 0; np * GEMM_NR < nc; np++) {
+            int offset[GEMM_NR];
+            int valid = 0;
+            for (int j = 0; j < GEMM_NR && np * GEMM_NR + j < nc; j++) {
+                int n = n0 + np * GEMM_NR + j;
+                offset[valid++] = (n / Out::cols) * L::stride * In::width + (n % Out::cols) * L::stride;
+            }
+            lowerPanel<L>(input, offset, valid, col_buffer + np * L::reduction * GEMM_NR);
+        }
+
+        for (int np = 0; np * GEMM_NR < nc; np++) {
+            const float* b = col_buffer + np * L::reduction * GEMM_NR;
+
+            for (int mp = 0; mp < m_panels; mp++) {
+                kernels.gemm_micro_kernel(L::reduction, packed_weights + mp * L::reduction * GEMM_MR, b, &acc[0][0]);
+
+                // Bias + relu epilogue, scattered back into the padded output planes
+                for (int i = 0; i < GEMM_MR && mp * GEMM_MR + i < Out::filters; i++) {
+                    int out_f = mp * GEMM_MR + i;
+                    float* plane = output + out_f * Out::height * Out::width;
+                    for (int j = 0; j < GEMM_NR && np * GEMM_NR + j < nc; j++) {
+                        int n = n0 + np * GEMM_NR + j;
+                        float val = acc[i][j] + biases[out_f];
+                        plane[(n / Out::cols + Out::padding) * Out::width + n % Out::cols + Out::padding] = (val > 0) ? val : 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The fused operators below pool the conv output of C with P, which must be an unpadded 2x2 / 2 max pool of it
+template <class C, class P>
+constexpr bool fusablePool() {
+    return P::kernel_size == 2 && P::stride == 2 && C::Output::padding == 0 && P::Input::filters == C::Output::filters &&
+           P::Input::rows == C::Output::rows && P::Input::cols == C::Output::cols;
+}
+
+// convGemm + relu + P, straight from the GEMM accumulators, lowering block pooled pixels at a time (a multiple of
+// GEMM_POOL_NR, GEMM_POOL_NC unless tuned). col_buffer must hold C::reduction * 4 * block floats.
+template <class C, class P>
+void convPoolGemm(const float* input, const float* packed_weights, const float* biases, float* output, float* col_buffer,
+                  int block) {
+    static_assert(fusablePool<C, P>(), "Only a 2x2 / 2 pool of the conv output can be fused");
+    typedef typename C::Input In;
+    typedef typename P::Output Out;
+    const int N = Out::rows * Out::cols;
+    const int m_panels = ROUND_UP(Out::filters, GEMM_MR) / GEMM_MR;
+    const KernelTable& kernels = activeKernels();
+    float acc[GEMM_MR][GEMM_NR];
+
+    for (int p0 = 0; p0 < N; p0 += block) {
+        int pc = (N - p0 < block) ? N - p0 : block;
+
+        // Each pooled pixel contributes the 4 conv pixels of its 2x2 window as consecutive columns,
+        // so a panel holds GEMM_POOL_NR whole windows
+        for (int np = 0; np * GEMM_POOL_NR < pc; np++) {
+            int offset[GEMM_NR];
+            int valid = 0;
+            for (int q = 0; q < GEMM_POOL_NR && np * GEMM_POOL_NR + q < pc; q++) {
+                int n = p0 + np * GEMM_POOL_NR + q;
+                int row0 = 2 * (n / Out::cols);
+                int col0 = 2 * (n % Out::cols);
+                for (int w = 0; w < 4; w++) {
+                    offset[valid++] = (row0 + w / 2) * C::stride * In::width + (col0 + w % 2) * C::stride;
+                }
+            }
+            lowerPanel<C>(input, offset, valid, col_buffer + np * C::reduction * GEMM_NR);
+        }
+
+        for (int np = 0; np * GEMM_POOL_NR < pc; np++) {
+            const float* b = col_buffer + np * C::reduction * GEMM_NR;
+
+            for (int mp = 0; mp < m_panels; mp++) {
+                kernels.gemm_micro_kernel(C::reduction, packed_weights + mp * C::reduction * GEMM_MR, b, &acc[0][0]);
+
+                // Max over each window straight from the accumulators, then bias + relu: both are monotonic,
+                // so this matches pooling the activated conv output exactly
+                for (int i = 0; i < GEMM_MR && mp * GEMM_MR + i < Out::filters; i++) {
+                    int out_f = mp * GEMM_MR + i;
+                    float* plane = output + out_f * Out::height * Out::width;
+                    for (int q = 0; q < GEMM_POOL_NR && np * GEMM_POOL_NR + q < pc; q++) {
+                        const float* window = &acc[i][4 * q];
+                        float max_val = window[0];
+                        if (window[1] > max_val) max_val = window[1];
+                        if (window[2] > max_val) max_val = window[2];
+                        if (window[3] > max_val) max_val = window[3];
+
+                        int n = p0 + np * GEMM_POOL_NR + q;
+                        float val = max_val + biases[out_f];
+                        plane[(n / Out::cols + Out::padding) * Out::width + n % Out::cols + Out::padding] = (val > 0) ? val : 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Same on NCHWc tensors: input blocked by InBlock channels, output by NCHWC_BLOCK
+template <class C, class P, int InBlock>
+void convPoolBlocked(const float* input, const float* blocked_weights, const float* biases, float* output) {
+    static_assert(fusablePool<C, P>(), "Only a 2x2 / 2 pool of the conv output can be fused");
+    static_assert(C::Input::filters % InBlock == 0 && P::Output::filters % NCHWC_BLOCK == 0, "Channels must be whole blocks");
+    static_assert(P::Output::cols >= NCHWC_TILE / 2, "Rows narrower than a tile");
+    typedef typename C::Input In;
+    typedef typename P::Output Out;
+    const int block_stride = In::height * In::width * InBlock;
+    const int row_stride = In::width * InBlock;
+    const int pixel_stride = C::stride * InBlock;
+    const int conv_width = 2 * Out::cols;
+    const KernelTable& kernels = activeKernels();
+
+    // Two conv rows of one tile, their 2x2 windows are pooled before anything is stored
+    float acc[2][NCHWC_TILE][NCHWC_BLOCK];
+
+    for (int ob = 0; ob < Out::filters / NCHWC_BLOCK; ob++) {
+        const float* weights = blocked_weights + ob * C::reduction * NCHWC_BLOCK;
+        const float* bias = biases + ob * NCHWC_BLOCK;
+        float* plane = output + ob * Out::height * Out::width * NCHWC_BLOCK;
+
+        for (int row = 0; row < Out::rows; row++) {
+            for (int c0 = 0; c0 < conv_width; c0 += NCHWC_TILE) {
+                // The last tile is moved back to end at the row edge, recomputing a few pixels instead of reading past it
+                int col0 = (c0 + NCHWC_TILE > conv_width) ? conv_width - NCHWC_TILE : c0;
+
+                for (int r = 0; r < 2; r++) {
+                    const float* src = input + (2 * row + r) * C::stride * row_stride + col0 * pixel_stride;
+                    kernels.nchwc_conv_tile(src, weights, In::filters / InBlock, InBlock, C::kernel_size, block_stride,
+                                            row_stride, pixel_stride, &acc[r][0][0]);
+                }
+
+                for (int q = 0; q < NCHWC_TILE / 2; q++) {
+                    float* dst = plane + ((row + Out::padding) * Out::width + col0 / 2 + q + Out::padding) * NCHWC_BLOCK;
+                    for (int o = 0; o < NCHWC_BLOCK; o++) {
+                        float max_val = acc[0][2 * q][o];
+                        if (acc[0][2 * q + 1][o] > max_val) max_val = acc[0][2 * q + 1][o];
+                        if (acc[1][2 * q][o] > max_val) max_val = acc[1][2 * q][o];
+                        if (acc[1][2 * q + 1][o] > max_val) max_val = acc[1][2 * q + 1][o];
+                        float val = max_val + bias[o];
+                        dst[o] = (val > 0) ? val : 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Winograd F(2x2, 3x3) conv + relu of C into the Out planes. With Pool each 2x2 output tile is max pooled into
+// one pixel of Out, otherwise Out is C::Output. scratch must hold WINOGRAD_SCRATCH_SIZE(C::Input::filters) floats.
+template <class C, class Out, bool Pool>
+void winogradTiles(const float* input, const float* transformed_weights, const float* biases, float* output, float* scratch) {
+    static_assert(C::stride == 1 && C::kernel_size == 3, "Winograd F(2x2, 3x3) needs a stride 1 3x3 conv");
+    static_assert(C::Output::rows % 2 == 0 && C::Output::cols % 2 == 0, "Winograd F(2x2, 3x3) needs an even output size");
+    typedef typename C::Input In;
+    const int tiles_x = C::Output::cols / 2;
+    const int tiles = (C::Output::rows / 2) * tiles_x;
+    const int m_panels = ROUND_UP(Out::filters, GEMM_MR) / GEMM_MR;
+    const int point_stride = PACKED_WEIGHTS_SIZE(Out::filters, In::filters, 1);
+    const KernelTable& kernels = activeKernels();
+
+    // Products of one GEMM_MR x GEMM_NR block of (filter, tile) pairs for every point
+    float acc[WINOGRAD_POINTS][GEMM_MR][GEMM_NR];
+    float m[WINOGRAD_POINTS];
+    float v[WINOGRAD_POINTS];
+
+    for (int t0 = 0; t0 < tiles; t0 += GEMM_NR) {
+        int tc = (tiles - t0 < GEMM_NR) ? tiles - t0 : GEMM_NR;
+
+        // Transformed inputs, one k-major GEMM_NR panel per point with the input filters as the reduction dimension
+        for (int in_f = 0; in_f < In::filters; in_f++) {
+            for (int j = 0; j < GEMM_NR; j++) {
+                if (j < tc) {
+                    int t = t0 + j;
+                    winogradTransformInput(input + (in_f * In::height + 2 * (t / tiles_x)) * In::width + 2 * (t % tiles_x),
+                                           In::width, v);
+                } else {
+                    memset(v, 0, sizeof(v));
+                }
+                for (int xi = 0; xi < WINOGRAD_POINTS; xi++) {
+                    scratch[(xi * In::filters + in_f) * GEMM_NR + j] = v[xi];
+                }
+            }
+        }
+
+        for (int mp = 0; mp < m_panels; mp++) {
+            for (int xi = 0; xi < WINOGRAD_POINTS; xi++) {
+                kernels.gemm_micro_kernel(In::filters, transformed_weights + xi * point_stride + mp * In::filters * GEMM_MR,
+                                          scratch + xi * In::filters * GEMM_NR, &acc[xi][0][0]);
+            }
+
+            for (int i = 0; i < GEMM_MR && mp * GEMM_MR + i < Out::filters; i++) {
+                int out_f = mp * GEMM_MR + i;
+                float* plane = output + out_f * Out::height * Out::width;
+                for (int j = 0; j < tc; j++) {
+                    for (int xi = 0; xi < WINOGRAD_POINTS; xi++) {
+                        m[xi] = acc[xi][i][j];
+                    }
+                    float y[2][2];
+                    winogradTransformOutput(m, y);
+
+                    int t = t0 + j;
+                    int row = t / tiles_x;
+                    int col = t % tiles_x;
+                    if (Pool) {
+                        // The 2x2 output tile is exactly one pooling window, bias + relu commute with the max
+                        float max_val = y[0][0];
+                        if (y[0][1] > max_val) max_val = y[0][1];
+                        if (y[1][0] > max_val) max_val = y[1][0];
+                        if (y[1][1] > max_val) max_val = y[1][1];
+                        float val = max_val + biases[out_f];
+                        plane[(row + Out::padding) * Out::width + col + Out::padding] = (val > 0) ? val : 0;
+                    } else {
+                        for (int r = 0; r < 2; r++) {
+                            float* out_row = plane + (2 * row + r + Out::padding) * Out::width + 2 * col + Out::padding;
+                            for (int c = 0; c < 2; c++) {
+                                float val = y[r][c] + biases[out_f];
+                                out_row[c] = (val > 0) ? val : 0;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Winograd F(2x2, 3x3) conv + relu over weights transformed by winogradTransformWeights
+template <class C>
+void convWinograd(const float* input, const float* transformed_weights, const float* biases, float* output, float* scratch) {
+    winogradTiles<C, typename C::Output, false>(input, transformed_weights, biases, output, scratch);
+}
+
+// convWinograd + relu + P, each 2x2 output tile being one pooling window
+template <class C, class P>
+void convPoolWinograd(const float* input, const float* transformed_weights, const float* biases, float* output, float* scratch) {
+    static_assert(fusablePool<C, P>(), "Only a 2x2 / 2 pool of the conv output can be fused");
+    winogradTiles<C, typename P::Output, true>(input, transformed_weights, biases, output, scratch);
+}
+
+// Max pool of L::Input planes
+template <class L>
+void maxPool(const float* input, float* output) {
+    typedef typename L::Input In;
+    typedef typename L::Output Out;
+
+    for (int f = 0; f < Out::filters; f++) {
+        const float* in_plane = input + f * In::height * In::width;
+        float* out_plane = output + f * Out::height * Out::width;
+
+        if (L::kernel_size == 2 && L::stride == 2) {
+            const KernelTable& kernels = activeKernels();
+            for (int row = 0; row < Out::rows; row++) {
+                kernels.max_pool_2x2_row(in_plane + 2 * row * In::width, in_plane + (2 * row + 1) * In::width,
+                                         out_plane + (row + Out::padding) * Out::width + Out::padding, Out::cols);
+            }
+            continue;
+        }
+
+        for (int row = 0; row < Out::rows; row++) {
+            for (int col = 0; col < Out::cols; col++) {
+                const float* window = in_plane + L::stride * row * In::width + L::stride * col;
+                float max_val = INT32_MIN;
+                for (int i = 0; i < L::kernel_size; i++) {
+                    for (int j = 0; j < L::kernel_size; j++) {
+                        if (window[i * In::width + j] > max_val) {
+                            max_val = window[i * In::width + j];
+                        }
+                    }
+                }
+                out_plane[(row + Out::padding) * Out::width + col + Out::padding] = max_val;
+            }
+        }
+    }
+}
+
+// output = act(weights x input + biases) over [outputs][inputs] weights
+template <class L>
+void fullyConnected(const float* weights, const float* biases, const float* input, float* output) {
+    const KernelTable& kernels = activeKernels();
+    for (int n = 0; n < L::outputs; n++) {
+        float val = kernels.dot(weights + n * L::inputs, input, L::inputs) + biases[n];
+        output[n] = L::relu ? relu(val) : val;
+    }
+}
+
+// fullyConnected for every vector of a batch as one GEMM over weights packed by packConvWeights (kernel_size 1),
+// so each weight panel is loaded once for the whole batch. Vector n starts at input + n * input_stride /
+// output + n * output_stride, and packed_inputs must hold ROUND_UP(batch_size, GEMM_NR) * L::inputs floats.
+template <class L>
+void fullyConnectedBatch(const float* packed_weights, const float* biases, const float* input, int input_stride,
+                         float* output, int output_stride, int batch_size, float* packed_inputs) {
+    const int m_panels = ROUND_UP(L::outputs, GEMM_MR) / GEMM_MR;
+    int n_panels = ROUND_UP(batch_size, GEMM_NR) / GEMM_NR;
+    const KernelTable& kernels = activeKernels();
+    float acc[GEMM_MR][GEMM_NR];
+
+    // Transpose the batch into GEMM_NR column panels, k-major
+    for (int np = 0; np < n_panels; np++) {
+        float* dst = packed_inputs + np * L::inputs * GEMM_NR;
+        for (int j = 0; j < GEMM_NR; j++) {
+            int n = np * GEMM_NR + j;
+            for (int k = 0; k < L::inputs; k++) {
+                dst[k * GEMM_NR + j] = (n < batch_size) ? input[n * input_stride + k] : 0;
+            }
+        }
+    }
+
+    for (int mp = 0; mp < m_panels; mp++) {
+        for (int np = 0; np < n_panels; np++) {
+            const float* b = packed_inputs + np * L::inputs * GEMM_NR;
+            kernels.gemm_micro_kernel(L::inputs, packed_weights + mp * L::inputs * GEMM_MR, b, &acc[0][0]);
+
+            for (int i = 0; i < GEMM_MR && mp * GEMM_MR + i < L::outputs; i++) {
+                int m = mp * GEMM_MR + i;
+                for (int j = 0; j < GEMM_NR && np * GEMM_NR + j < batch_size; j++) {
+                    float val = acc[i][j] + biases[m];
+                    output[(np * GEMM_NR + j) * output_stride + m] = (L::relu && val < 0) ? 0 : val;
+                }
+            }
+        }
+    }
+}
+
+#endif // LAYERS_H
@@ -0,0 +1,76 @@
+#ifndef LENET_H
+#define LENET_H
+
+#include <stddef.h>
+
+/* C interface of the classifier, a thin wrapper over engine.h for programs that can't link C++. An engine holds
+   the weights and may be shared by any number of threads, each thread classifies through its own session. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LENET_CLASSES 10
+
+/* Values of lenet_engine_load's conv_algorithm, the same as ConvAlgorithm in cnn.h */
+enum lenet_conv_algorithm {
+    LENET_CONV_DEFAULT = -1, /* whatever the model file selects */
+    LENET_CONV_DIRECT = 0,
+    LENET_CONV_IM2COL_GEMM = 1,
+    LENET_CONV_FUSED_GEMM = 2,
+    LENET_CONV_FUSED_WINOGRAD = 3,
+    LENET_CONV_NCHWC = 4,
+    LENET_CONV_TUNED = 5 /* the per-layer plan of autotune.h, the default one here, see lenet_engine_load_tuned */
+};
+
+typedef struct lenet_engine lenet_engine;
+typedef struct lenet_session lenet_session;
+
+typedef struct lenet_result {
+    int class_index; /* see lenet_class_name, -1 if the image couldn't be decoded */
+    float scores[LENET_CLASSES];
+} lenet_result;
+
+/* Loads a text parameter file, a binary model or a shared model given as "shm:<name>", returns NULL on failure
+   (the reason is printed to stderr) */
+lenet_engine* lenet_engine_load(const char* model_path, int conv_algorithm);
+
+/* lenet_engine_load with LENET_CONV_TUNED and the plan cached for this CPU in tuning_cache, a file written by
+   Lenet_monkey_cnn --autotune (NULL for lenet_tuning.txt in the working directory). Without a cache entry for
+   this CPU the default plan runs. Returns NULL if the model can't be loaded */
+lenet_engine* lenet_engine_load_tuned(const char* model_path, const char* tuning_cache);
+
+/* Every session of the engine must be freed first */
+void lenet_engine_free(lenet_engine* engine);
+
+/* 1 if the engine is attached to a shared model that has been published again since, load a new engine to pick
+   the new weights up. 0 otherwise */
+int lenet_engine_outdated(const lenet_engine* engine);
+
+/* A session classifying up to max_batch images per batched call, NULL on failure */
+lenet_session* lenet_session_create(const lenet_engine* engine, int max_batch);
+
+void lenet_session_free(lenet_session* session);
+
+/* Classifies one encoded image, returns 0 on success and -1 if it can't be decoded */
+int lenet_classify_image(lenet_session* session, const void* data, size_t size, lenet_result* result);
+
+/* Classifies one channels x rows x cols float tensor (see lenet_input_shape), pixels mapped to (p - 127.5) / 127.5
+   in RGB plane order. Returns 0 on success. */
+int lenet_classify_tensor(lenet_session* session, const float* tensor, lenet_result* result);
+
+/* Classifies count encoded images in batches, returns how many could be decoded or -1 on failure */
+int lenet_classify_images(lenet_session* session, const void* const* data, const size_t* sizes, int count,
+                          lenet_result* results);
+
+/* Shape lenet_classify_tensor expects */
+void lenet_input_shape(int* channels, int* rows, int* cols);
+
+/* Name of a class index, NULL if out of range */
+const char* lenet_class_name(int class_index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LENET_H */
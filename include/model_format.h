@@ -0,0 +1,81 @@
+#ifndef MODEL_FORMAT_H
+#define MODEL_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cnn.h"
+
+//-------------------------------------------------------------BINARY MODEL FORMAT--------------------------------------------//
+
+// File layout:
+//   ModelHeader | TensorDesc[tensor_count] | zero fill up to header_size (a page multiple) | Params image
+// The data section is a byte-for-byte image of Params, including the packed weights, so a mapped file
+// is used by the kernels in place. The tensor table describes where each Params field lives so a file
+// written for a different Params layout is rejected instead of silently misread.
+
+#define MODEL_MAGIC "LNMONKEY"
+#define MODEL_VERSION 3 // 2: blocked1 packed for the planar image, 3: packing constants in the header
+#define MODEL_PAGE_SIZE 4096
+#define MODEL_MAX_TENSORS 32
+
+enum ModelDtype {
+    MODEL_DTYPE_FP32 = 0
+};
+
+typedef struct ModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t tensor_count;
+    uint32_t header_size; // bytes before the data section
+    uint64_t data_size;   // bytes in the data section, sizeof(Params) when written
+    uint64_t checksum;    // modelChecksum of the data section
+    // The packed weights are laid out for these, the tensor table alone can't tell a different build apart
+    uint32_t gemm_mr;
+    uint32_t nchwc_block;
+    uint32_t winograd_tile;
+    uint8_t reserved[12];
+} ModelHeader;
+
+typedef struct TensorDesc {
+    char name[16];
+    uint32_t rank;
+    uint32_t dims[4];
+    uint32_t reserved;
+    uint64_t offset; // from the start of the data section
+    uint64_t bytes;
+    uint8_t padding[8];
+} TensorDesc;
+
+// A model file mapped into memory, params points into the mapping
+typedef struct MappedModel {
+    void* base;
+    size_t size;
+    Params* params;
+} MappedModel;
+
+// Word-wise FNV-1a over size bytes (size must be a multiple of 8)
+uint64_t modelChecksum(const void* data, size_t size);
+
+// True if path starts with MODEL_MAGIC
+bool isBinaryModel(const char* path);
+
+// Bytes before the data section, a page multiple
+size_t modelHeaderSize();
+
+// Fills the modelHeaderSize() bytes at header_page with the header and tensor table describing params
+void writeModelHeader(const Params& params, void* header_page);
+
+// Writes params (weights and packed weights) in the binary format
+bool saveModel(const char* path, const Params& params);
+
+// Maps a binary model copy-on-write after validating its header, tensor table and optionally its checksum
+bool mapModel(const char* path, MappedModel& model, bool verify_checksum);
+
+// mapModel of an open file or shared memory object, name is only used in messages. fd may be closed afterwards
+bool mapModelFd(int fd, const char* name, MappedModel& model, bool verify_checksum);
+
+void unmapModel(MappedModel& model);
+
+#endif // MODEL_FORMAT_H
@@ -0,0 +1,30 @@
+#ifndef NCHWC_H
+#define NCHWC_H
+
+#include "gemm.h"
+
+//-------------------------------------------------------------BLOCKED NCHWc LAYOUT-------------------------------------------//
+
+// Activations are stored as [filters / block][rows][cols][block]: the block channels of a pixel are
+// contiguous, so a conv broadcasts one input value against a vector of NCHWC_BLOCK output channels
+// without gathering anything. Weights are packed to match by packBlockedWeights.
+#define NCHWC_BLOCK 16
+
+// Output pixels of one row computed per kernel call, each pair of them is a 2x2 pooling window column
+#define NCHWC_TILE 8
+
+// Size (in floats) of a weight tensor packed by packBlockedWeights
+#define BLOCKED_WEIGHTS_SIZE(out_filters, in_filters, kernel_size)                                                                 \
+    (ROUND_UP(out_filters, NCHWC_BLOCK) * (in_filters) * (kernel_size) * (kernel_size))
+
+// Repacks a [out][in][k][k] weight tensor for inputs blocked by in_block channels into
+// [out / NCHWC_BLOCK][in / in_block][k][k][in_block][NCHWC_BLOCK], zero filling missing output channels
+void packBlockedWeights(const float* weights, float* blocked, int out_filters, int in_filters, int kernel_size, int in_block);
+
+// [filters][rows][cols] planes to [filters / block][rows][cols][block], filters must be a multiple of block
+void reorderToBlocked(const float* planes, float* blocked, int filters, int rows, int cols, int block);
+
+// Inverse of reorderToBlocked
+void reorderFromBlocked(const float* blocked, float* planes, int filters, int rows, int cols, int block);
+
+#endif // NCHWC_H
@@ -0,0 +1,71 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+//-------------------------------------------------------------LAYER DESCRIPTORS----------------------------------------------//
+
+// Every shape of the network is a compile time constant: each layer is described by a type whose members
+// are derived from the layer before it, and the operators in layers.h are instantiated per layer type.
+
+constexpr int outputSize(int in, int padding, int kernel_size, int stride) {
+    return (in + 2 * padding - kernel_size) / stride + 1;
+}
+
+// Filters planes of Rows x Cols pixels, stored inside a zero ring of Padding pixels
+template <int Filters, int Rows, int Cols, int Padding>
+struct Activation {
+    static constexpr int filters = Filters;
+    static constexpr int rows = Rows;
+    static constexpr int cols = Cols;
+    static constexpr int padding = Padding;
+    static constexpr int height = Rows + 2 * Padding; // stored plane size
+    static constexpr int width = Cols + 2 * Padding;
+    static constexpr int size = Filters * height * width;
+};
+
+// Convolution + relu of In, the output planes get an OutPadding ring for the next layer
+template <class In, int OutFilters, int KernelSize, int Stride, int OutPadding>
+struct ConvLayer {
+    typedef In Input;
+    typedef Activation<OutFilters, outputSize(In::rows, In::padding, KernelSize, Stride),
+                       outputSize(In::cols, In::padding, KernelSize, Stride), OutPadding>
+        Output;
+    static constexpr int kernel_size = KernelSize;
+    static constexpr int stride = Stride;
+    static constexpr int reduction = In::filters * KernelSize * KernelSize; // weights per output filter
+};
+
+// Max pooling of In
+template <class In, int KernelSize, int Stride, int OutPadding>
+struct PoolLayer {
+    typedef In Input;
+    typedef Activation<In::filters, outputSize(In::rows, In::padding, KernelSize, Stride),
+                       outputSize(In::cols, In::padding, KernelSize, Stride), OutPadding>
+        Output;
+    static constexpr int kernel_size = KernelSize;
+    static constexpr int stride = Stride;
+};
+
+// Fully connected layer, outputs = act(weights[Outputs][Inputs] x inputs + biases)
+template <int Inputs, int Outputs, bool Relu>
+struct FcLayer {
+    static constexpr int inputs = Inputs;
+    static constexpr int outputs = Outputs;
+    static constexpr bool relu = Relu;
+};
+
+//------------------------------------------------------------Lenet-Configuration------------------------------//
+
+typedef Activation<3, 128, 128, 1> InputImage;
+
+typedef ConvLayer<InputImage, 16, 3, 2, 0> Layer1Conv;
+typedef PoolLayer<Layer1Conv::Output, 2, 2, 1> Layer2Pool;
+typedef ConvLayer<Layer2Pool::Output, 32, 3, 2, 0> Layer3Conv;
+typedef PoolLayer<Layer3Conv::Output, 2, 2, 1> Layer4Pool;
+typedef ConvLayer<Layer4Pool::Output, 64, 3, 1, 0> Layer5Conv;
+typedef PoolLayer<Layer5Conv::Output, 2, 2, 0> Layer6Pool; // flattened into the FC input
+
+typedef FcLayer<Layer6Pool::Output::size, 100, true> Layer7Fc;
+typedef FcLayer<Layer7Fc::outputs, 50, true> Layer8Fc;
+typedef FcLayer<Layer8Fc::outputs, 10, false> Layer9Fc;
+
+#endif // NETWORK_H
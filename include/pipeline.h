@@ -0,0 +1,137 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cnn.h"
+#include "file_reader.h"
+
+//-------------------------------------------------------------PIPELINE-------------------------------------------------------//
+
+// Bounded lock-free multi-producer/multi-consumer queue (Vyukov). Each cell carries a sequence number
+// telling producers and consumers whose turn it is, so neither side ever takes a lock.
+template <typename T> class BoundedQueue {
+  public:
+    // capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        cells = new Cell[size];
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        enqueue_pos.store(0, std::memory_order_relaxed);
+        dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~BoundedQueue() {
+        delete[] cells;
+    }
+
+    bool tryPush(const T& value) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Racy snapshot of the number of queued items, only meant for statistics
+    size_t sizeApprox() const {
+        size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+        size_t head = dequeue_pos.load(std::memory_order_relaxed);
+        return (tail > head) ? tail - head : 0;
+    }
+
+  private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+
+    Cell* cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+};
+
+typedef struct PipelineConfig {
+    int reader_threads;  // file I/O
+    int decoder_threads; // JPEG decode + resize + normalize
+    int infer_threads;   // forwardPass
+    int queue_capacity;  // depth of each inter-stage queue
+    int io_depth;        // file reads each reader keeps in flight
+    int io_backend;      // FileReaderBackend
+} PipelineConfig;
+
+#define PIPELINE_STAGES 3
+
+// Where the threads of one stage spent their time, summed over the stage's threads
+typedef struct StageStats {
+    const char* name;
+    int threads;
+    long items;
+    double busy_seconds;    // doing the stage's work
+    double starved_seconds; // waiting for input from the previous stage
+    double blocked_seconds; // waiting for room in the next stage's queue
+    double input_depth;     // average fill of the input queue seen on each pop
+} StageStats;
+
+typedef struct PipelineStats {
+    StageStats stages[PIPELINE_STAGES];
+    double wall_seconds;
+    int io_backend; // FileReaderBackend the readers ended up with
+} PipelineStats;
+
+// Default stage sizes for this machine: one reader with FILE_READER_DEPTH reads in flight, the remaining cores split
+// between decode and inference
+void defaultPipelineConfig(PipelineConfig& config);
+
+// Same as loadDataset but overlaps file reads, decode/preprocess and inference on separate thread pools
+void loadDatasetPipelined(const char* folderPath, int& test_set_size, int padding, const Params& param, int& correct_cases,
+                          int& unlabelled_cases, const PipelineConfig& config, PipelineStats* stats);
+
+// Prints the per stage table, the read backend and the wall time on stderr, stdout only carries the results scripts parse
+void printPipelineStats(const PipelineStats& stats);
+
+#endif // PIPELINE_H
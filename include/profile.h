@@ -0,0 +1,81 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+//-------------------------------------------------------------HOT PATH PROFILING---------------------------------------------//
+
+// Built with -DCNN_PROFILE=ON, every PROFILE_SCOPE records the calls, TSC cycles and wall time of its stage
+// and, when perf_event_open is allowed, the instructions retired and cache misses of the calling thread.
+// Each thread counts into its own ProfileSlab, the slabs are summed into the report printed to stderr at exit.
+// Without CNN_PROFILE PROFILE_SCOPE expands to nothing, so instrumented code compiles exactly as before.
+
+// Stages are inclusive, forwardPass also counts the time of the layers it runs
+enum ProfileStage {
+    PROFILE_DECODE = 0, // JPEG decode in preprocessImage and the pipeline decoders
+    PROFILE_RESIZE,     // cv::resize in preprocessMat
+    PROFILE_NORMALIZE,  // the rest of preprocessMat
+    PROFILE_FORWARD_PASS,
+    PROFILE_FORWARD_BATCH,
+    PROFILE_FORWARD_INT8,
+    PROFILE_FORWARD_HALF,
+    PROFILE_LAYER_1_CONV,
+    PROFILE_LAYER_2_MAX_POOL,
+    PROFILE_LAYER_3_CONV,
+    PROFILE_LAYER_4_MAX_POOL,
+    PROFILE_LAYER_5_CONV,
+    PROFILE_LAYER_6_MAX_POOL_FLATTEN,
+    PROFILE_LAYER_1_2_CONV_POOL,
+    PROFILE_LAYER_3_4_CONV_POOL,
+    PROFILE_LAYER_5_6_CONV_POOL_FLATTEN,
+    PROFILE_LAYER_7_FC,
+    PROFILE_LAYER_7_FC_SPARSE,
+    PROFILE_LAYER_8_FC,
+    PROFILE_LAYER_9_FC,
+    PROFILE_FC_BATCH, // the batched FC GEMMs of forwardBatch
+    PROFILE_STAGES
+};
+
+#ifdef CNN_PROFILE
+
+// Counter values at one point of a thread's execution
+typedef struct ProfileSample {
+    uint64_t cycles;
+    uint64_t nanoseconds;
+    uint64_t instructions; // 0 without perf counters
+    uint64_t cache_misses;
+} ProfileSample;
+
+void profileRead(ProfileSample& sample);
+
+// Adds the difference between start and now to the calling thread's totals of stage
+void profileRecord(int stage, const ProfileSample& start);
+
+// Sums every thread's totals and prints them, also registered with atexit on first use
+void profileReport();
+
+class ProfileScope {
+  public:
+    explicit ProfileScope(int stage) : stage_(stage) {
+        profileRead(start_);
+    }
+    ~ProfileScope() {
+        profileRecord(stage_, start_);
+    }
+
+  private:
+    int stage_;
+    ProfileSample start_;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
+
+#else
+
+#define PROFILE_SCOPE(stage)
+
+#endif // CNN_PROFILE
+
+#endif // PROFILE_H
@@ -0,0 +1,53 @@
+#ifndef QUANT_H
+#define QUANT_H
+
+#include <stdint.h>
+
+#include "cnn.h"
+
+//-------------------------------------------------------------INT8 QUANTIZATION----------------------------------------------//
+
+// Inputs of the quantized layers: conv 1, conv 3, conv 5, fc 7, fc 8, fc 9
+#define QUANT_LAYERS 6
+
+// Symmetric INT8 copy of Params: per output channel weight scales, per layer input activation scales.
+// Layer N computes relu(sum(q_in * q_w) * input_scale * weight_scale[out] + bias[out]) in float, the
+// pooling layers between them run on the float outputs.
+typedef struct QuantParams {
+    alignas(64) int8_t weights1[NUM_FILTERS_1][INPUT_FILTERS_1 * KERNEL_SIZE_1 * KERNEL_SIZE_1];
+    alignas(64) int8_t weights2[NUM_FILTERS_3][INPUT_FILTERS_3 * KERNEL_SIZE_3 * KERNEL_SIZE_3];
+    alignas(64) int8_t weights3[NUM_FILTERS_5][INPUT_FILTERS_5 * KERNEL_SIZE_5 * KERNEL_SIZE_5];
+    alignas(64) int8_t weights4[WEIGHT_ROWS_7][WEIGHT_COLS_7];
+    alignas(64) int8_t weights5[WEIGHT_ROWS_8][WEIGHT_COLS_8];
+    alignas(64) int8_t weights6[WEIGHT_ROWS_9][WEIGHT_COLS_9];
+    float weight_scales1[NUM_FILTERS_1];
+    float weight_scales2[NUM_FILTERS_3];
+    float weight_scales3[NUM_FILTERS_5];
+    float weight_scales4[WEIGHT_ROWS_7];
+    float weight_scales5[WEIGHT_ROWS_8];
+    float weight_scales6[WEIGHT_ROWS_9];
+    float input_scales[QUANT_LAYERS];
+} QuantParams;
+
+// How far the INT8 path drifts from fp32 over a dataset
+typedef struct QuantReport {
+    int images;
+    int fp32_correct;
+    int int8_correct;
+    int agreement; // images where both paths predict the same class
+} QuantReport;
+
+// Quantizes weights1-6 per output channel
+void quantizeWeights(const Params& param, QuantParams& qparams);
+
+// Sets input_scales from the largest activation magnitudes seen while running up to max_images images
+// below folderPath through the fp32 forwardPass (0 = all), returns the number of images used
+int calibrateActivations(const char* folderPath, const Params& param, QuantParams& qparams, int max_images);
+
+// INT8 counterpart of forwardPass, inputData.image must be preprocessed as for forwardPass
+int forwardPassInt8(ImageData& inputData, Workspace& workspace, const Params& param, const QuantParams& qparams);
+
+// Runs every image below folderPath through both paths
+void evaluateInt8(const char* folderPath, const Params& param, const QuantParams& qparams, int padding, QuantReport& report);
+
+#endif // QUANT_H
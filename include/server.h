@@ -0,0 +1,71 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+#include "engine.h"
+
+//-------------------------------------------------------------INFERENCE SERVER-----------------------------------------------//
+
+// Long running classifier on a Unix domain socket, the model is loaded once by main --serve. Every connection
+// gets a thread that reads and preprocesses its requests, requests of all connections are queued for the
+// inference threads, which run them through forwardBatch max_batch at a time. A batch starts as soon as it
+// is full or its oldest request has waited max_wait_us, so a lone client only pays the wait once.
+//
+// An engine attached to a shared model (shm:<name>) is reloaded within SERVER_RELOAD_CHECK_MS of a new publish.
+// Batches already running finish on the old weights, the ones after run on the new.
+//
+// Wire protocol, in host byte order since both ends are on the same machine: a ServerRequest header followed by
+// size payload bytes, answered by one ServerResponse. A connection may send any number of requests, one at a time.
+
+#define SERVER_REQUEST_MAGIC 0x51524E4Cu  // "LNRQ"
+#define SERVER_RESPONSE_MAGIC 0x53524E4Cu // "LNRS"
+#define SERVER_MAX_PAYLOAD (64 << 20)
+#define SERVER_RELOAD_CHECK_MS 500
+
+enum ServerRequestType {
+    SERVER_REQUEST_ENCODED = 0, // an image file as stored on disk, anything preprocessImage can read
+    SERVER_REQUEST_TENSOR = 1   // INPUT_FILTERS_1 x INPUT_ROWS_1 x INPUT_COLS_1 floats, normalized like normalizeImage
+};
+
+enum ServerStatus {
+    SERVER_OK = 0,
+    SERVER_BAD_REQUEST,  // wrong magic, unknown type or a payload size that doesn't fit the type
+    SERVER_BAD_IMAGE,    // the encoded image could not be decoded
+    SERVER_SHUTTING_DOWN // the request arrived after SIGINT / SIGTERM
+};
+
+typedef struct ServerRequest {
+    uint32_t magic;
+    uint32_t type; // ServerRequestType
+    uint32_t size; // payload bytes that follow
+    uint32_t reserved;
+} ServerRequest;
+
+typedef struct ServerResponse {
+    uint32_t magic;
+    int32_t status;     // ServerStatus
+    int32_t prediction; // index in monkey_classes, -1 unless status is SERVER_OK
+    uint32_t reserved;
+    float scores[TOTAL_CLASSES]; // layer_9
+} ServerResponse;
+
+typedef struct ServerConfig {
+    int max_batch;     // requests per forwardBatch call
+    int max_wait_us;   // how long the oldest queued request may wait for the batch to fill
+    int infer_threads; // batches running at the same time
+} ServerConfig;
+
+// Batches of up to 16, 2 ms of waiting, one inference thread per 4 cores
+void defaultServerConfig(ServerConfig& config);
+
+// Serves requests on socketPath with engine until SIGINT or SIGTERM, returns false if the socket can't be set up
+bool runServer(const char* socketPath, const Engine& engine, const ServerConfig& config);
+
+// Client side: the connected socket, -1 if nothing listens on socketPath
+int connectServer(const char* socketPath);
+
+// Sends one request and waits for its response, returns false if the connection broke
+bool classifyRemote(int fd, uint32_t type, const void* payload, uint32_t size, ServerResponse& response);
+
+#endif // SERVER_H
@@ -0,0 +1,83 @@
+#ifndef SHARDED_EVAL_H
+#define SHARDED_EVAL_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "cnn.h"
+
+//-------------------------------------------------------------SHARDED EVALUATION---------------------------------------------//
+
+// Spreads the evaluation of one dataset over worker processes, on this machine or, through a launcher command
+// such as "ssh node1", on others. An image belongs to shard fnv1a(its path below the dataset root) % shard_count,
+// so every worker given the same dataset picks the same images wherever the dataset is mounted.
+//
+// The coordinator starts the workers with their stdin and stdout on a socket and hands out one shard at a time,
+// a worker answers with the confusion matrix of its shard and the coordinator merges them. A shard whose worker
+// dies, stops answering for timeout_s or can't read the whole shard goes back in the queue for a fresh worker,
+// up to max_attempts times.
+//
+// Wire protocol, in host byte order since every node runs the same build: an EvalRequest from the coordinator,
+// answered by one EvalResult, until the coordinator sends EVAL_SHUTDOWN or hangs up.
+
+#define EVAL_REQUEST_MAGIC 0x51455645u // "EVEQ"
+#define EVAL_RESULT_MAGIC 0x52455645u  // "EVER"
+#define EVAL_SHUTDOWN 0xffffffffu      // EvalRequest.shard telling the worker to exit
+#define EVAL_MAX_ATTEMPTS 3
+
+typedef struct EvalRequest {
+    uint32_t magic;
+    uint32_t shard;
+    uint32_t shard_count;
+    uint32_t reserved;
+} EvalRequest;
+
+typedef struct EvalResult {
+    uint32_t magic;
+    uint32_t shard;
+    int32_t status;      // 0, or the errno of what kept the shard from being read in full
+    uint32_t images;     // evaluated, unlabelled ones included
+    uint32_t unlabelled; // images in no class folder, left out of the accuracy
+    uint32_t unreadable; // images that couldn't be decoded, left out of images
+    uint32_t confusion[TOTAL_CLASSES][TOTAL_CLASSES]; // [label][prediction]
+} EvalResult;
+
+// Merged EvalResults
+typedef struct EvalCounts {
+    long images;
+    long unlabelled;
+    long unreadable;
+    long confusion[TOTAL_CLASSES][TOTAL_CLASSES];
+} EvalCounts;
+
+typedef struct EvalConfig {
+    int shards;
+    int workers;      // running at the same time
+    int max_attempts; // per shard
+    int timeout_s;    // per shard attempt, 0 = wait forever
+    std::vector<std::string> launchers;   // command prefixes the workers are started through, round robin, empty = local
+    std::vector<std::string> worker_args; // arguments of every worker, --eval-worker included
+} EvalConfig;
+
+typedef struct EvalStats {
+    int shards;
+    int workers_started;
+    int retries; // shard attempts that failed
+    int failed;  // shards given up after max_attempts, missing from the counts
+} EvalStats;
+
+// Shard of an image, relativePath being its path below the dataset root
+int imageShard(const char* relativePath, int shard_count);
+
+// Worker side: evaluates the shards requested on in_fd and answers on out_fd until EVAL_SHUTDOWN or end of file
+bool runEvalWorker(int in_fd, int out_fd, const char* folderPath, const Params& param);
+
+// Coordinator side: runs config.shards shards on worker processes, returns false if any shard failed for good
+bool runEvalCoordinator(const EvalConfig& config, EvalCounts& counts, EvalStats& stats);
+
+// Accuracy per class and overall, and the confusion matrix
+void printEvalCounts(const EvalCounts& counts, const EvalStats& stats);
+
+#endif // SHARDED_EVAL_H
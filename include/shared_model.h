@@ -0,0 +1,50 @@
+#ifndef SHARED_MODEL_H
+#define SHARED_MODEL_H
+
+#include <stdint.h>
+
+#include "model_format.h"
+
+//-------------------------------------------------------------SHARED MODEL---------------------------------------------------//
+
+// One loader publishes a model under a name, any number of worker processes on the host attach to it instead of
+// parsing their own copy. A publish writes a complete binary model image (model_format.h) into a new POSIX shared
+// memory object /<name>.<generation>, makes it read-only, and only then bumps the generation in the control
+// object /<name>. An attach therefore sees the old model or the new one, never a mix. The previous image is
+// unlinked at once: processes that mapped it keep it until they detach, new attaches get the new one.
+//
+// Workers map the image copy-on-write like mapModel, so the weight pages exist once per host however many
+// processes use them. Publishers are serialized by a lock on the control object.
+
+#define SHARED_MODEL_PREFIX "shm:" // loadEngine treats shm:<name> as a shared model
+#define SHARED_MODEL_MAGIC "LNSHARED"
+#define SHARED_MODEL_NAME_LENGTH 200
+
+typedef struct SharedModelControl {
+    char magic[8];
+    uint64_t generation; // of the current image, 0 until the first publish, read and written atomically
+    uint8_t reserved[48];
+} SharedModelControl;
+
+typedef struct SharedModel {
+    MappedModel model;
+    const SharedModelControl* control; // mapped read-only, NULL when detached
+    uint64_t generation;               // of model
+    char name[SHARED_MODEL_NAME_LENGTH];
+} SharedModel;
+
+// Publishes params under name (letters, digits, '-', '_' and '.'), returns the new generation, 0 on failure
+uint64_t publishSharedModel(const char* name, const Params& params);
+
+// Removes name and its current image, attached processes keep their mapping
+bool unpublishSharedModel(const char* name);
+
+// Maps the current image of name, retrying if a publish replaces it in between
+bool attachSharedModel(const char* name, SharedModel& shared, bool verify_checksum);
+
+// True once a newer generation than shared.generation has been published, cheap enough to poll
+bool sharedModelChanged(const SharedModel& shared);
+
+void detachSharedModel(SharedModel& shared);
+
+#endif // SHARED_MODEL_H
@@ -0,0 +1,65 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+//-------------------------------------------------------------SIMD KERNELS---------------------------------------------------//
+
+// NOTE: The per-ISA kernel files are compiled with -mavx2/-mavx512f etc. and must only include this header,
+// pulling in inline functions from other headers would let the linker pick an AVX copy for scalar callers.
+
+#include <stdint.h>
+
+#include "gemm.h"
+#include "nchwc.h"
+
+// Outputs per stored block of the sparse layer 7, one xmm register, see sparse.h
+#define SPARSE_BLOCK 4
+
+typedef struct KernelTable {
+    const char* isa;
+
+    // acc[GEMM_MR][GEMM_NR] = a (GEMM_MR panel, k-major) x b (GEMM_NR panel, k-major) over K steps
+    void (*gemm_micro_kernel)(int K, const float* a, const float* b, float* acc);
+
+    // Returns sum(a[i] * b[i]) for i < n
+    float (*dot)(const float* a, const float* b, int n);
+
+    // Returns sum(a[i] * b[i]) for i < n, accumulated in int32
+    int32_t (*dot_s8)(const int8_t* a, const int8_t* b, int n);
+
+    // Returns sum(a[i] * b[i]) for i < n, a holding fp16 / bf16 bit patterns widened to fp32 in registers
+    float (*dot_f16)(const uint16_t* a, const float* b, int n);
+    float (*dot_bf16)(const uint16_t* a, const float* b, int n);
+
+    // acc[NCHWC_TILE][NCHWC_BLOCK] = conv of NCHWC_TILE pixels pixel_stride apart against one output block of
+    // weights packed by packBlockedWeights. input points at the first pixel's receptive field, whose kernel rows
+    // are row_stride apart, in_blocks blocks of in_block channels each block_stride apart
+    void (*nchwc_conv_tile)(const float* input, const float* weights, int in_blocks, int in_block, int kernel_size,
+                            int block_stride, int row_stride, int pixel_stride, float* acc);
+
+    // out[c] = max of the 2x2 window at columns 2c, 2c + 1 of row0 and row1, for c < out_cols
+    void (*max_pool_2x2_row)(const float* row0, const float* row1, float* out, int out_cols);
+
+    // For every input j with x[j] != 0: sums[blocks[k] * SPARSE_BLOCK + r] += values[k * SPARSE_BLOCK + r] * x[j]
+    // for r < SPARSE_BLOCK and k in starts[j] .. starts[j + 1]. sums and values are 16 byte aligned
+    void (*sparse_blocks)(const float* x, int inputs, const int32_t* starts, const uint8_t* blocks, const float* values,
+                          float* sums);
+} KernelTable;
+
+extern const KernelTable scalar_kernels;
+#ifdef CNN_HAVE_SSE42
+extern const KernelTable sse42_kernels;
+#endif
+#ifdef CNN_HAVE_AVX2
+extern const KernelTable avx2_kernels;
+#endif
+#ifdef CNN_HAVE_AVX512
+extern const KernelTable avx512_kernels;
+#endif
+
+// Kernels for the widest ISA supported by this CPU, chosen via CPUID on first use
+const KernelTable& activeKernels();
+
+// Forces a narrower ISA ("scalar", "sse4.2", "avx2", "avx512"), returns false if unsupported here
+bool selectKernels(const char* isa);
+
+#endif // SIMD_H
@@ -0,0 +1,62 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stdint.h>
+
+#include "cnn.h"
+#include "simd.h"
+
+//-------------------------------------------------------------SPARSE LAYER 7-------------------------------------------------//
+
+// weights4 holds most of the parameters and layer_7_fc reads all of it for every image. pruneWeights zeroes its
+// smallest blocks, SparseFc stores the blocks that are left and layer_7_fc_sparse multiplies by them.
+//
+// A block is SPARSE_BLOCK consecutive outputs fed by one input, so the blocks are grouped by input (block CSR over
+// the columns of weights4). layer_6 is post relu and max pooled, so many inputs are zero and their whole column of
+// blocks is skipped. The blocks left are SPARSE_BLOCK wide multiply-adds into the outputs.
+
+#define SPARSE_BLOCKS_7 (WEIGHT_ROWS_7 / SPARSE_BLOCK)
+
+static_assert(WEIGHT_ROWS_7 % SPARSE_BLOCK == 0, "layer 7 outputs must be whole sparse blocks");
+
+typedef struct SparseFc {
+    alignas(64) float values[WEIGHT_COLS_7 * WEIGHT_ROWS_7]; // SPARSE_BLOCK weights per stored block
+    uint8_t blocks[WEIGHT_COLS_7 * SPARSE_BLOCKS_7];          // output block of each stored block
+    int32_t starts[WEIGHT_COLS_7 + 1];                        // stored blocks of input j are starts[j] .. starts[j + 1]
+    int block_count;
+} SparseFc;
+
+// How the pruned sparse path compares to the dense one over a dataset
+typedef struct SparseReport {
+    int images;
+    int dense_correct;
+    int sparse_correct;
+    int agreement;             // images where both paths predict the same class
+    float weight_sparsity;     // zero fraction of the pruned weights4
+    float block_sparsity;      // fraction of the blocks SparseFc doesn't store
+    float activation_sparsity; // zero fraction of layer_6, inputs the sparse kernel skips
+    double dense_seconds;      // in layer_7_fc
+    double sparse_seconds;     // in layer_7_fc_sparse
+} SparseReport;
+
+// Zeroes the weights4 blocks with the smallest L2 norm until a sparsity fraction of the blocks is zero, then repacks
+// packed4 so every path runs the pruned weights. Returns the zero fraction of weights4.
+float pruneWeights(Params& param, float sparsity);
+
+// Zero fraction of weights4
+float weightSparsity(const Params& param);
+
+// Stores the blocks of weights4 with a nonzero weight
+void buildSparseFc(const Params& param, SparseFc& sparse);
+
+// Same output as layer_7_fc over the weights sparse was built from
+void layer_7_fc_sparse(ImageData& inputData, const Params& param, const SparseFc& sparse);
+
+// forwardPass with layer_7_fc_sparse
+int forwardPassSparse(ImageData& inputData, Workspace& workspace, const Params& param, const SparseFc& sparse);
+
+// Runs every image below folderPath through dense, the unpruned weights, and through the sparse path on pruned
+void evaluateSparse(const char* folderPath, const Params& dense, const Params& pruned, const SparseFc& sparse, int padding,
+                    SparseReport& report);
+
+#endif // SPARSE_H
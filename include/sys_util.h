@@ -0,0 +1,18 @@
+#ifndef SYS_UTIL_H
+#define SYS_UTIL_H
+
+#include <stddef.h>
+
+//-------------------------------------------------------------SYSTEM HELPERS-------------------------------------------------//
+
+// Reads exactly size bytes, retrying short and interrupted reads. False on an error or end of file before size bytes.
+bool readFully(int fd, void* data, size_t size);
+
+// Writes exactly size bytes, retrying short and interrupted writes. Sockets are written with MSG_NOSIGNAL, so a
+// peer that hung up is reported as an error instead of killing the process with SIGPIPE.
+bool writeFully(int fd, const void* data, size_t size);
+
+// Seconds on the monotonic clock, for measuring intervals
+double now();
+
+#endif // SYS_UTIL_H
@@ -0,0 +1,57 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+#include "gemm.h"
+
+//-------------------------------------------------------------WINOGRAD F(2x2, 3x3)-------------------------------------------//
+
+// Each 4x4 input tile yields a 2x2 output tile of a stride 1, 3x3 convolution using 16 multiplies per
+// (in, out) channel pair instead of 36. In the transformed domain the conv becomes WINOGRAD_POINTS
+// independent [out_filters x in_filters] x [in_filters x tiles] matrix products, run on the SGEMM micro-kernel.
+#define WINOGRAD_TILE 4
+#define WINOGRAD_POINTS (WINOGRAD_TILE * WINOGRAD_TILE)
+
+// Largest error relative to the output magnitude accepted against the direct convolution
+#define WINOGRAD_TOLERANCE 1e-4f
+
+// Size (in floats) of the transformed weights: one GEMM_MR packed [out][in] matrix per point
+#define WINOGRAD_WEIGHTS_SIZE(out_filters, in_filters) (WINOGRAD_POINTS * PACKED_WEIGHTS_SIZE(out_filters, in_filters, 1))
+
+// Size (in floats) of the scratch used by convWinograd: the transformed inputs of one GEMM_NR panel of tiles
+#define WINOGRAD_SCRATCH_SIZE(in_filters) (WINOGRAD_POINTS * (in_filters) * GEMM_NR)
+
+// Computes G g G^T for every [out][in][3][3] filter and packs each point's matrix into GEMM_MR panels
+void winogradTransformWeights(const float* weights, float* transformed, int out_filters, int in_filters);
+
+// B^T = [1 0 -1 0; 0 1 1 0; 0 -1 1 0; 0 1 0 -1], v = B^T d B for the 4x4 tile at d with row pitch width
+inline void winogradTransformInput(const float* d, int width, float* v) {
+    float tmp[WINOGRAD_TILE][WINOGRAD_TILE];
+    for (int j = 0; j < WINOGRAD_TILE; j++) {
+        float d0 = d[j], d1 = d[width + j], d2 = d[2 * width + j], d3 = d[3 * width + j];
+        tmp[0][j] = d0 - d2;
+        tmp[1][j] = d1 + d2;
+        tmp[2][j] = d2 - d1;
+        tmp[3][j] = d1 - d3;
+    }
+    for (int i = 0; i < WINOGRAD_TILE; i++) {
+        v[i * WINOGRAD_TILE + 0] = tmp[i][0] - tmp[i][2];
+        v[i * WINOGRAD_TILE + 1] = tmp[i][1] + tmp[i][2];
+        v[i * WINOGRAD_TILE + 2] = tmp[i][2] - tmp[i][1];
+        v[i * WINOGRAD_TILE + 3] = tmp[i][1] - tmp[i][3];
+    }
+}
+
+// A^T = [1 1 1 0; 0 1 -1 -1], y = A^T m A
+inline void winogradTransformOutput(const float* m, float y[2][2]) {
+    float tmp[2][WINOGRAD_TILE];
+    for (int j = 0; j < WINOGRAD_TILE; j++) {
+        tmp[0][j] = m[j] + m[WINOGRAD_TILE + j] + m[2 * WINOGRAD_TILE + j];
+        tmp[1][j] = m[WINOGRAD_TILE + j] - m[2 * WINOGRAD_TILE + j] - m[3 * WINOGRAD_TILE + j];
+    }
+    for (int i = 0; i < 2; i++) {
+        y[i][0] = tmp[i][0] + tmp[i][1] + tmp[i][2];
+        y[i][1] = tmp[i][1] - tmp[i][2] - tmp[i][3];
+    }
+}
+
+#endif // WINOGRAD_H
@@ -0,0 +1,391 @@
+#include "../include/autotune.h"
+#include "../include/simd.h"
+#include "../include/sys_util.h"
+
+#include <ctype.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+// A candidate's time is the median of AUTOTUNE_SAMPLES samples, each repeating it for at least AUTOTUNE_SAMPLE_S
+#define AUTOTUNE_SAMPLES 9
+#define AUTOTUNE_SAMPLE_S 0.002
+
+static const char* stage_names[TUNING_STAGES] = {"layer_1_2", "layer_3_4", "layer_5_6"};
+
+// GEMM shape of each stage: weights per output filter and pooled output pixels
+static const int stage_reduction[TUNING_STAGES] = {Layer1Conv::reduction, Layer3Conv::reduction, Layer5Conv::reduction};
+static const int stage_pixels[TUNING_STAGES] = {Layer2Pool::Output::rows * Layer2Pool::Output::cols,
+                                                Layer4Pool::Output::rows * Layer4Pool::Output::cols,
+                                                Layer6Pool::Output::rows * Layer6Pool::Output::cols};
+
+typedef void (*StageFunction)(ImageData& imageData, Workspace& workspace, const Params& param);
+
+static const StageFunction stage_functions[TUNING_STAGES] = {layer_1_2_conv_pool, layer_3_4_conv_pool,
+                                                             layer_5_6_conv_pool_flatten};
+
+void defaultTuningPlan(TuningPlan& plan) {
+    for (int s = 0; s < TUNING_STAGES; s++) {
+        plan.stages[s].algorithm = CONV_FUSED_GEMM;
+        plan.stages[s].block = GEMM_POOL_NC;
+    }
+    plan.fc_batch_min = GEMM_NR / 2;
+}
+
+int maxStageBlock(int stage) {
+    return COL_BUFFER_SIZE / (4 * stage_reduction[stage]) / GEMM_POOL_NR * GEMM_POOL_NR;
+}
+
+//-----CACHE FILE-----//
+
+static void trim(std::string& text) {
+    size_t start = 0;
+    while (start < text.size() && isspace((unsigned char)text[start])) {
+        start++;
+    }
+    size_t end = text.size();
+    while (end > start && isspace((unsigned char)text[end - 1])) {
+        end--;
+    }
+    text = text.substr(start, end - start);
+}
+
+std::string tuningKey() {
+    std::string model;
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    if (file != NULL) {
+        char* line = NULL;
+        size_t capacity = 0;
+        while (getline(&line, &capacity, file) >= 0) {
+            const char* colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+                model = colon + 1;
+                break;
+            }
+        }
+        free(line);
+        fclose(file);
+    }
+
+    // Tabs separate the fields of a cache line
+    std::replace(model.begin(), model.end(), '\t', ' ');
+    trim(model);
+    if (model.empty()) {
+        model = "unknown cpu";
+    }
+    return model + "\t" + activeKernels().isa;
+}
+
+std::string formatTuningPlan(const TuningPlan& plan) {
+    std::string text;
+    char field[64];
+    for (int s = 0; s < TUNING_STAGES; s++) {
+        const StageTuning& stage = plan.stages[s];
+        if (stage.algorithm == CONV_FUSED_GEMM) {
+            snprintf(field, sizeof(field), "%s=gemm:%d ", stage_names[s], stage.block);
+        } else {
+            snprintf(field, sizeof(field), "%s=%s ", stage_names[s], (stage.algorithm == CONV_NCHWC) ? "nchwc" : "winograd");
+        }
+        text += field;
+    }
+    snprintf(field, sizeof(field), "fc_batch=%d", plan.fc_batch_min);
+    return text + field;
+}
+
+// Sets the name=value field of plan, false if either is invalid
+static bool parseField(const char* name, const char* value, TuningPlan& plan) {
+    if (strcmp(name, "fc_batch") == 0) {
+        plan.fc_batch_min = atoi(value);
+        return plan.fc_batch_min >= 1;
+    }
+
+    for (int s = 0; s < TUNING_STAGES; s++) {
+        if (strcmp(name, stage_names[s]) != 0) {
+            continue;
+        }
+        StageTuning& stage = plan.stages[s];
+        int block = 0;
+        char end = 0;
+        if (sscanf(value, "gemm:%d%c", &block, &end) == 1) {
+            stage.algorithm = CONV_FUSED_GEMM;
+            stage.block = block;
+            return block >= GEMM_POOL_NR && block % GEMM_POOL_NR == 0 && block <= maxStageBlock(s);
+        }
+        if (strcmp(value, "nchwc") == 0) {
+            stage.algorithm = CONV_NCHWC;
+            return true;
+        }
+        // Layer 5 is the only stride 1 conv
+        if (strcmp(value, "winograd") == 0 && s == TUNING_STAGES - 1) {
+            stage.algorithm = CONV_FUSED_WINOGRAD;
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+bool parseTuningPlan(const char* text, TuningPlan& plan) {
+    TuningPlan parsed;
+    defaultTuningPlan(parsed);
+    std::vector<char> buffer(text, text + strlen(text) + 1);
+
+    // Every field must be present once, the bit of a stage is 1 << s and fc_batch's 1 << TUNING_STAGES
+    int seen = 0;
+    char* saveptr = NULL;
+    for (char* field = strtok_r(buffer.data(), " \t\r\n", &saveptr); field != NULL; field = strtok_r(NULL, " \t\r\n", &saveptr)) {
+        char* equals = strchr(field, '=');
+        if (equals == NULL) {
+            return false;
+        }
+        *equals = 0;
+        if (!parseField(field, equals + 1, parsed)) {
+            return false;
+        }
+        int bit = TUNING_STAGES;
+        for (int s = 0; s < TUNING_STAGES; s++) {
+            if (strcmp(field, stage_names[s]) == 0) {
+                bit = s;
+            }
+        }
+        if (seen & (1 << bit)) {
+            return false;
+        }
+        seen |= 1 << bit;
+    }
+    if (seen != (1 << (TUNING_STAGES + 1)) - 1) {
+        return false;
+    }
+    plan = parsed;
+    return true;
+}
+
+bool loadTuning(const char* cachePath, const std::string& key, TuningPlan& plan) {
+    FILE* file = fopen(cachePath, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    std::string prefix = key + "\t";
+    char* line = NULL;
+    size_t capacity = 0;
+    bool loaded = false;
+    while (getline(&line, &capacity, file) >= 0) {
+        if (strncmp(line, prefix.c_str(), prefix.size()) != 0) {
+            continue;
+        }
+        loaded = parseTuningPlan(line + prefix.size(), plan);
+        if (!loaded) {
+            fprintf(stderr, "Ignoring the malformed tuning of this host in %s\n", cachePath);
+        }
+        break;
+    }
+    free(line);
+    fclose(file);
+    return loaded;
+}
+
+bool saveTuning(const char* cachePath, const std::string& key, const TuningPlan& plan) {
+    std::string prefix = key + "\t";
+    std::vector<std::string> lines;
+
+    // The entries of other hosts are kept in order, this host's goes last
+    FILE* file = fopen(cachePath, "r");
+    if (file != NULL) {
+        char* line = NULL;
+        size_t capacity = 0;
+        while (getline(&line, &capacity, file) >= 0) {
+            if (strncmp(line, prefix.c_str(), prefix.size()) == 0) {
+                continue;
+            }
+            lines.push_back(line);
+            if (lines.back().empty() || lines.back()[lines.back().size() - 1] != '\n') {
+                lines.back() += '\n';
+            }
+        }
+        free(line);
+        fclose(file);
+    }
+    if (lines.empty()) {
+        lines.push_back("# <cpu model>\t<isa>\t<plan>, see autotune.h\n");
+    }
+    lines.push_back(prefix + formatTuningPlan(plan) + "\n");
+
+    // Each writer has its own temporary file, concurrent saves only race on the rename
+    std::string tmp_path = std::string(cachePath) + ".tmp." + std::to_string((int)getpid());
+    file = fopen(tmp_path.c_str(), "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to create %s\n", tmp_path.c_str());
+        return false;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < lines.size(); i++) {
+        ok = fputs(lines[i].c_str(), file) >= 0 && ok;
+    }
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp_path.c_str(), cachePath) != 0) {
+        fprintf(stderr, "Failed to write %s\n", cachePath);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+//-----SEARCH-----//
+
+typedef struct TuneContext {
+    Params* param; // a copy of the tuned model, its plan is the candidate being timed
+    ImageData* imageData;
+    Workspace* workspace;
+    ImageBatch batch;
+    int stage;
+    bool gemm;
+} TuneContext;
+
+typedef void (*TuneStep)(TuneContext& context);
+
+static void runStage(TuneContext& context) {
+    stage_functions[context.stage](*context.imageData, *context.workspace, *context.param);
+}
+
+static void runConvStack(TuneContext& context) {
+    convStack(*context.imageData, *context.workspace, *context.param);
+}
+
+static void runFcLayers(TuneContext& context) {
+    fcLayersBatch(context.batch, *context.param, context.gemm);
+}
+
+// Median seconds per step. The second warm-up run estimates how many repetitions make a sample long enough
+// to be far above the clock resolution.
+static double timeStep(TuneStep step, TuneContext& context) {
+    step(context);
+    double start = now();
+    step(context);
+    double once = now() - start;
+    int repeats = (int)(AUTOTUNE_SAMPLE_S / std::max(once, 1e-7)) + 1;
+
+    std::vector<double> samples;
+    for (int i = 0; i < AUTOTUNE_SAMPLES; i++) {
+        start = now();
+        for (int r = 0; r < repeats; r++) {
+            step(context);
+        }
+        samples.push_back((now() - start) / repeats);
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+// Tries the GEMM cache blocks of each stage on its own, behind GEMM stages so its input is planar
+static void tuneBlocks(TuneContext& context, TuningPlan& plan) {
+    context.param->tuning = plan;
+    convStack(*context.imageData, *context.workspace, *context.param);
+
+    for (int s = 0; s < TUNING_STAGES; s++) {
+        context.stage = s;
+        double best = -1;
+        int best_block = plan.stages[s].block;
+
+        // Doubling up to the col_buffer limit, a block past the stage's pixels lowers the same single block
+        for (int block = GEMM_POOL_NR; block <= maxStageBlock(s); block *= 2) {
+            plan.stages[s].block = block;
+            context.param->tuning = plan;
+            double seconds = timeStep(runStage, context);
+            if (best < 0 || seconds < best) {
+                best = seconds;
+                best_block = block;
+            }
+            if (block >= stage_pixels[s]) {
+                break;
+            }
+        }
+        plan.stages[s].block = best_block;
+    }
+}
+
+// Times the whole conv stack for every combination of stage algorithms, since the layout a stage writes
+// decides whether the next one has to reorder it
+static void tuneAlgorithms(TuneContext& context, bool allow_winograd, TuningPlan& plan) {
+    static const int candidates[] = {CONV_FUSED_GEMM, CONV_NCHWC, CONV_FUSED_WINOGRAD};
+    const int count = sizeof(candidates) / sizeof(candidates[0]);
+    int combinations = 1;
+    for (int s = 0; s < TUNING_STAGES; s++) {
+        combinations *= count;
+    }
+
+    TuningPlan trial = plan;
+    double best = -1;
+    for (int c = 0; c < combinations; c++) {
+        bool valid = true;
+        for (int s = 0, code = c; s < TUNING_STAGES; s++, code /= count) {
+            trial.stages[s].algorithm = candidates[code % count];
+            if (trial.stages[s].algorithm == CONV_FUSED_WINOGRAD && (s != TUNING_STAGES - 1 || !allow_winograd)) {
+                valid = false;
+            }
+        }
+        if (!valid) {
+            continue;
+        }
+
+        context.param->tuning = trial;
+        double seconds = timeStep(runConvStack, context);
+        if (best < 0 || seconds < best) {
+            best = seconds;
+            plan = trial;
+        }
+    }
+}
+
+// Finds the smallest batch from which the FC GEMMs beat the image by image layers at every larger batch size
+// up to a full GEMM_NR panel. If they lose even on a full panel only larger batches use them.
+static void tuneFcBatch(TuneContext& context, TuningPlan& plan) {
+    for (int b = 0; b < GEMM_NR; b++) {
+        memcpy(context.batch.images[b].layer_6, context.imageData->layer_6, sizeof(context.imageData->layer_6));
+    }
+
+    plan.fc_batch_min = GEMM_NR + 1;
+    for (int size = GEMM_NR; size >= 1; size--) {
+        context.batch.size = size;
+        context.gemm = true;
+        double gemm = timeStep(runFcLayers, context);
+        context.gemm = false;
+        double single = timeStep(runFcLayers, context);
+        if (gemm >= single) {
+            break;
+        }
+        plan.fc_batch_min = size;
+    }
+}
+
+bool autotune(const Params& param, bool allow_winograd, TuningPlan& plan) {
+    if (param.conv_algorithm != CONV_TUNED) {
+        fprintf(stderr, "autotune needs a model loaded for CONV_TUNED\n");
+        return false;
+    }
+
+    TuneContext context;
+    context.param = allocateParams();
+    memcpy(context.param, &param, sizeof(Params));
+    context.imageData = new ImageData();
+    context.workspace = allocateWorkspace();
+    allocateBatch(context.batch, GEMM_NR);
+    syntheticImage(*context.imageData);
+
+    // The blocks are picked first since they only matter to GEMM stages, which the algorithm search then
+    // compares at their best
+    defaultTuningPlan(plan);
+    tuneBlocks(context, plan);
+    tuneAlgorithms(context, allow_winograd, plan);
+    context.param->tuning = plan;
+    convStack(*context.imageData, *context.workspace, *context.param);
+    tuneFcBatch(context, plan);
+
+    freeBatch(context.batch);
+    freeWorkspace(context.workspace);
+    delete context.imageData;
+    freeParams(context.param);
+    return true;
+}
@@ -0,0 +1,389 @@
+#include "../include/cnn.h"
+#include "../include/autotune.h"
+#include "../include/jpeg_decoder.h"
+#include "../include/model_format.h"
+#include "../include/simd.h"
+#include "../include/sys_util.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Times every layer_N_* function and forwardPass on a synthetic image, loadParams (or mapModel) and the
+// decode / preprocess steps of loadDataset, then the end to end throughput of loadDataset and
+// loadDatasetParallel. Latencies are reported as median and 99th percentile over all samples, --json prints
+// one JSON object per line instead of the tables so runs of two builds can be diffed.
+
+static const char* conv_names[] = {"direct", "gemm", "fused", "winograd", "nchwc", "tuned"};
+
+#define CONV_ALGORITHMS (int)(sizeof(conv_names) / sizeof(conv_names[0]))
+
+// Operation counts per call. Convolutions count 2 flops per multiply-add of the direct algorithm whatever
+// algorithm runs them, max pools one op per comparison
+template <class L>
+constexpr double convFlops() {
+    return 2.0 * L::Output::filters * L::Output::rows * L::Output::cols * L::reduction;
+}
+
+template <class L>
+constexpr double poolOps() {
+    return (double)L::Output::filters * L::Output::rows * L::Output::cols * (L::kernel_size * L::kernel_size - 1);
+}
+
+template <class L>
+constexpr double fcFlops() {
+    return 2.0 * L::inputs * L::outputs;
+}
+
+typedef void (*LayerFunction)(ImageData& imageData, Workspace& workspace, const Params& param);
+
+template <void (*Layer)(ImageData&, Workspace&)>
+static void poolStep(ImageData& imageData, Workspace& workspace, const Params&) {
+    Layer(imageData, workspace);
+}
+
+template <void (*Layer)(ImageData&, const Params&)>
+static void fcStep(ImageData& imageData, Workspace&, const Params& param) {
+    Layer(imageData, param);
+}
+
+typedef struct LayerStep {
+    const char* name;
+    LayerFunction run;
+    double flops;
+} LayerStep;
+
+// The layer sequences forwardPass runs for CONV_DIRECT / CONV_IM2COL_GEMM and for the fused algorithms
+static const LayerStep unfused_steps[] = {
+    {"layer_1_conv", layer_1_conv, convFlops<Layer1Conv>()},
+    {"layer_2_max_pool", poolStep<layer_2_max_pool>, poolOps<Layer2Pool>()},
+    {"layer_3_conv", layer_3_conv, convFlops<Layer3Conv>()},
+    {"layer_4_max_pool", poolStep<layer_4_max_pool>, poolOps<Layer4Pool>()},
+    {"layer_5_conv", layer_5_conv, convFlops<Layer5Conv>()},
+    {"layer_6_max_pool_flatten", poolStep<layer_6_max_pool_flatten>, poolOps<Layer6Pool>()},
+    {"layer_7_fc", fcStep<layer_7_fc>, fcFlops<Layer7Fc>()},
+    {"layer_8_fc", fcStep<layer_8_fc>, fcFlops<Layer8Fc>()},
+    {"layer_9_fc", fcStep<layer_9_fc>, fcFlops<Layer9Fc>()},
+};
+
+static const LayerStep fused_steps[] = {
+    {"layer_1_2_conv_pool", layer_1_2_conv_pool, convFlops<Layer1Conv>() + poolOps<Layer2Pool>()},
+    {"layer_3_4_conv_pool", layer_3_4_conv_pool, convFlops<Layer3Conv>() + poolOps<Layer4Pool>()},
+    {"layer_5_6_conv_pool_flatten", layer_5_6_conv_pool_flatten, convFlops<Layer5Conv>() + poolOps<Layer6Pool>()},
+    {"layer_7_fc", fcStep<layer_7_fc>, fcFlops<Layer7Fc>()},
+    {"layer_8_fc", fcStep<layer_8_fc>, fcFlops<Layer8Fc>()},
+    {"layer_9_fc", fcStep<layer_9_fc>, fcFlops<Layer9Fc>()},
+};
+
+static const double forward_flops = convFlops<Layer1Conv>() + poolOps<Layer2Pool>() + convFlops<Layer3Conv>() +
+                                    poolOps<Layer4Pool>() + convFlops<Layer5Conv>() + poolOps<Layer6Pool>() +
+                                    fcFlops<Layer7Fc>() + fcFlops<Layer8Fc>() + fcFlops<Layer9Fc>();
+
+// Samples (in seconds) of one timed operation
+typedef struct Latency {
+    std::string name;
+    const char* conv; // algorithm the samples were taken with, "-" if it doesn't apply
+    double flops;     // per call, 0 if it doesn't apply
+    std::vector<double> samples;
+} Latency;
+
+typedef struct Throughput {
+    std::string name;
+    const char* conv;
+    int images;
+    double seconds;
+} Throughput;
+
+// Nearest rank percentile of sorted samples
+static double percentile(const std::vector<double>& sorted, double q) {
+    size_t rank = (size_t)ceil(q * sorted.size());
+    return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+// Times each layer of a forward pass with the algorithm, then forwardPass as a whole. The layers run in
+// order every iteration so each one sees the data and cache state it has inside a real pass.
+static void benchLayers(Params& param, int algorithm, int iterations, std::vector<Latency>& results) {
+    ImageData* imageData = new ImageData();
+    Workspace* workspace = allocateWorkspace();
+    syntheticImage(*imageData);
+
+    int saved_algorithm = param.conv_algorithm;
+    param.conv_algorithm = algorithm;
+
+    bool fused = algorithm >= CONV_FUSED_GEMM;
+    const LayerStep* steps = fused ? fused_steps : unfused_steps;
+    int num_steps = fused ? (int)(sizeof(fused_steps) / sizeof(fused_steps[0]))
+                          : (int)(sizeof(unfused_steps) / sizeof(unfused_steps[0]));
+
+    size_t first = results.size();
+    for (int s = 0; s < num_steps; s++) {
+        Latency latency = {steps[s].name, conv_names[algorithm], steps[s].flops, std::vector<double>()};
+        results.push_back(latency);
+    }
+
+    // Iteration -1 warms the caches and page tables up and isn't recorded
+    for (int it = -1; it < iterations; it++) {
+        for (int s = 0; s < num_steps; s++) {
+            double start = now();
+            steps[s].run(*imageData, *workspace, param);
+            double elapsed = now() - start;
+            if (it >= 0) {
+                results[first + s].samples.push_back(elapsed);
+            }
+        }
+    }
+
+    Latency forward = {"forwardPass", conv_names[algorithm], forward_flops, std::vector<double>()};
+    for (int it = -1; it < iterations; it++) {
+        double start = now();
+        forwardPass(*imageData, *workspace, param);
+        double elapsed = now() - start;
+        if (it >= 0) {
+            forward.samples.push_back(elapsed);
+        }
+    }
+    results.push_back(forward);
+
+    param.conv_algorithm = saved_algorithm;
+    freeWorkspace(workspace);
+    delete imageData;
+}
+
+// Times the two steps preprocessImage runs for every image of loadDataset, cycling over the dataset, and the
+// full resolution cv::imread the scaled decode replaces
+static void benchDecode(const char* images_path, int iterations, std::vector<Latency>& results) {
+    std::vector<DatasetEntry> entries;
+    listDataset(images_path, entries);
+    if (entries.empty()) {
+        fprintf(stderr, "No images found below %s, skipping the decode benchmark\n", images_path);
+        return;
+    }
+
+    ImageData* imageData = new ImageData();
+    JpegDecoder* decoder = createJpegDecoder();
+    Latency decode = {"decode", "-", 0, std::vector<double>()};
+    Latency preprocess = {"preprocess", "-", 0, std::vector<double>()};
+    Latency full_decode = {"decode_full", "-", 0, std::vector<double>()};
+    cv::Mat image;
+
+    for (int it = 0; it < iterations; it++) {
+        const DatasetEntry& entry = entries[it % entries.size()];
+        double start = now();
+        image = cv::imread(entry.path.c_str(), cv::IMREAD_COLOR);
+        double full = now() - start;
+        if (image.empty()) {
+            fprintf(stderr, "Error: Could not read the image %s\n", entry.path.c_str());
+            continue;
+        }
+
+        start = now();
+        if (!decodeJpegFile(*decoder, entry.path.c_str(), INPUT_ROWS_1, INPUT_COLS_1, image)) {
+            image = cv::imread(entry.path.c_str(), cv::IMREAD_COLOR);
+        }
+        double decoded = now();
+        preprocessMat(image, *imageData, PADDING_1);
+        double end = now();
+
+        decode.samples.push_back(decoded - start);
+        preprocess.samples.push_back(end - decoded);
+        full_decode.samples.push_back(full);
+    }
+
+    if (!decode.samples.empty()) {
+        results.push_back(decode);
+        results.push_back(preprocess);
+        results.push_back(full_decode);
+    }
+    freeJpegDecoder(decoder);
+    delete imageData;
+}
+
+// Times how long the model file takes to become usable: parsed and packed for a text file, mapped and
+// checksummed for a binary one
+static bool benchLoad(const char* param_path, int iterations, std::vector<Latency>& results) {
+    static Params params;
+    bool binary = isBinaryModel(param_path);
+    Latency load = {binary ? "mapModel" : "loadParams", "-", 0, std::vector<double>()};
+
+    for (int it = 0; it < iterations; it++) {
+        MappedModel model = {NULL, 0, NULL};
+        double start = now();
+        bool ok = binary ? mapModel(param_path, model, true) : loadParams(param_path, params);
+        double elapsed = now() - start;
+        unmapModel(model);
+        if (!ok) {
+            return false;
+        }
+        load.samples.push_back(elapsed);
+    }
+
+    results.push_back(load);
+    return true;
+}
+
+static void benchEndToEnd(const char* images_path, const Params& param, std::vector<Throughput>& results) {
+    const char* conv = conv_names[param.conv_algorithm];
+
+    ImageData* imageData = new ImageData();
+    cv::Mat image;
+    Throughput serial = {"loadDataset", conv, 0, 0};
+    int correct_cases = 0;
+    int unlabelled = 0;
+    double start = now();
+    loadDataset(images_path, *imageData, serial.images, PADDING_1, param, image, correct_cases, unlabelled);
+    serial.seconds = now() - start;
+    results.push_back(serial);
+    delete imageData;
+
+    Throughput parallel = {"loadDatasetParallel", conv, 0, 0};
+    correct_cases = 0;
+    start = now();
+    loadDatasetParallel(images_path, parallel.images, PADDING_1, param, correct_cases, unlabelled, 0, GEMM_NR);
+    parallel.seconds = now() - start;
+    results.push_back(parallel);
+}
+
+static void printText(const std::vector<Latency>& latencies, const std::vector<Throughput>& throughputs) {
+    printf("%-28s %-9s %8s %12s %12s %10s\n", "operation", "conv", "samples", "median_us", "p99_us", "GFLOP/s");
+    for (size_t i = 0; i < latencies.size(); i++) {
+        std::vector<double> sorted = latencies[i].samples;
+        std::sort(sorted.begin(), sorted.end());
+        double median = percentile(sorted, 0.5);
+        printf("%-28s %-9s %8zu %12.3f %12.3f ", latencies[i].name.c_str(), latencies[i].conv, sorted.size(), median * 1e6,
+               percentile(sorted, 0.99) * 1e6);
+        if (latencies[i].flops > 0) {
+            printf("%10.3f\n", latencies[i].flops / median * 1e-9);
+        } else {
+            printf("%10s\n", "-");
+        }
+    }
+
+    printf("\n%-28s %-9s %8s %12s %12s\n", "end to end", "conv", "images", "seconds", "images/s");
+    for (size_t i = 0; i < throughputs.size(); i++) {
+        const Throughput& t = throughputs[i];
+        printf("%-28s %-9s %8d %12.3f %12.1f\n", t.name.c_str(), t.conv, t.images, t.seconds,
+               (t.seconds > 0) ? t.images / t.seconds : 0);
+    }
+}
+
+// One object per line, in the same order as the tables, with a fixed key order so runs diff line by line
+static void printJson(const std::vector<Latency>& latencies, const std::vector<Throughput>& throughputs, int iterations) {
+    printf("{\"kind\":\"config\",\"isa\":\"%s\",\"iterations\":%d}\n", activeKernels().isa, iterations);
+    for (size_t i = 0; i < latencies.size(); i++) {
+        std::vector<double> sorted = latencies[i].samples;
+        std::sort(sorted.begin(), sorted.end());
+        double median = percentile(sorted, 0.5);
+        printf("{\"kind\":\"latency\",\"name\":\"%s\",\"conv\":\"%s\",\"samples\":%zu,\"median_us\":%.3f,\"p99_us\":%.3f,"
+               "\"gflops\":%.3f}\n",
+               latencies[i].name.c_str(), latencies[i].conv, sorted.size(), median * 1e6, percentile(sorted, 0.99) * 1e6,
+               (latencies[i].flops > 0) ? latencies[i].flops / median * 1e-9 : 0);
+    }
+    for (size_t i = 0; i < throughputs.size(); i++) {
+        const Throughput& t = throughputs[i];
+        printf("{\"kind\":\"throughput\",\"name\":\"%s\",\"conv\":\"%s\",\"images\":%d,\"seconds\":%.6f,\"images_per_s\":%.3f}\n",
+               t.name.c_str(), t.conv, t.images, t.seconds, (t.seconds > 0) ? t.images / t.seconds : 0);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* images_path = "../extern/test_data";
+    const char* param_path = "../extern/parameters.txt";
+    int iterations = 200;
+    int load_iterations = 5;
+    int conv_algorithm = -1;
+    const char* tuning_cache = DEFAULT_TUNING_CACHE;
+    bool json = false;
+
+    // --conv=<name> benchmarks one convolution algorithm (default: all), --iterations=N samples per layer,
+    // --load-iterations=N samples of loadParams / mapModel, --model=<file> and --images=<dir> as for the
+    // inference binary, --isa=<name> caps the SIMD kernels, --tune-cache=<file> is where "tuned" finds the plan of
+    // this host (see autotune.h), --json switches to JSON lines output
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--conv=", 7) == 0) {
+            for (int c = 0; c < CONV_ALGORITHMS; c++) {
+                if (strcmp(argv[i] + 7, conv_names[c]) == 0) {
+                    conv_algorithm = c;
+                }
+            }
+            if (conv_algorithm < 0) {
+                fprintf(stderr, "Unknown convolution algorithm %s\n", argv[i] + 7);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            iterations = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--load-iterations=", 18) == 0) {
+            load_iterations = atoi(argv[i] + 18);
+        } else if (strncmp(argv[i], "--model=", 8) == 0) {
+            param_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--images=", 9) == 0) {
+            images_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--tune-cache=", 13) == 0) {
+            tuning_cache = argv[i] + 13;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strncmp(argv[i], "--isa=", 6) == 0) {
+            if (!selectKernels(argv[i] + 6)) {
+                fprintf(stderr, "ISA %s is not supported on this CPU\n", argv[i] + 6);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (iterations < 1 || load_iterations < 1) {
+        fprintf(stderr, "Iteration counts must be at least 1\n");
+        return 1;
+    }
+
+    // Without a cached plan "tuned" runs the default one, the fused GEMM
+    TuningPlan plan;
+    bool cached = loadTuning(tuning_cache, tuningKey(), plan);
+
+    std::vector<Latency> latencies;
+    std::vector<Throughput> throughputs;
+
+    if (!benchLoad(param_path, load_iterations, latencies)) {
+        return 1;
+    }
+
+    // The layers run on the model the inference binary would load from the same file
+    static Params param;
+    MappedModel model = {NULL, 0, NULL};
+    Params* loaded = &param;
+    if (isBinaryModel(param_path)) {
+        if (!mapModel(param_path, model, true)) {
+            return 1;
+        }
+        loaded = model.params;
+    } else if (!loadParams(param_path, param)) {
+        return 1;
+    }
+    if (cached) {
+        loaded->tuning = plan;
+    }
+
+    for (int c = 0; c < CONV_ALGORITHMS; c++) {
+        if (conv_algorithm < 0 || conv_algorithm == c) {
+            benchLayers(*loaded, c, iterations, latencies);
+        }
+    }
+    benchDecode(images_path, iterations, latencies);
+
+    // End to end runs use the requested algorithm, or the one the model loads with
+    if (conv_algorithm >= 0) {
+        loaded->conv_algorithm = conv_algorithm;
+    }
+    benchEndToEnd(images_path, *loaded, throughputs);
+
+    if (json) {
+        printJson(latencies, throughputs, iterations);
+    } else {
+        printf("Kernels = %s\n", activeKernels().isa);
+        printf("Iterations = %d\n\n", iterations);
+        printText(latencies, throughputs);
+    }
+
+    unmapModel(model);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "../include/server.h"
+
+#include <unistd.h>
+
+// Sends images to a server started with main --serve=<socket> and prints their classes and scores
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <socket> <image>...\n", argv[0]);
+        return 1;
+    }
+
+    int fd = connectServer(argv[1]);
+    if (fd < 0) {
+        fprintf(stderr, "No server listening on %s\n", argv[1]);
+        return 1;
+    }
+
+    int failures = 0;
+    std::vector<uchar> bytes;
+    for (int i = 2; i < argc; i++) {
+        FILE* file = fopen(argv[i], "rb");
+        if (file == NULL) {
+            fprintf(stderr, "Error: Could not read the image %s\n", argv[i]);
+            failures++;
+            continue;
+        }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        bytes.resize(size > 0 ? size : 0);
+        bool read_ok = size > 0 && fread(bytes.data(), 1, size, file) == (size_t)size;
+        fclose(file);
+        if (!read_ok) {
+            fprintf(stderr, "Error: Could not read the image %s\n", argv[i]);
+            failures++;
+            continue;
+        }
+
+        ServerResponse response;
+        if (!classifyRemote(fd, SERVER_REQUEST_ENCODED, bytes.data(), (uint32_t)bytes.size(), response)) {
+            fprintf(stderr, "Lost the connection to %s\n", argv[1]);
+            close(fd);
+            return 1;
+        }
+        if (response.status != SERVER_OK) {
+            fprintf(stderr, "%s: rejected with status %d\n", argv[i], response.status);
+            failures++;
+            continue;
+        }
+
+        printf("%s: %s (%d) scores", argv[i], monkey_classes[response.prediction], response.prediction);
+        for (int c = 0; c < TOTAL_CLASSES; c++) {
+            printf(" %g", response.scores[c]);
+        }
+        printf("\n");
+    }
+
+    close(fd);
+    return failures ? 1 : 0;
+}
@@ -1,626 +1,763 @@
 #include "../include/cnn.h"
+#include "../include/autotune.h"
+#include "../include/dataset_scan.h"
+#include "../include/jpeg_decoder.h"
+#include "../include/layers.h"
+#include "../include/profile.h"
+#include "../include/simd.h"
 
-const char* monkey_classes[] = {"Emperor Tamarin", "Gray Langur", "Hamadryas Baboon", "Proboscis Monkey", "Vervet Monkey",
-                                "Golden Monkey",   "Mandril",     "Bald Uakari",      "White Faced Saki", "Red Howler"};
-
-void loadDataset(const char* folderPath, ImageData& imageData, int& test_set_size, int padding, Params& param, cv::Mat& image,
-                 int& correct_cases) {
-    DIR* directory;
-    struct dirent* entry;
+#include <ctype.h>
 
-    // Open the directory
-    directory = opendir(folderPath);
-    if (directory == NULL) {
-        fprintf(stderr, "Failed to open directory: %s\n", folderPath);
-        return;
-    }
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
 
-    // Read the directory entries
-    while ((entry = readdir(directory)) != NULL) {
-        if (entry->d_type == DT_DIR) { // Check if it's a subdirectory
-            // Ignore the current directory (.) and parent directory (..)
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                continue;
-            }
+const char* monkey_classes[] = {"Emperor Tamarin", "Gray Langur", "Hamadryas Baboon", "Proboscis Monkey", "Vervet Monkey",
+                                "Golden Monkey",   "Mandril",     "Bald Uakari",      "White Faced Saki", "Red Howler"};
 
-            // Construct the subfolder path
-            char subfolderPath[MAX_PATH_LENGTH];
-            strncpy(subfolderPath, folderPath, sizeof(subfolderPath));
-            strncat(subfolderPath, "/", sizeof(subfolderPath) - strlen(subfolderPath) - 1);
-            strncat(subfolderPath, entry->d_name, sizeof(subfolderPath) - strlen(subfolderPath) - 1);
-
-            // Read images recursively in the subfolder
-            loadDataset(subfolderPath, imageData, test_set_size, padding, param, image, correct_cases);
-        } else if (entry->d_type == DT_REG) { // Check if it's a regular file
-            // Get the file name
-            const char* fileName = entry->d_name;
-
-            // Check if the file is an image (you can add more image formats if needed)
-            const char* extension = strrchr(fileName, '.');
-            if (extension != NULL && (strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0)) {
-
-                // Construct the full image path
-                char imagePath[MAX_PATH_LENGTH];
-                snprintf(imagePath, sizeof(imagePath), "%s/%s", folderPath, fileName);
-                // std::cout << imagePath << std::endl;
-
-                // Read the image
-                image = cv::imread(imagePath, cv::IMREAD_COLOR);
-
-                if (image.empty()) {
-                    std::cout << "Error: Could not read the image.\n";
-                    return;
-                }
-
-                // Resize the image to 124x124
-                cv::Size newSize(INPUT_ROWS_1, INPUT_COLS_1);
-                cv::resize(image, image, newSize);
-                // image = bilinearInterpolation(image, 128, 128);
-
-                // Convert the resized image to a 3x124x124 array
-                cv::Mat channels[INPUT_FILTERS_1];
-                cv::split(image, channels);
-
-                for (int f = 0; f < INPUT_FILTERS_1; f++) {
-                    for (int i = 0; i < INPUT_ROWS_1; i++) {
-                        for (int j = 0; j < INPUT_COLS_1; j++) {
-                            imageData.image[INPUT_FILTERS_1 - f - 1][padding + i][padding + j] =
-                                (static_cast<float>(channels[f].at<uchar>(i, j)) - MEAN) / STD;
-                        }
-                    }
-                }
-
-                imageData.height = INPUT_ROWS_1 + 2 * padding;
-                imageData.width = INPUT_COLS_1 + 2 * padding;
-                imageData.filters = INPUT_FILTERS_1;
-
-                // Apply Padding
-                for (int f = 0; f < imageData.filters; f++) {
-                    for (int i = 0; i < imageData.height; i++) {
-                        for (int j = 0; j < padding; j++) {
-                            imageData.image[f][i][j] = 0;
-                            imageData.image[f][imageData.height - i - 1][j] = 0;
-                        }
-                    }
-                }
-                for (int f = 0; f < imageData.filters; f++) {
-                    for (int i = 0; i < padding; i++) {
-                        for (int j = 0; j < imageData.width; j++) {
-                            imageData.image[f][i][j] = 0;
-                            imageData.image[f][i][imageData.width - j - 1] = 0;
-                        }
-                    }
-                }
-
-                const char* class_name = strrchr(folderPath, '/') + 1;
-                // Send the image data to forward pass
-                int res = forwardPass(imageData, param);
-
-                if (strcmp(class_name, monkey_classes[res]) == 0) {
-                    correct_cases++;
-                }
-
-                // Count total images processed so far
-                test_set_size++;
-                // printf("Image Path: %s\n", imagePath);
-            }
+int classIndex(const char* className) {
+    for (int c = 0; c < TOTAL_CLASSES; c++) {
+        if (strcmp(className, monkey_classes[c]) == 0) {
+            return c;
         }
     }
+    return -1;
+}
 
-    // Close the directory
-    closedir(directory);
+bool decodeImage(const char* imagePath, cv::Mat& image) {
+    // Decode at the smallest DCT scale that still covers the network input, OpenCV handles what libjpeg can't
+    PROFILE_SCOPE(PROFILE_DECODE);
+    if (!decodeJpegFile(threadJpegDecoder(), imagePath, INPUT_ROWS_1, INPUT_COLS_1, image)) {
+        image = cv::imread(imagePath, cv::IMREAD_COLOR);
+    }
+    return !image.empty();
 }
 
-void loadParams(const char* paramPath, Params& params) {
-    FILE* file = fopen(paramPath, "rb");
-    if (file == NULL) {
-        printf("Failed to open the file.\n");
-        return;
+bool preprocessImage(const char* imagePath, ImageData& imageData, cv::Mat& image, int padding) {
+    if (!decodeImage(imagePath, image)) {
+        return false;
     }
-    char line[MAX_LINE_SIZE];
 
-    // Read weights of layer 1
-    if (fgets(line, MAX_LINE_SIZE, file)) {
+    preprocessMat(image, imageData, padding);
+    return true;
+}
 
-        char* token;
-        token = strtok(line, " ");
+void preprocessMat(cv::Mat& image, ImageData& imageData, int padding) {
+    resizeImage(image);
+    normalizeImage(image, imageData, padding);
+}
+
+void resizeImage(cv::Mat& image) {
+    // Resize the image to 124x124
+    PROFILE_SCOPE(PROFILE_RESIZE);
+    cv::Size newSize(INPUT_ROWS_1, INPUT_COLS_1);
+    cv::resize(image, image, newSize);
+    // image = bilinearInterpolation(image, 128, 128);
+}
 
-        for (int b = 0; b < NUM_FILTERS_1; b++) {
-            for (int c = 0; c < INPUT_FILTERS_1; c++) {
-                for (int i = 0; i < KERNEL_SIZE_1; i++) {
-                    for (int j = 0; j < KERNEL_SIZE_1; j++) {
-                        params.weights1[b][c][i][j] = atof(token);
-                        token = strtok(NULL, " ");
-                    }
-                }
+void normalizeImage(const cv::Mat& image, ImageData& imageData, int padding) {
+    // Convert the resized image to a 3x124x124 array
+    PROFILE_SCOPE(PROFILE_NORMALIZE);
+    cv::Mat channels[INPUT_FILTERS_1];
+    cv::split(image, channels);
+
+    for (int f = 0; f < INPUT_FILTERS_1; f++) {
+        for (int i = 0; i < INPUT_ROWS_1; i++) {
+            for (int j = 0; j < INPUT_COLS_1; j++) {
+                imageData.image[INPUT_FILTERS_1 - f - 1][padding + i][padding + j] =
+                    (static_cast<float>(channels[f].at<uchar>(i, j)) - MEAN) / STD;
             }
         }
     }
 
-    // Read biases of layer 1
-    if (fgets(line, MAX_LINE_SIZE, file)) {
-        char* token;
-        token = strtok(line, " ");
-        for (int c = 0; c < NUM_FILTERS_1; c++) {
-            params.biases1[c] = atof(token);
-            token = strtok(NULL, " ");
+    padImage(imageData, padding);
+}
+
+void tensorImage(const float* tensor, ImageData& imageData, int padding) {
+    for (int f = 0; f < INPUT_FILTERS_1; f++) {
+        for (int i = 0; i < INPUT_ROWS_1; i++) {
+            memcpy(&imageData.image[f][padding + i][padding], tensor + (f * INPUT_ROWS_1 + i) * INPUT_COLS_1,
+                   INPUT_COLS_1 * sizeof(float));
         }
     }
 
-    // Read weights of layer 3
-    if (fgets(line, MAX_LINE_SIZE, file)) {
-
-        char* token;
-        token = strtok(line, " ");
+    padImage(imageData, padding);
+}
 
-        for (int b = 0; b < NUM_FILTERS_3; b++) {
-            for (int c = 0; c < INPUT_FILTERS_3; c++) {
-                for (int i = 0; i < KERNEL_SIZE_3; i++) {
-                    for (int j = 0; j < KERNEL_SIZE_3; j++) {
-                        params.weights2[b][c][i][j] = atof(token);
-                        token = strtok(NULL, " ");
-                    }
-                }
+void syntheticImage(ImageData& imageData) {
+    unsigned int seed = 12345;
+    for (int f = 0; f < INPUT_FILTERS_1; f++) {
+        for (int i = PADDING_1; i < INPUT_ROWS_1 + PADDING_1; i++) {
+            for (int j = PADDING_1; j < INPUT_COLS_1 + PADDING_1; j++) {
+                seed = seed * 1103515245 + 12345;
+                imageData.image[f][i][j] = (float)((seed >> 8) & 0xffff) / 32768 - 1;
             }
         }
     }
 
-    // Read biases of layer 3
-    if (fgets(line, MAX_LINE_SIZE, file)) {
-        char* token;
-        token = strtok(line, " ");
-        for (int c = 0; c < NUM_FILTERS_3; c++) {
-            params.biases2[c] = atof(token);
-            token = strtok(NULL, " ");
+    padImage(imageData, PADDING_1);
+}
+
+void padImage(ImageData& imageData, int padding) {
+    imageData.height = INPUT_ROWS_1 + 2 * padding;
+    imageData.width = INPUT_COLS_1 + 2 * padding;
+    imageData.filters = INPUT_FILTERS_1;
+
+    // Apply Padding
+    for (int f = 0; f < imageData.filters; f++) {
+        for (int i = 0; i < imageData.height; i++) {
+            for (int j = 0; j < padding; j++) {
+                imageData.image[f][i][j] = 0;
+                imageData.image[f][imageData.height - i - 1][j] = 0;
+            }
         }
     }
-
-    // Read weights of layer 5
-    if (fgets(line, MAX_LINE_SIZE, file)) {
-
-        char* token;
-        token = strtok(line, " ");
-
-        for (int b = 0; b < NUM_FILTERS_5; b++) {
-            for (int c = 0; c < INPUT_FILTERS_5; c++) {
-                for (int i = 0; i < KERNEL_SIZE_5; i++) {
-                    for (int j = 0; j < KERNEL_SIZE_5; j++) {
-                        params.weights3[b][c][i][j] = atof(token);
-                        token = strtok(NULL, " ");
-                    }
-                }
+    for (int f = 0; f < imageData.filters; f++) {
+        for (int i = 0; i < padding; i++) {
+            for (int j = 0; j < imageData.width; j++) {
+                imageData.image[f][i][j] = 0;
+                imageData.image[f][i][imageData.width - j - 1] = 0;
             }
         }
     }
+}
+
+void walkDataset(const char* folderPath, ImageVisitor visit, void* context) {
+    DatasetScan* scan = startDatasetScan(folderPath, 0);
 
-    // Read biases of layer 5
-    if (fgets(line, MAX_LINE_SIZE, file)) {
-        char* token;
-        token = strtok(line, " ");
-        for (int c = 0; c < NUM_FILTERS_5; c++) {
-            params.biases3[c] = atof(token);
-            token = strtok(NULL, " ");
+    DatasetEntry entry;
+    while (nextDatasetEntry(*scan, entry)) {
+        if (!visit(entry.path.c_str(), entry.label, context)) {
+            break;
         }
     }
 
-    // Read weights of layer 6
-    if (fgets(line, MAX_LINE_SIZE, file)) {
+    finishDatasetScan(scan, NULL);
+}
 
-        char* token;
-        token = strtok(line, " ");
+typedef struct SerialContext {
+    ImageData* imageData;
+    Workspace* workspace;
+    const Params* param;
+    cv::Mat* image;
+    int padding;
+    int* test_set_size;
+    int* correct_cases;
+    int* unlabelled_cases;
+} SerialContext;
 
-        for (int c = 0; c < WEIGHT_ROWS_7; c++) {
-            for (int i = 0; i < WEIGHT_COLS_7; i++) {
-                params.weights4[c][i] = atof(token);
-                token = strtok(NULL, " ");
-            }
-        }
+static bool scoreImage(const char* imagePath, int label, void* context) {
+    SerialContext* ctx = (SerialContext*)context;
+
+    // One bad file doesn't end the run, it just isn't counted
+    if (!preprocessImage(imagePath, *ctx->imageData, *ctx->image, ctx->padding)) {
+        fprintf(stderr, "Error: Could not read the image %s\n", imagePath);
+        return true;
     }
 
-    // Read biases of layer 6
-    if (fgets(line, MAX_LINE_SIZE, file)) {
-        char* token;
-        token = strtok(line, " ");
-        for (int c = 0; c < WEIGHT_ROWS_7; c++) {
-            params.biases4[c] = atof(token);
-            token = strtok(NULL, " ");
-        }
+    // Send the image data to forward pass
+    int res = forwardPass(*ctx->imageData, *ctx->workspace, *ctx->param);
+
+    if (res == label) {
+        (*ctx->correct_cases)++;
+    } else if (label < 0) {
+        (*ctx->unlabelled_cases)++;
     }
 
-    // Read weights of layer 7
-    if (fgets(line, MAX_LINE_SIZE, file)) {
+    // Count total images processed so far
+    (*ctx->test_set_size)++;
+    return true;
+}
 
-        char* token;
-        token = strtok(line, " ");
+void loadDataset(const char* folderPath, ImageData& imageData, int& test_set_size, int padding, const Params& param, cv::Mat& image,
+                 int& correct_cases, int& unlabelled_cases) {
+    Workspace* workspace = allocateWorkspace();
+    SerialContext ctx = {&imageData, workspace, &param, &image, padding, &test_set_size, &correct_cases, &unlabelled_cases};
+    walkDataset(folderPath, scoreImage, &ctx);
+    freeWorkspace(workspace);
+}
 
-        for (int c = 0; c < WEIGHT_ROWS_8; c++) {
-            for (int i = 0; i < WEIGHT_COLS_8; i++) {
-                params.weights5[c][i] = atof(token);
-                token = strtok(NULL, " ");
-            }
-        }
+typedef struct BatchContext {
+    ImageBatch* batch;
+    const Params* param;
+    cv::Mat* image;
+    int padding;
+    int* test_set_size;
+    int* correct_cases;
+    int* unlabelled_cases;
+    int* predictions;
+} BatchContext;
+
+static void flushBatch(BatchContext* ctx) {
+    ImageBatch& batch = *ctx->batch;
+    forwardBatch(batch, *ctx->param, ctx->predictions);
+
+    for (int b = 0; b < batch.size; b++) {
+        if (ctx->predictions[b] == batch.labels[b]) {
+            (*ctx->correct_cases)++;
+        } else if (batch.labels[b] < 0) {
+            (*ctx->unlabelled_cases)++;
+        }
+    }
+    *ctx->test_set_size += batch.size;
+    batch.size = 0;
+}
+
+static bool batchImage(const char* imagePath, int label, void* context) {
+    BatchContext* ctx = (BatchContext*)context;
+    ImageBatch& batch = *ctx->batch;
+
+    if (!preprocessImage(imagePath, batch.images[batch.size], *ctx->image, ctx->padding)) {
+        fprintf(stderr, "Error: Could not read the image %s\n", imagePath);
+        return true;
     }
+    batch.labels[batch.size++] = label;
 
-    // Read biases of layer 7
-    if (fgets(line, MAX_LINE_SIZE, file)) {
-        char* token;
-        token = strtok(line, " ");
-        for (int c = 0; c < WEIGHT_ROWS_8; c++) {
-            params.biases5[c] = atof(token);
-            token = strtok(NULL, " ");
-        }
+    if (batch.size == batch.capacity) {
+        flushBatch(ctx);
     }
+    return true;
+}
 
-    // Read weights of layer 8
-    if (fgets(line, MAX_LINE_SIZE, file)) {
+void loadDatasetBatched(const char* folderPath, ImageBatch& batch, int& test_set_size, int padding, const Params& param, cv::Mat& image,
+                        int& correct_cases, int& unlabelled_cases) {
+    int* predictions = new int[batch.capacity];
+    BatchContext ctx = {&batch, &param, &image, padding, &test_set_size, &correct_cases, &unlabelled_cases, predictions};
 
-        char* token;
-        token = strtok(line, " ");
+    batch.size = 0;
+    walkDataset(folderPath, batchImage, &ctx);
 
-        for (int c = 0; c < WEIGHT_ROWS_9; c++) {
-            for (int i = 0; i < WEIGHT_COLS_9; i++) {
-                params.weights6[c][i] = atof(token);
-                token = strtok(NULL, " ");
+    // Score the last, partially filled batch
+    if (batch.size > 0) {
+        flushBatch(&ctx);
+    }
+    delete[] predictions;
+}
+
+// Written once by its worker when it finishes, summed after join. Adjacent tallies may share a cache line, so
+// evaluateWorker keeps the running counts in locals.
+typedef struct WorkerTally {
+    int test_set_size;
+    int correct_cases;
+    int unlabelled_cases;
+} WorkerTally;
+
+static void evaluateWorker(DatasetScan* scan, const Params* param, int padding, int batch_size, WorkerTally* tally) {
+    ImageBatch batch;
+    allocateBatch(batch, batch_size);
+    int* predictions = new int[batch_size];
+    cv::Mat image;
+    DatasetEntry entry;
+    bool more = true;
+    int test_set_size = 0;
+    int correct_cases = 0;
+    int unlabelled_cases = 0;
+
+    // Entries are taken as the scan finds them, no worker waits for the whole tree to be listed
+    while (more) {
+        batch.size = 0;
+        while (batch.size < batch_size && (more = nextDatasetEntry(*scan, entry))) {
+            if (!preprocessImage(entry.path.c_str(), batch.images[batch.size], image, padding)) {
+                fprintf(stderr, "Error: Could not read the image %s\n", entry.path.c_str());
+                continue;
             }
+            batch.labels[batch.size++] = entry.label;
+        }
+        if (batch.size == 0) {
+            continue;
         }
-    }
 
-    // Read biases of layer 8
-    if (fgets(line, MAX_LINE_SIZE, file)) {
-        char* token;
-        token = strtok(line, " ");
-        for (int c = 0; c < WEIGHT_ROWS_9; c++) {
-            params.biases6[c] = atof(token);
-            token = strtok(NULL, " ");
+        forwardBatch(batch, *param, predictions);
+        for (int b = 0; b < batch.size; b++) {
+            if (predictions[b] == batch.labels[b]) {
+                correct_cases++;
+            } else if (batch.labels[b] < 0) {
+                unlabelled_cases++;
+            }
         }
+        test_set_size += batch.size;
     }
+    tally->test_set_size = test_set_size;
+    tally->correct_cases = correct_cases;
+    tally->unlabelled_cases = unlabelled_cases;
 
-    fclose(file);
+    delete[] predictions;
+    freeBatch(batch);
 }
 
-int forwardPass(ImageData& inputData, Params& param) {
+static bool entryBefore(const DatasetEntry& a, const DatasetEntry& b) {
+    return a.path < b.path;
+}
 
-    layer_1_conv(inputData, param, PADDING_1, PADDING_2, STRIDE_1, KERNEL_SIZE_1, NUM_FILTERS_1, INPUT_FILTERS_1);
-    layer_2_max_pool(inputData, PADDING_2, PADDING_3, STRIDE_2, KERNEL_SIZE_2, NUM_FILTERS_2);
-    layer_3_conv(inputData, param, PADDING_3, PADDING_4, STRIDE_3, KERNEL_SIZE_3, NUM_FILTERS_3, INPUT_FILTERS_3);
-    layer_4_max_pool(inputData, PADDING_4, PADDING_5, STRIDE_4, KERNEL_SIZE_4, NUM_FILTERS_4);
-    layer_5_conv(inputData, param, PADDING_5, PADDING_6, STRIDE_5, KERNEL_SIZE_5, NUM_FILTERS_5, INPUT_FILTERS_5);
-    layer_6_max_pool_flatten(inputData, PADDING_6, STRIDE_6, KERNEL_SIZE_6, INPUT_COLS_7, NUM_FILTERS_6);
-    layer_7_fc(inputData, param, WEIGHT_ROWS_7, WEIGHT_COLS_7);
-    layer_8_fc(inputData, param, WEIGHT_ROWS_8, WEIGHT_COLS_8);
-    layer_9_fc(inputData, param, WEIGHT_ROWS_9, WEIGHT_COLS_9);
+void listDataset(const char* folderPath, std::vector<DatasetEntry>& entries) {
+    size_t first = entries.size();
+    DatasetScan* scan = startDatasetScan(folderPath, 0);
 
-    int max_ind = 0;
-    for (int i = 1; i < TOTAL_CLASSES; i++) {
-        if (inputData.layer_9[i] > inputData.layer_9[max_ind]) {
-            max_ind = i;
-        }
+    DatasetEntry entry;
+    while (nextDatasetEntry(*scan, entry)) {
+        entries.push_back(entry);
     }
+    finishDatasetScan(scan, NULL);
 
-    return max_ind;
+    // The scanners race each other, sort so packing and calibration see the same order on every run
+    std::sort(entries.begin() + first, entries.end(), entryBefore);
 }
 
-void layer_9_fc(ImageData& imageData, Params& param, int rows, int cols) {
-    for (int n = 0; n < rows; n++) {
-        imageData.layer_9[n] = 0;
-
-        for (int i = 0; i < cols; i++) {
-            imageData.layer_9[n] += imageData.layer_8[i] * param.weights6[n][i];
+void loadDatasetParallel(const char* folderPath, int& test_set_size, int padding, const Params& param, int& correct_cases,
+                         int& unlabelled_cases, int num_threads, int batch_size) {
+    if (num_threads <= 0) {
+        num_threads = (int)std::thread::hardware_concurrency();
+        if (num_threads <= 0) {
+            num_threads = 1;
         }
-
-        imageData.layer_9[n] = imageData.layer_9[n] + param.biases6[n];
     }
-}
 
-void layer_8_fc(ImageData& imageData, Params& param, int rows, int cols) {
-    for (int n = 0; n < rows; n++) {
-        imageData.layer_8[n] = 0;
+    // The workers already saturate the cores, keep OpenCV from spawning its own threads on top
+    int cv_threads = cv::getNumThreads();
+    cv::setNumThreads(1);
 
-        for (int i = 0; i < cols; i++) {
-            imageData.layer_8[n] += imageData.layer_7[i] * param.weights5[n][i];
-        }
+    DatasetScan* scan = startDatasetScan(folderPath, 0);
+    std::vector<WorkerTally> tallies(num_threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) {
+        tallies[t].test_set_size = 0;
+        tallies[t].correct_cases = 0;
+        tallies[t].unlabelled_cases = 0;
+        workers.push_back(std::thread(evaluateWorker, scan, &param, padding, batch_size, &tallies[t]));
+    }
 
-        imageData.layer_8[n] = relu(imageData.layer_8[n] + param.biases5[n]);
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].join();
+        test_set_size += tallies[t].test_set_size;
+        correct_cases += tallies[t].correct_cases;
+        unlabelled_cases += tallies[t].unlabelled_cases;
     }
+    finishDatasetScan(scan, NULL);
+
+    cv::setNumThreads(cv_threads);
 }
 
-void layer_7_fc(ImageData& imageData, Params& param, int rows, int cols) {
-    for (int n = 0; n < rows; n++) {
-        imageData.layer_7[n] = 0;
+// Reads the next line of the parameter file and parses exactly count values from it
+static bool readValues(FILE* file, char*& line, size_t& capacity, float* values, int count, const char* name) {
+    if (getline(&line, &capacity, file) < 0) {
+        fprintf(stderr, "Parameter file ends before %s\n", name);
+        return false;
+    }
 
-        for (int i = 0; i < cols; i++) {
-            imageData.layer_7[n] += imageData.layer_6[i] * param.weights4[n][i];
+    char* cursor = line;
+    for (int i = 0; i < count; i++) {
+        char* end;
+        values[i] = strtod(cursor, &end);
+        if (end == cursor) {
+            fprintf(stderr, "Expected %d values for %s, found %d\n", count, name, i);
+            return false;
         }
+        cursor = end;
+    }
 
-        imageData.layer_7[n] = relu(imageData.layer_7[n] + param.biases4[n]);
+    while (isspace((unsigned char)*cursor)) {
+        cursor++;
+    }
+    if (*cursor != '\0') {
+        fprintf(stderr, "Expected %d values for %s, found more\n", count, name);
+        return false;
     }
+    return true;
 }
 
-void layer_6_max_pool_flatten(ImageData& imageData, int padding, int stride, int kernel_size, int out_filters, int in_filters) {
-
-    imageData.height = COMPUTE_OUTPUT_SIZE(imageData.height - 2 * padding, padding, kernel_size, stride);
-    imageData.width = COMPUTE_OUTPUT_SIZE(imageData.width - 2 * padding, padding, kernel_size, stride);
-    imageData.filters = out_filters;
-    int stride_x, stride_y;
-
-    int ind = 0;
-    for (int in_f = 0; in_f < in_filters; in_f++) {
-        for (int row = 0; row < imageData.height; row++) {
-            for (int col = 0; col < imageData.width; col++) {
-
-                stride_x = stride * row;
-                stride_y = stride * col;
-                float max_val = INT32_MIN;
-
-                for (int i = 0; i < kernel_size; i++) {
-                    for (int j = 0; j < kernel_size; j++) {
-                        if (imageData.layer_5[in_f][stride_x + i][stride_y + j] > max_val) {
-                            max_val = imageData.layer_5[in_f][stride_x + i][stride_y + j];
-                        }
-                    }
-                }
-                imageData.layer_6[ind++] = max_val;
-            }
-        }
+bool loadParams(const char* paramPath, Params& params) {
+    FILE* file = fopen(paramPath, "rb");
+    if (file == NULL) {
+        printf("Failed to open the file.\n");
+        return false;
+    }
+
+    // Lines are grown by getline, the largest (layer 7 weights) is over a megabyte of text
+    char* line = NULL;
+    size_t capacity = 0;
+
+    // One line per tensor: weights then biases of layers 1, 3, 5, 7, 8 and 9
+    bool ok = readValues(file, line, capacity, &params.weights1[0][0][0][0],
+                         NUM_FILTERS_1 * INPUT_FILTERS_1 * KERNEL_SIZE_1 * KERNEL_SIZE_1, "weights1") &&
+              readValues(file, line, capacity, params.biases1, NUM_FILTERS_1, "biases1") &&
+              readValues(file, line, capacity, &params.weights2[0][0][0][0],
+                         NUM_FILTERS_3 * INPUT_FILTERS_3 * KERNEL_SIZE_3 * KERNEL_SIZE_3, "weights2") &&
+              readValues(file, line, capacity, params.biases2, NUM_FILTERS_3, "biases2") &&
+              readValues(file, line, capacity, &params.weights3[0][0][0][0],
+                         NUM_FILTERS_5 * INPUT_FILTERS_5 * KERNEL_SIZE_5 * KERNEL_SIZE_5, "weights3") &&
+              readValues(file, line, capacity, params.biases3, NUM_FILTERS_5, "biases3") &&
+              readValues(file, line, capacity, &params.weights4[0][0], WEIGHT_ROWS_7 * WEIGHT_COLS_7, "weights4") &&
+              readValues(file, line, capacity, params.biases4, WEIGHT_ROWS_7, "biases4") &&
+              readValues(file, line, capacity, &params.weights5[0][0], WEIGHT_ROWS_8 * WEIGHT_COLS_8, "weights5") &&
+              readValues(file, line, capacity, params.biases5, WEIGHT_ROWS_8, "biases5") &&
+              readValues(file, line, capacity, &params.weights6[0][0], WEIGHT_ROWS_9 * WEIGHT_COLS_9, "weights6") &&
+              readValues(file, line, capacity, params.biases6, WEIGHT_ROWS_9, "biases6");
+
+    free(line);
+    fclose(file);
+    if (!ok) {
+        return false;
     }
-}
 
-void layer_5_conv(ImageData& imageData, Params& param, int padding, int new_padding, int stride, int kernel_size, int out_filters,
-                  int in_filters) {
+    packParams(params);
+    return true;
+}
 
-    imageData.height = COMPUTE_OUTPUT_SIZE(imageData.height - 2 * padding, padding, kernel_size, stride);
-    imageData.width = COMPUTE_OUTPUT_SIZE(imageData.width - 2 * padding, padding, kernel_size, stride);
-    imageData.filters = out_filters;
-    int stride_x, stride_y;
+void packParams(Params& params) {
+    // Pack weights once for the im2col + SGEMM and batched FC paths
+    packConvWeights(&params.weights1[0][0][0][0], params.packed1, NUM_FILTERS_1, INPUT_FILTERS_1, KERNEL_SIZE_1);
+    packConvWeights(&params.weights2[0][0][0][0], params.packed2, NUM_FILTERS_3, INPUT_FILTERS_3, KERNEL_SIZE_3);
+    packConvWeights(&params.weights3[0][0][0][0], params.packed3, NUM_FILTERS_5, INPUT_FILTERS_5, KERNEL_SIZE_5);
+    packConvWeights(&params.weights4[0][0], params.packed4, WEIGHT_ROWS_7, WEIGHT_COLS_7, 1);
+    packConvWeights(&params.weights5[0][0], params.packed5, WEIGHT_ROWS_8, WEIGHT_COLS_8, 1);
+    packConvWeights(&params.weights6[0][0], params.packed6, WEIGHT_ROWS_9, WEIGHT_COLS_9, 1);
+    winogradTransformWeights(&params.weights3[0][0][0][0], params.winograd3, NUM_FILTERS_5, INPUT_FILTERS_5);
+    packBlockedWeights(&params.weights1[0][0][0][0], params.blocked1, NUM_FILTERS_1, INPUT_FILTERS_1, KERNEL_SIZE_1, 1);
+    packBlockedWeights(&params.weights2[0][0][0][0], params.blocked2, NUM_FILTERS_3, INPUT_FILTERS_3, KERNEL_SIZE_3, NCHWC_BLOCK);
+    packBlockedWeights(&params.weights3[0][0][0][0], params.blocked3, NUM_FILTERS_5, INPUT_FILTERS_5, KERNEL_SIZE_5, NCHWC_BLOCK);
+    params.conv_algorithm = CONV_NCHWC;
+    defaultTuningPlan(params.tuning);
+}
 
-    for (int j = 0; j < new_padding; j++) {
-        for (int f = 0; f < imageData.filters; f++) {
-            for (int i = 0; i < imageData.height; i++) {
-                imageData.layer_5[f][i][j] = 0;
-                imageData.layer_5[f][imageData.height - i - 1][j] = 0;
-            }
+int predictedClass(const float* scores) {
+    int max_ind = 0;
+    for (int i = 1; i < TOTAL_CLASSES; i++) {
+        if (scores[i] > scores[max_ind]) {
+            max_ind = i;
         }
     }
 
-    for (int i = 0; i < new_padding; i++) {
-        for (int j = 0; j < imageData.width; j++) {
-            for (int f = 0; f < imageData.filters; f++) {
-                imageData.layer_5[f][i][j] = 0;
-                imageData.layer_5[f][i][imageData.width - j - 1] = 0;
+    return max_ind;
+}
+
+float winogradError(Params& param) {
+    ImageData* imageData = new ImageData();
+    Workspace* reference = allocateWorkspace();
+    Workspace* winograd = allocateWorkspace();
+
+    // Deterministic input in [-1, 1) with a zero padding ring, as layer_4_max_pool would leave it
+    unsigned int seed = 12345;
+    for (int f = 0; f < INPUT_FILTERS_5; f++) {
+        for (int i = PADDING_5; i < INPUT_ROWS_5 + PADDING_5; i++) {
+            for (int j = PADDING_5; j < INPUT_COLS_5 + PADDING_5; j++) {
+                seed = seed * 1103515245 + 12345;
+                reference->layer_4[f][i][j] = (float)((seed >> 8) & 0xffff) / 32768 - 1;
             }
         }
     }
+    memcpy(winograd->layer_4, reference->layer_4, sizeof(reference->layer_4));
 
-    for (int out_f = 0; out_f < imageData.filters; out_f++) {
-        for (int row = 0; row < imageData.height; row++) {
-            for (int col = 0; col < imageData.width; col++) {
+    int algorithm = param.conv_algorithm;
+    param.conv_algorithm = CONV_DIRECT;
+    layer_5_conv(*imageData, *reference, param);
+    param.conv_algorithm = algorithm;
 
-                imageData.layer_5[out_f][row][col] = 0;
-                for (int in_f = 0; in_f < in_filters; in_f++) {
+    convWinograd<Layer5Conv>(&winograd->layer_4[0][0][0], param.winograd3, param.biases3, &winograd->layer_5[0][0][0],
+                             winograd->col_buffer);
 
-                    stride_x = stride * row;
-                    stride_y = stride * col;
+    const float* expected = &reference->layer_5[0][0][0];
+    const float* actual = &winograd->layer_5[0][0][0];
+    float max_diff = 0, max_val = 0;
+    for (size_t i = 0; i < sizeof(reference->layer_5) / sizeof(float); i++) {
+        max_diff = fmaxf(max_diff, fabsf(expected[i] - actual[i]));
+        max_val = fmaxf(max_val, fabsf(expected[i]));
+    }
 
-                    for (int i = 0; i < kernel_size; i++) {
-                        for (int j = 0; j < kernel_size; j++) {
+    delete imageData;
+    freeWorkspace(reference);
+    freeWorkspace(winograd);
+    return (max_val > 0) ? max_diff / max_val : max_diff;
+}
 
-                            imageData.layer_5[out_f][row + new_padding][col + new_padding] +=
-                                imageData.layer_4[in_f][stride_x + i][stride_y + j] * param.weights3[out_f][in_f][i][j];
-                        }
-                    }
-                }
-                imageData.layer_5[out_f][row + new_padding][col + new_padding] =
-                    relu(imageData.layer_5[out_f][row][col] + param.biases3[out_f]);
-            }
-        }
+void convStack(ImageData& inputData, Workspace& workspace, const Params& param) {
+    if (param.conv_algorithm >= CONV_FUSED_GEMM) {
+        layer_1_2_conv_pool(inputData, workspace, param);
+        layer_3_4_conv_pool(inputData, workspace, param);
+        layer_5_6_conv_pool_flatten(inputData, workspace, param);
+        return;
     }
 
-    imageData.height += 2 * new_padding;
-    imageData.width += 2 * new_padding;
+    layer_1_conv(inputData, workspace, param);
+    layer_2_max_pool(inputData, workspace);
+    layer_3_conv(inputData, workspace, param);
+    layer_4_max_pool(inputData, workspace);
+    layer_5_conv(inputData, workspace, param);
+    layer_6_max_pool_flatten(inputData, workspace);
 }
 
-void layer_4_max_pool(ImageData& imageData, int padding, int new_padding, int stride, int kernel_size, int out_filters) {
+int forwardPass(ImageData& inputData, Workspace& workspace, const Params& param) {
+    PROFILE_SCOPE(PROFILE_FORWARD_PASS);
 
-    imageData.height = COMPUTE_OUTPUT_SIZE(imageData.height - 2 * padding, padding, kernel_size, stride);
-    imageData.width = COMPUTE_OUTPUT_SIZE(imageData.width - 2 * padding, padding, kernel_size, stride);
-    imageData.filters = out_filters;
-    int stride_x, stride_y;
+    convStack(inputData, workspace, param);
+    layer_7_fc(inputData, param);
+    layer_8_fc(inputData, param);
+    layer_9_fc(inputData, param);
 
-    for (int j = 0; j < new_padding; j++) {
-        for (int f = 0; f < imageData.filters; f++) {
-            for (int i = 0; i < imageData.height; i++) {
-                imageData.layer_4[f][i][j] = 0;
-                imageData.layer_4[f][imageData.height - i - 1][j] = 0;
-            }
-        }
-    }
+    return predictedClass(inputData.layer_9);
+}
 
-    for (int i = 0; i < new_padding; i++) {
-        for (int j = 0; j < imageData.width; j++) {
-            for (int f = 0; f < imageData.filters; f++) {
-                imageData.layer_4[f][i][j] = 0;
-                imageData.layer_4[f][i][imageData.width - j - 1] = 0;
-            }
-        }
+void forwardBatch(ImageBatch& batch, const Params& param, int* predictions) {
+    PROFILE_SCOPE(PROFILE_FORWARD_BATCH);
+
+    // Conv weights are small next to the activations, so the conv stack runs image by image while they stay in cache
+    for (int b = 0; b < batch.size; b++) {
+        convStack(batch.images[b], *batch.workspace, param);
     }
 
-    for (int out_f = 0; out_f < imageData.filters; out_f++) {
-        for (int row = 0; row < imageData.height; row++) {
-            for (int col = 0; col < imageData.width; col++) {
+    // Under half a GEMM_NR panel the zero padding costs more than the weight reuse saves, unless tuned otherwise
+    int gemm_batch = (param.conv_algorithm == CONV_TUNED) ? param.tuning.fc_batch_min : GEMM_NR / 2;
+    fcLayersBatch(batch, param, batch.size >= gemm_batch);
 
-                stride_x = stride * row;
-                stride_y = stride * col;
-                float max_val = INT32_MIN;
+    for (int b = 0; b < batch.size; b++) {
+        predictions[b] = predictedClass(batch.images[b].layer_9);
+    }
+}
 
-                for (int i = 0; i < kernel_size; i++) {
-                    for (int j = 0; j < kernel_size; j++) {
-                        if (imageData.layer_3[out_f][stride_x + i][stride_y + j] > max_val) {
-                            max_val = imageData.layer_3[out_f][stride_x + i][stride_y + j];
-                        }
-                    }
-                }
-                imageData.layer_4[out_f][row + new_padding][col + new_padding] = max_val;
-            }
+void fcLayersBatch(ImageBatch& batch, const Params& param, bool gemm) {
+    if (!gemm) {
+        for (int b = 0; b < batch.size; b++) {
+            layer_7_fc(batch.images[b], param);
+            layer_8_fc(batch.images[b], param);
+            layer_9_fc(batch.images[b], param);
         }
+        return;
     }
 
-    imageData.height += 2 * new_padding;
-    imageData.width += 2 * new_padding;
+    // The FC weights dominate, so each layer is one GEMM that streams them once for the whole batch
+    PROFILE_SCOPE(PROFILE_FC_BATCH);
+    int stride = sizeof(ImageData) / sizeof(float);
+    ImageData& first = batch.images[0];
+    fullyConnectedBatch<Layer7Fc>(param.packed4, param.biases4, first.layer_6, stride, first.layer_7, stride, batch.size,
+                                  batch.packed_activations);
+    fullyConnectedBatch<Layer8Fc>(param.packed5, param.biases5, first.layer_7, stride, first.layer_8, stride, batch.size,
+                                  batch.packed_activations);
+    fullyConnectedBatch<Layer9Fc>(param.packed6, param.biases6, first.layer_8, stride, first.layer_9, stride, batch.size,
+                                  batch.packed_activations);
 }
 
-void layer_3_conv(ImageData& imageData, Params& param, int padding, int new_padding, int stride, int kernel_size, int out_filters,
-                  int in_filters) {
+void allocateBatch(ImageBatch& batch, int capacity) {
+    batch.capacity = capacity;
+    batch.size = 0;
+    batch.images = new ImageData[capacity]();
+    batch.labels = new int[capacity];
+    batch.packed_activations = new float[ROUND_UP(capacity, GEMM_NR) * INPUT_COLS_7];
+    batch.workspace = allocateWorkspace();
+}
 
-    imageData.height = COMPUTE_OUTPUT_SIZE(imageData.height - 2 * padding, padding, kernel_size, stride);
-    imageData.width = COMPUTE_OUTPUT_SIZE(imageData.width - 2 * padding, padding, kernel_size, stride);
-    imageData.filters = out_filters;
-    int stride_x, stride_y;
+void freeBatch(ImageBatch& batch) {
+    delete[] batch.images;
+    delete[] batch.labels;
+    delete[] batch.packed_activations;
+    freeWorkspace(batch.workspace);
+    batch.images = NULL;
+    batch.labels = NULL;
+    batch.packed_activations = NULL;
+    batch.workspace = NULL;
+    batch.capacity = 0;
+    batch.size = 0;
+}
 
-    for (int j = 0; j < new_padding; j++) {
-        for (int f = 0; f < imageData.filters; f++) {
-            for (int i = 0; i < imageData.height; i++) {
-                imageData.layer_3[f][i][j] = 0;
-                imageData.layer_3[f][imageData.height - i - 1][j] = 0;
-            }
-        }
+Workspace* allocateWorkspace() {
+    void* memory = NULL;
+    if (posix_memalign(&memory, 64, sizeof(Workspace)) != 0) {
+        fprintf(stderr, "Failed to allocate a %zu byte workspace\n", sizeof(Workspace));
+        abort();
     }
+    memset(memory, 0, sizeof(Workspace));
+    return (Workspace*)memory;
+}
 
-    for (int i = 0; i < new_padding; i++) {
-        for (int j = 0; j < imageData.width; j++) {
-            for (int f = 0; f < imageData.filters; f++) {
-                imageData.layer_3[f][i][j] = 0;
-                imageData.layer_3[f][i][imageData.width - j - 1] = 0;
-            }
-        }
-    }
+void freeWorkspace(Workspace* workspace) {
+    free(workspace);
+}
 
-    for (int out_f = 0; out_f < imageData.filters; out_f++) {
-        for (int row = 0; row < imageData.height; row++) {
-            for (int col = 0; col < imageData.width; col++) {
+Params* allocateParams() {
+    void* memory = NULL;
+    if (posix_memalign(&memory, 64, sizeof(Params)) != 0) {
+        fprintf(stderr, "Failed to allocate %zu bytes of parameters\n", sizeof(Params));
+        abort();
+    }
+    memset(memory, 0, sizeof(Params));
+    return (Params*)memory;
+}
 
-                imageData.layer_3[out_f][row][col] = 0;
-                for (int in_f = 0; in_f < in_filters; in_f++) {
+void freeParams(Params* params) {
+    free(params);
+}
 
-                    stride_x = stride * row;
-                    stride_y = stride * col;
+// Records the shape of the activation a layer just wrote
+template <class A>
+static void setShape(ImageData& imageData) {
+    imageData.filters = A::filters;
+    imageData.height = A::height;
+    imageData.width = A::width;
+}
 
-                    for (int i = 0; i < kernel_size; i++) {
-                        for (int j = 0; j < kernel_size; j++) {
+void layer_9_fc(ImageData& imageData, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_9_FC);
+    fullyConnected<Layer9Fc>(&param.weights6[0][0], param.biases6, imageData.layer_8, imageData.layer_9);
+}
 
-                            imageData.layer_3[out_f][row + new_padding][col + new_padding] +=
-                                imageData.layer_2[in_f][stride_x + i][stride_y + j] * param.weights2[out_f][in_f][i][j];
-                        }
-                    }
-                }
-                imageData.layer_3[out_f][row + new_padding][col + new_padding] =
-                    relu(imageData.layer_3[out_f][row][col] + param.biases2[out_f]);
-            }
-        }
-    }
+void layer_8_fc(ImageData& imageData, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_8_FC);
+    fullyConnected<Layer8Fc>(&param.weights5[0][0], param.biases5, imageData.layer_7, imageData.layer_8);
+}
 
-    imageData.height += 2 * new_padding;
-    imageData.width += 2 * new_padding;
+void layer_7_fc(ImageData& imageData, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_7_FC);
+    fullyConnected<Layer7Fc>(&param.weights4[0][0], param.biases4, imageData.layer_6, imageData.layer_7);
 }
 
-void layer_2_max_pool(ImageData& imageData, int padding, int new_padding, int stride, int kernel_size, int out_filters) {
+// The blocked layer 6 lives in col_buffer
+static_assert(Layer6Pool::Output::size <= COL_BUFFER_SIZE, "col_buffer too small for the blocked layer 6");
+static_assert(WINOGRAD_SCRATCH_SIZE(Layer5Conv::Input::filters) <= COL_BUFFER_SIZE, "col_buffer too small for the Winograd scratch");
 
-    imageData.height = COMPUTE_OUTPUT_SIZE(imageData.height - 2 * padding, padding, kernel_size, stride);
-    imageData.width = COMPUTE_OUTPUT_SIZE(imageData.width - 2 * padding, padding, kernel_size, stride);
-    imageData.filters = out_filters;
-    int stride_x, stride_y;
+// A reordered stage input lives in layer_1, which the fused stages never write
+static_assert(Layer2Pool::Output::size <= Layer2Pool::Input::size && Layer4Pool::Output::size <= Layer2Pool::Input::size,
+              "layer_1 too small for a reordered stage input");
 
-    for (int j = 0; j < new_padding; j++) {
-        for (int f = 0; f < imageData.filters; f++) {
-            for (int i = 0; i < imageData.height; i++) {
-                imageData.layer_2[f][i][j] = 0;
-                imageData.layer_2[f][imageData.height - i - 1][j] = 0;
-            }
-        }
-    }
+// Algorithm and GEMM cache block of a fused stage (0 for layers 1 + 2), the active plan's under CONV_TUNED
+static int stageAlgorithm(const Params& param, int stage) {
+    return (param.conv_algorithm == CONV_TUNED) ? param.tuning.stages[stage].algorithm : param.conv_algorithm;
+}
 
-    for (int i = 0; i < new_padding; i++) {
-        for (int j = 0; j < imageData.width; j++) {
-            for (int f = 0; f < imageData.filters; f++) {
-                imageData.layer_2[f][i][j] = 0;
-                imageData.layer_2[f][i][imageData.width - j - 1] = 0;
-            }
-        }
+static int stageBlock(const Params& param, int stage) {
+    return (param.conv_algorithm == CONV_TUNED) ? param.tuning.stages[stage].block : GEMM_POOL_NC;
+}
+
+// The input A of a stage running consumer, written by a stage that ran producer. Only a tuned plan mixes the
+// planar and NCHWc layouts, the activation is then reordered into layer_1 for the stage that reads it
+template <class A>
+static const float* stageInput(const float* input, int producer, int consumer, Workspace& workspace) {
+    if ((producer == CONV_NCHWC) == (consumer == CONV_NCHWC)) {
+        return input;
+    }
+    float* reordered = &workspace.layer_1[0][0][0];
+    if (consumer == CONV_NCHWC) {
+        reorderToBlocked(input, reordered, A::filters, A::height, A::width, NCHWC_BLOCK);
+    } else {
+        reorderFromBlocked(input, reordered, A::filters, A::height, A::width, NCHWC_BLOCK);
     }
+    return reordered;
+}
+
+void layer_5_6_conv_pool_flatten(ImageData& imageData, Workspace& workspace, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_5_6_CONV_POOL_FLATTEN);
+    int algorithm = stageAlgorithm(param, 2);
+    const float* input =
+        stageInput<Layer4Pool::Output>(&workspace.layer_4[0][0][0], stageAlgorithm(param, 1), algorithm, workspace);
+
+    if (algorithm == CONV_NCHWC) {
+        // Pool into col_buffer, blocked, then reorder to the planar order the FC weights expect
+        convPoolBlocked<Layer5Conv, Layer6Pool, NCHWC_BLOCK>(input, param.blocked3, param.biases3, workspace.col_buffer);
+        reorderFromBlocked(workspace.col_buffer, imageData.layer_6, Layer6Pool::Output::filters, Layer6Pool::Output::rows,
+                           Layer6Pool::Output::cols, NCHWC_BLOCK);
+    } else if (algorithm == CONV_FUSED_WINOGRAD) {
+        // Unpadded pooled planes laid out back to back are exactly the flattened layer_6
+        convPoolWinograd<Layer5Conv, Layer6Pool>(input, param.winograd3, param.biases3, imageData.layer_6, workspace.col_buffer);
+    } else {
+        convPoolGemm<Layer5Conv, Layer6Pool>(input, param.packed3, param.biases3, imageData.layer_6, workspace.col_buffer,
+                                             stageBlock(param, 2));
+    }
+    setShape<Layer6Pool::Output>(imageData);
+}
 
-    for (int out_f = 0; out_f < imageData.filters; out_f++) {
-        for (int row = 0; row < imageData.height; row++) {
-            for (int col = 0; col < imageData.width; col++) {
+void layer_3_4_conv_pool(ImageData& imageData, Workspace& workspace, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_3_4_CONV_POOL);
+    int algorithm = stageAlgorithm(param, 1);
+    const float* input =
+        stageInput<Layer2Pool::Output>(&workspace.layer_2[0][0][0], stageAlgorithm(param, 0), algorithm, workspace);
+    float* output = &workspace.layer_4[0][0][0];
+
+    if (algorithm == CONV_NCHWC) {
+        zeroPadding<Layer4Pool::Output, NCHWC_BLOCK>(output);
+        convPoolBlocked<Layer3Conv, Layer4Pool, NCHWC_BLOCK>(input, param.blocked2, param.biases2, output);
+    } else {
+        zeroPadding<Layer4Pool::Output, 1>(output);
+        convPoolGemm<Layer3Conv, Layer4Pool>(input, param.packed2, param.biases2, output, workspace.col_buffer,
+                                             stageBlock(param, 1));
+    }
+    setShape<Layer4Pool::Output>(imageData);
+}
 
-                stride_x = stride * row;
-                stride_y = stride * col;
-                float max_val = INT32_MIN;
+void layer_1_2_conv_pool(ImageData& imageData, Workspace& workspace, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_1_2_CONV_POOL);
+    float* output = &workspace.layer_2[0][0][0];
 
-                for (int i = 0; i < kernel_size; i++) {
-                    for (int j = 0; j < kernel_size; j++) {
-                        if (imageData.layer_1[out_f][stride_x + i][stride_y + j] > max_val) {
-                            max_val = imageData.layer_1[out_f][stride_x + i][stride_y + j];
-                        }
-                    }
-                }
-                imageData.layer_2[out_f][row + new_padding][col + new_padding] = max_val;
-            }
-        }
+    if (stageAlgorithm(param, 0) == CONV_NCHWC) {
+        // Planes are the blocked layout with a block of 1 channel, so the image is read as is
+        zeroPadding<Layer2Pool::Output, NCHWC_BLOCK>(output);
+        convPoolBlocked<Layer1Conv, Layer2Pool, 1>(&imageData.image[0][0][0], param.blocked1, param.biases1, output);
+    } else {
+        zeroPadding<Layer2Pool::Output, 1>(output);
+        convPoolGemm<Layer1Conv, Layer2Pool>(&imageData.image[0][0][0], param.packed1, param.biases1, output,
+                                             workspace.col_buffer, stageBlock(param, 0));
     }
-
-    imageData.height += 2 * new_padding;
-    imageData.width += 2 * new_padding;
+    setShape<Layer2Pool::Output>(imageData);
 }
 
-void layer_1_conv(ImageData& imageData, Params& param, int padding, int new_padding, int stride, int kernel_size, int out_filters,
-                  int in_filters) {
+void layer_6_max_pool_flatten(ImageData& imageData, Workspace& workspace) {
+    PROFILE_SCOPE(PROFILE_LAYER_6_MAX_POOL_FLATTEN);
+    // An unpadded output is already flat
+    maxPool<Layer6Pool>(&workspace.layer_5[0][0][0], imageData.layer_6);
+    setShape<Layer6Pool::Output>(imageData);
+}
 
-    imageData.height = COMPUTE_OUTPUT_SIZE(imageData.height - 2 * padding, padding, kernel_size, stride);
-    imageData.width = COMPUTE_OUTPUT_SIZE(imageData.width - 2 * padding, padding, kernel_size, stride);
-    imageData.filters = out_filters;
-    int stride_x, stride_y;
+void layer_5_conv(ImageData& imageData, Workspace& workspace, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_5_CONV);
+    const float* input = &workspace.layer_4[0][0][0];
+    float* output = &workspace.layer_5[0][0][0];
 
-    for (int j = 0; j < new_padding; j++) {
-        for (int f = 0; f < imageData.filters; f++) {
-            for (int i = 0; i < imageData.height; i++) {
-                imageData.layer_1[f][i][j] = 0;
-                imageData.layer_1[f][imageData.height - i - 1][j] = 0;
-            }
-        }
+    zeroPadding<Layer5Conv::Output, 1>(output);
+    if (param.conv_algorithm == CONV_DIRECT) {
+        convDirect<Layer5Conv>(input, &param.weights3[0][0][0][0], param.biases3, output);
+    } else {
+        convGemm<Layer5Conv>(input, param.packed3, param.biases3, output, workspace.col_buffer);
     }
+    setShape<Layer5Conv::Output>(imageData);
+}
 
-    for (int i = 0; i < new_padding; i++) {
-        for (int j = 0; j < imageData.width; j++) {
-            for (int f = 0; f < imageData.filters; f++) {
-                imageData.layer_1[f][i][j] = 0;
-                imageData.layer_1[f][i][imageData.width - j - 1] = 0;
-            }
-        }
-    }
+void layer_4_max_pool(ImageData& imageData, Workspace& workspace) {
+    PROFILE_SCOPE(PROFILE_LAYER_4_MAX_POOL);
+    // The buffer may hold a blocked tensor from a CONV_NCHWC pass, so the whole padding ring is cleared
+    zeroPadding<Layer4Pool::Output, 1>(&workspace.layer_4[0][0][0]);
+    maxPool<Layer4Pool>(&workspace.layer_3[0][0][0], &workspace.layer_4[0][0][0]);
+    setShape<Layer4Pool::Output>(imageData);
+}
 
-    for (int out_f = 0; out_f < imageData.filters; out_f++) {
-        for (int row = 0; row < imageData.height; row++) {
-            for (int col = 0; col < imageData.width; col++) {
+void layer_3_conv(ImageData& imageData, Workspace& workspace, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_3_CONV);
+    const float* input = &workspace.layer_2[0][0][0];
+    float* output = &workspace.layer_3[0][0][0];
 
-                imageData.layer_1[out_f][row][col] = 0;
-                for (int in_f = 0; in_f < in_filters; in_f++) {
+    zeroPadding<Layer3Conv::Output, 1>(output);
+    if (param.conv_algorithm == CONV_DIRECT) {
+        convDirect<Layer3Conv>(input, &param.weights2[0][0][0][0], param.biases2, output);
+    } else {
+        convGemm<Layer3Conv>(input, param.packed2, param.biases2, output, workspace.col_buffer);
+    }
+    setShape<Layer3Conv::Output>(imageData);
+}
 
-                    stride_x = stride * row;
-                    stride_y = stride * col;
+void layer_2_max_pool(ImageData& imageData, Workspace& workspace) {
+    PROFILE_SCOPE(PROFILE_LAYER_2_MAX_POOL);
+    // The buffer may hold a blocked tensor from a CONV_NCHWC pass, so the whole padding ring is cleared
+    zeroPadding<Layer2Pool::Output, 1>(&workspace.layer_2[0][0][0]);
+    maxPool<Layer2Pool>(&workspace.layer_1[0][0][0], &workspace.layer_2[0][0][0]);
+    setShape<Layer2Pool::Output>(imageData);
+}
 
-                    for (int i = 0; i < kernel_size; i++) {
-                        for (int j = 0; j < kernel_size; j++) {
+void layer_1_conv(ImageData& imageData, Workspace& workspace, const Params& param) {
+    PROFILE_SCOPE(PROFILE_LAYER_1_CONV);
+    const float* input = &imageData.image[0][0][0];
+    float* output = &workspace.layer_1[0][0][0];
 
-                            imageData.layer_1[out_f][row + new_padding][col + new_padding] +=
-                                imageData.image[in_f][stride_x + i][stride_y + j] * param.weights1[out_f][in_f][i][j];
-                        }
-                    }
-                }
-                imageData.layer_1[out_f][row + new_padding][col + new_padding] =
-                    relu(imageData.layer_1[out_f][row][col] + param.biases1[out_f]);
-            }
-        }
+    zeroPadding<Layer1Conv::Output, 1>(output);
+    if (param.conv_algorithm == CONV_DIRECT) {
+        convDirect<Layer1Conv>(input, &param.weights1[0][0][0][0], param.biases1, output);
+    } else {
+        convGemm<Layer1Conv>(input, param.packed1, param.biases1, output, workspace.col_buffer);
     }
-
-    imageData.height += 2 * new_padding;
-    imageData.width += 2 * new_padding;
+    setShape<Layer1Conv::Output>(imageData);
 }
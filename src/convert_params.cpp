@@ -0,0 +1,50 @@
+#include "../include/model_format.h"
+#include "../include/sparse.h"
+
+// Converts the text parameter file into the binary, mmap-able model format
+int main(int argc, char** argv) {
+    float sparsity = 0;
+    const char* paths[2];
+    int path_count = 0;
+
+    // --prune=S zeroes a fraction S of the layer 7 weight blocks, see sparse.h
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--prune=", 8) == 0) {
+            sparsity = atof(argv[i] + 8);
+            if (sparsity < 0 || sparsity >= 1) {
+                path_count = -1;
+                break;
+            }
+        } else if (argv[i][0] != '-' && path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            path_count = -1;
+            break;
+        }
+    }
+    if (path_count != 2) {
+        fprintf(stderr, "Usage: %s [--prune=S] <parameters.txt> <model.bin>\n", argv[0]);
+        return 1;
+    }
+
+    static Params params;
+    if (!loadParams(paths[0], params)) {
+        return 1;
+    }
+    if (sparsity > 0) {
+        printf("Layer 7 Weight Sparsity = %f\n", pruneWeights(params, sparsity) * 100);
+    }
+    if (!saveModel(paths[1], params)) {
+        return 1;
+    }
+
+    // Read it back through the same path the inference binary uses
+    MappedModel model;
+    if (!mapModel(paths[1], model, true)) {
+        return 1;
+    }
+    printf("Wrote %s (%zu bytes)\n", paths[1], model.size);
+    unmapModel(model);
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+#include "../include/dataset_scan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#define SCAN_CHUNK 256 // entries a producer collects before taking the lock
+
+struct DatasetScan {
+    std::mutex mutex;
+    std::condition_variable entry_ready;  // an entry was queued or the last producer finished
+    std::condition_variable entry_taken;  // the entry queue has room again
+    std::condition_variable folder_ready; // a folder was queued or the tree ran out of folders
+    std::deque<DatasetEntry> entries;
+    std::deque<std::string> folders;
+    int scanning;  // scanners reading a folder, which may still queue subfolders
+    int producers; // threads that may still queue entries
+    bool cancelled;
+    ScanStats stats;
+    std::vector<std::thread> threads;
+};
+
+static bool isImageFile(const char* fileName) {
+    const char* extension = strrchr(fileName, '.');
+    return extension != NULL && (strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0);
+}
+
+// Class index of the last folder in path, path being a folder or, with is_file, a file inside one
+static int folderLabel(const std::string& path, bool is_file) {
+    size_t end = path.size();
+    if (is_file) {
+        size_t slash = path.rfind('/');
+        if (slash == std::string::npos) {
+            return -1;
+        }
+        end = slash;
+    }
+    size_t start = path.rfind('/', (end > 0) ? end - 1 : 0);
+    start = (start == std::string::npos || start >= end) ? 0 : start + 1;
+    return classIndex(path.substr(start, end - start).c_str());
+}
+
+static void countError(DatasetScan& scan) {
+    std::lock_guard<std::mutex> lock(scan.mutex);
+    scan.stats.errors++;
+}
+
+// Moves found to the entry queue, waiting while the consumers are SCAN_QUEUE_CAPACITY entries behind.
+// Returns false if the scan was cancelled.
+static bool queueEntries(DatasetScan& scan, std::vector<DatasetEntry>& found) {
+    std::unique_lock<std::mutex> lock(scan.mutex);
+    for (size_t i = 0; i < found.size() && !scan.cancelled; i++) {
+        while (scan.entries.size() >= SCAN_QUEUE_CAPACITY && !scan.cancelled) {
+            // Consumers may be asleep on an empty queue this call has been filling
+            scan.entry_ready.notify_all();
+            scan.entry_taken.wait(lock);
+        }
+        if (!scan.cancelled) {
+            scan.entries.push_back(std::move(found[i]));
+            scan.stats.images++;
+        }
+    }
+    found.clear();
+    scan.entry_ready.notify_all();
+    return !scan.cancelled;
+}
+
+static void finishProducer(DatasetScan& scan) {
+    std::lock_guard<std::mutex> lock(scan.mutex);
+    if (--scan.producers == 0) {
+        scan.entry_ready.notify_all();
+    }
+}
+
+static void scanFolder(DatasetScan& scan, const std::string& folder) {
+    DIR* directory = opendir(folder.c_str());
+    if (directory == NULL) {
+        fprintf(stderr, "Failed to open directory: %s (%s)\n", folder.c_str(), strerror(errno));
+        countError(scan);
+        return;
+    }
+
+    // Images are labelled by the name of the folder they live in
+    int label = folderLabel(folder, false);
+    std::vector<std::string> subfolders;
+    std::vector<DatasetEntry> found;
+    bool cancelled = false;
+
+    struct dirent* entry;
+    while (!cancelled && (entry = readdir(directory)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        // Some filesystems (network, FUSE, old XFS) leave d_type unset, ask the inode instead. Like d_type this
+        // describes the entry itself, symbolic links are not followed.
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat info;
+            if (fstatat(dirfd(directory), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0) {
+                fprintf(stderr, "Failed to stat %s/%s (%s)\n", folder.c_str(), entry->d_name, strerror(errno));
+                countError(scan);
+                continue;
+            }
+            type = S_ISDIR(info.st_mode) ? DT_DIR : (S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        if (type == DT_DIR) {
+            subfolders.push_back(folder + "/" + entry->d_name);
+        } else if (type == DT_REG && isImageFile(entry->d_name)) {
+            DatasetEntry image = {folder + "/" + entry->d_name, label};
+            found.push_back(image);
+            if (found.size() == SCAN_CHUNK) {
+                cancelled = !queueEntries(scan, found);
+            }
+        }
+    }
+    closedir(directory);
+
+    if (!subfolders.empty()) {
+        std::lock_guard<std::mutex> lock(scan.mutex);
+        for (size_t i = 0; i < subfolders.size(); i++) {
+            scan.folders.push_back(std::move(subfolders[i]));
+        }
+        scan.folder_ready.notify_all();
+    }
+    if (!found.empty()) {
+        queueEntries(scan, found);
+    }
+}
+
+static void scanWorker(DatasetScan* scan) {
+    std::unique_lock<std::mutex> lock(scan->mutex);
+    for (;;) {
+        // An empty queue only means the tree is done once no scanner can add to it
+        while (scan->folders.empty() && scan->scanning > 0 && !scan->cancelled) {
+            scan->folder_ready.wait(lock);
+        }
+        if (scan->folders.empty() || scan->cancelled) {
+            break;
+        }
+
+        // Depth first keeps the folder queue short on wide trees
+        std::string folder = std::move(scan->folders.back());
+        scan->folders.pop_back();
+        scan->scanning++;
+        scan->stats.directories++;
+        lock.unlock();
+
+        scanFolder(*scan, folder);
+
+        lock.lock();
+        if (--scan->scanning == 0 && scan->folders.empty()) {
+            scan->folder_ready.notify_all();
+        }
+    }
+    lock.unlock();
+
+    finishProducer(*scan);
+}
+
+static void trim(std::string& text) {
+    size_t start = text.find_first_not_of(" \t\r\n");
+    size_t end = text.find_last_not_of(" \t\r\n");
+    text = (start == std::string::npos) ? std::string() : text.substr(start, end - start + 1);
+}
+
+// A class name of monkey_classes or its index, -2 if it is neither
+static int parseLabel(const std::string& text) {
+    char* end;
+    long index = strtol(text.c_str(), &end, 10);
+    if (end != text.c_str() && *end == '\0') {
+        return (index >= 0 && index < TOTAL_CLASSES) ? (int)index : -2;
+    }
+    int label = classIndex(text.c_str());
+    return (label < 0) ? -2 : label;
+}
+
+static void manifestWorker(DatasetScan* scan, std::string manifestPath) {
+    FILE* file = fopen(manifestPath.c_str(), "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open manifest: %s (%s)\n", manifestPath.c_str(), strerror(errno));
+        countError(*scan);
+        finishProducer(*scan);
+        return;
+    }
+
+    size_t slash = manifestPath.rfind('/');
+    std::string base = (slash == std::string::npos) ? std::string() : manifestPath.substr(0, slash + 1);
+
+    std::vector<DatasetEntry> found;
+    char* line = NULL;
+    size_t capacity = 0;
+    long line_number = 0;
+    bool cancelled = false;
+
+    while (!cancelled && getline(&line, &capacity, file) >= 0) {
+        line_number++;
+        std::string path(line);
+        std::string label_text;
+        size_t tab = path.find('\t');
+        if (tab != std::string::npos) {
+            label_text = path.substr(tab + 1);
+            path.resize(tab);
+            trim(label_text);
+        }
+        trim(path);
+        if (path.empty() || path[0] == '#') {
+            continue;
+        }
+        if (path[0] != '/') {
+            path = base + path;
+        }
+
+        int label = label_text.empty() ? folderLabel(path, true) : parseLabel(label_text);
+        if (label == -2) {
+            fprintf(stderr, "%s:%ld: unknown label \"%s\"\n", manifestPath.c_str(), line_number, label_text.c_str());
+            countError(*scan);
+            continue;
+        }
+
+        DatasetEntry image = {path, label};
+        found.push_back(image);
+        if (found.size() == SCAN_CHUNK) {
+            cancelled = !queueEntries(*scan, found);
+        }
+    }
+    if (!found.empty()) {
+        queueEntries(*scan, found);
+    }
+
+    free(line);
+    fclose(file);
+    {
+        std::lock_guard<std::mutex> lock(scan->mutex);
+        scan->stats.directories++;
+    }
+    finishProducer(*scan);
+}
+
+DatasetScan* startDatasetScan(const char* source, int scan_threads) {
+    DatasetScan* scan = new DatasetScan();
+    scan->scanning = 0;
+    scan->producers = 0;
+    scan->cancelled = false;
+    memset(&scan->stats, 0, sizeof(scan->stats));
+
+    struct stat info;
+    if (stat(source, &info) != 0) {
+        fprintf(stderr, "Failed to open dataset: %s (%s)\n", source, strerror(errno));
+        scan->stats.errors++;
+        return scan;
+    }
+
+    if (!S_ISDIR(info.st_mode)) {
+        scan->producers = 1;
+        scan->threads.push_back(std::thread(manifestWorker, scan, std::string(source)));
+        return scan;
+    }
+
+    // Labels come from the last path component, which a trailing slash would leave empty
+    std::string root(source);
+    while (root.size() > 1 && root[root.size() - 1] == '/') {
+        root.resize(root.size() - 1);
+    }
+    scan->folders.push_back(root);
+
+    if (scan_threads <= 0) {
+        scan_threads = DEFAULT_SCAN_THREADS;
+    }
+    scan->producers = scan_threads;
+    for (int t = 0; t < scan_threads; t++) {
+        scan->threads.push_back(std::thread(scanWorker, scan));
+    }
+    return scan;
+}
+
+bool nextDatasetEntry(DatasetScan& scan, DatasetEntry& entry) {
+    std::unique_lock<std::mutex> lock(scan.mutex);
+    while (scan.entries.empty() && scan.producers > 0) {
+        scan.entry_ready.wait(lock);
+    }
+    if (scan.entries.empty()) {
+        return false;
+    }
+
+    entry = std::move(scan.entries.front());
+    scan.entries.pop_front();
+    scan.entry_taken.notify_one();
+    return true;
+}
+
+void finishDatasetScan(DatasetScan* scan, ScanStats* stats) {
+    {
+        std::lock_guard<std::mutex> lock(scan->mutex);
+        scan->cancelled = true;
+        scan->entry_taken.notify_all();
+        scan->folder_ready.notify_all();
+    }
+    for (size_t t = 0; t < scan->threads.size(); t++) {
+        scan->threads[t].join();
+    }
+
+    if (stats != NULL) {
+        *stats = scan->stats;
+    }
+    delete scan;
+}
@@ -0,0 +1,406 @@
+#include "../include/dataset_shard.h"
+#include "../include/model_format.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#define SHARD_PIXELS (INPUT_FILTERS_1 * INPUT_ROWS_1 * INPUT_COLS_1)
+
+static_assert(sizeof(ShardHeader) == 64, "ShardHeader must stay 64 bytes");
+static_assert(sizeof(ShardEntry) == 16, "ShardEntry must stay 16 bytes");
+static_assert(SHARD_PIXELS % 8 == 0, "modelChecksum works on 8 byte words");
+
+static uint32_t recordBytes(int dtype) {
+    return (dtype == SHARD_DTYPE_FP32) ? SHARD_PIXELS * sizeof(float) : SHARD_PIXELS;
+}
+
+static int hardwareThreads(int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = (int)std::thread::hardware_concurrency();
+    }
+    return (num_threads <= 0) ? 1 : num_threads;
+}
+
+typedef struct PackContext {
+    const std::vector<DatasetEntry>* entries;
+    std::atomic<size_t> next_entry;
+    std::vector<char>* packed; // 1 for each entry whose record was written
+    std::atomic<bool> write_failed;
+    int fd;
+    int dtype;
+    uint64_t data_offset;
+    uint32_t record_bytes;
+} PackContext;
+
+static void packWorker(PackContext* ctx) {
+    ImageData* imageData = new ImageData();
+    uint8_t* record = new uint8_t[ctx->record_bytes];
+    cv::Mat image;
+
+    for (;;) {
+        size_t i = ctx->next_entry.fetch_add(1);
+        if (i >= ctx->entries->size()) {
+            break;
+        }
+
+        const char* path = (*ctx->entries)[i].path.c_str();
+        if (!decodeImage(path, image)) {
+            fprintf(stderr, "Error: Could not read the image %s\n", path);
+            continue;
+        }
+        resizeImage(image);
+
+        if (ctx->dtype == SHARD_DTYPE_U8) {
+            // Planar in the channel order normalizeImage writes, BGR pixels become RGB planes
+            for (int f = 0; f < INPUT_FILTERS_1; f++) {
+                for (int r = 0; r < INPUT_ROWS_1; r++) {
+                    const uchar* pixels = image.ptr(r);
+                    for (int c = 0; c < INPUT_COLS_1; c++) {
+                        record[(f * INPUT_ROWS_1 + r) * INPUT_COLS_1 + c] = pixels[c * INPUT_FILTERS_1 + INPUT_FILTERS_1 - f - 1];
+                    }
+                }
+            }
+        } else {
+            normalizeImage(image, *imageData, 0);
+            float* values = (float*)record;
+            for (int f = 0; f < INPUT_FILTERS_1; f++) {
+                for (int r = 0; r < INPUT_ROWS_1; r++) {
+                    memcpy(values + (f * INPUT_ROWS_1 + r) * INPUT_COLS_1, imageData->image[f][r], INPUT_COLS_1 * sizeof(float));
+                }
+            }
+        }
+
+        off_t offset = (off_t)(ctx->data_offset + i * ctx->record_bytes);
+        if (pwrite(ctx->fd, record, ctx->record_bytes, offset) != (ssize_t)ctx->record_bytes) {
+            ctx->write_failed.store(true);
+            break;
+        }
+        (*ctx->packed)[i] = 1;
+    }
+
+    delete[] record;
+    delete imageData;
+}
+
+// Path of an image relative to the folder it was listed from
+static const char* relativeName(const char* folderPath, const std::string& path) {
+    size_t length = strlen(folderPath);
+    if (path.compare(0, length, folderPath) != 0) {
+        return path.c_str();
+    }
+    const char* name = path.c_str() + length;
+    while (*name == '/') {
+        name++;
+    }
+    return name;
+}
+
+int packDataset(const char* folderPath, const char* path, int dtype, int num_threads) {
+    std::vector<DatasetEntry> entries;
+    listDataset(folderPath, entries);
+
+    // Every listed image gets an index slot and a record slot, names are only known to fit for the same reason
+    uint32_t capacity = (uint32_t)entries.size();
+    size_t names_size = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        names_size += strlen(relativeName(folderPath, entries[i].path)) + 1;
+    }
+    uint64_t index_end = sizeof(ShardHeader) + (uint64_t)capacity * sizeof(ShardEntry);
+    uint64_t data_offset = ROUND_UP(index_end + names_size, SHARD_PAGE_SIZE);
+    uint32_t record_bytes = recordBytes(dtype);
+    uint64_t file_size = data_offset + (uint64_t)capacity * record_bytes;
+
+    // Write next to the target and rename over it, like saveModel, with a per-process temporary name
+    std::string tmp_path = std::string(path) + ".tmp." + std::to_string((int)getpid());
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create %s\n", tmp_path.c_str());
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)file_size) != 0) {
+        fprintf(stderr, "Failed to size %s\n", tmp_path.c_str());
+        close(fd);
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+
+    std::vector<char> packed(capacity, 0);
+    PackContext ctx;
+    ctx.entries = &entries;
+    ctx.next_entry.store(0);
+    ctx.packed = &packed;
+    ctx.write_failed.store(false);
+    ctx.fd = fd;
+    ctx.dtype = dtype;
+    ctx.data_offset = data_offset;
+    ctx.record_bytes = record_bytes;
+
+    // The workers already saturate the cores, keep OpenCV from spawning its own threads on top
+    int cv_threads = cv::getNumThreads();
+    cv::setNumThreads(1);
+    num_threads = hardwareThreads(num_threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) {
+        workers.push_back(std::thread(packWorker, &ctx));
+    }
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].join();
+    }
+    cv::setNumThreads(cv_threads);
+
+    // Index and names of the images that made it, in listing order
+    size_t meta_size = data_offset - sizeof(ShardHeader);
+    char* meta = (char*)calloc(1, meta_size);
+    ShardEntry* index = (ShardEntry*)meta;
+    char* names = meta + (index_end - sizeof(ShardHeader));
+    uint32_t count = 0;
+    uint32_t name_offset = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        if (!packed[i]) {
+            continue;
+        }
+        const char* name = relativeName(folderPath, entries[i].path);
+        index[count].offset = (uint64_t)i * record_bytes;
+        index[count].label = entries[i].label;
+        index[count].name_offset = name_offset;
+        strcpy(names + name_offset, name);
+        name_offset += strlen(name) + 1;
+        count++;
+    }
+
+    bool ok = !ctx.write_failed.load() && pwrite(fd, meta, meta_size, sizeof(ShardHeader)) == (ssize_t)meta_size;
+    free(meta);
+
+    ShardHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SHARD_MAGIC, sizeof(header.magic));
+    header.version = SHARD_VERSION;
+    header.dtype = dtype;
+    header.count = count;
+    header.capacity = capacity;
+    header.filters = INPUT_FILTERS_1;
+    header.rows = INPUT_ROWS_1;
+    header.cols = INPUT_COLS_1;
+    header.record_bytes = record_bytes;
+    header.data_offset = data_offset;
+    header.file_size = file_size;
+
+    // Checksum what was written through a mapping of the file, the records never were in memory all at once
+    if (ok) {
+        void* base = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        ok = base != MAP_FAILED;
+        if (ok) {
+            madvise(base, file_size, MADV_SEQUENTIAL);
+            header.checksum = modelChecksum((const char*)base + sizeof(ShardHeader), file_size - sizeof(ShardHeader));
+            munmap(base, file_size);
+        }
+    }
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    ok = (close(fd) == 0) && ok;
+
+    if (!ok || rename(tmp_path.c_str(), path) != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+    return (int)count;
+}
+
+static bool validateShard(const char* path, const char* base, size_t size, bool verify_checksum) {
+    const ShardHeader* header = (const ShardHeader*)base;
+
+    if (size < sizeof(ShardHeader) || memcmp(header->magic, SHARD_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s is not a dataset shard\n", path);
+        return false;
+    }
+    if (header->version != SHARD_VERSION || (header->dtype != SHARD_DTYPE_U8 && header->dtype != SHARD_DTYPE_FP32)) {
+        fprintf(stderr, "%s: unsupported shard version %u / dtype %u\n", path, header->version, header->dtype);
+        return false;
+    }
+    if (header->filters != INPUT_FILTERS_1 || header->rows != INPUT_ROWS_1 || header->cols != INPUT_COLS_1 ||
+        header->record_bytes != recordBytes(header->dtype)) {
+        fprintf(stderr, "%s: images are %ux%ux%u, this build needs %dx%dx%d, regenerate it with pack_dataset\n", path,
+                header->filters, header->rows, header->cols, INPUT_FILTERS_1, INPUT_ROWS_1, INPUT_COLS_1);
+        return false;
+    }
+
+    uint64_t index_end = sizeof(ShardHeader) + (uint64_t)header->capacity * sizeof(ShardEntry);
+    uint64_t data_size = (uint64_t)header->capacity * header->record_bytes;
+    if (header->count > header->capacity || header->data_offset % SHARD_PAGE_SIZE != 0 || header->data_offset < index_end ||
+        header->file_size != size || header->data_offset + data_size != size) {
+        fprintf(stderr, "%s: shard is truncated or its layout is inconsistent\n", path);
+        return false;
+    }
+
+    if (verify_checksum && modelChecksum(base + sizeof(ShardHeader), size - sizeof(ShardHeader)) != header->checksum) {
+        fprintf(stderr, "%s: checksum mismatch\n", path);
+        return false;
+    }
+
+    // The index is trusted from here on, so every record and name must lie inside its section
+    const ShardEntry* entries = (const ShardEntry*)(base + sizeof(ShardHeader));
+    const char* names = base + index_end;
+    size_t names_size = header->data_offset - index_end;
+    for (uint32_t i = 0; i < header->count; i++) {
+        const ShardEntry& entry = entries[i];
+        if (entry.offset % header->record_bytes != 0 || entry.offset >= data_size || entry.label < -1 ||
+            entry.label >= TOTAL_CLASSES || entry.name_offset >= names_size ||
+            memchr(names + entry.name_offset, 0, names_size - entry.name_offset) == NULL) {
+            fprintf(stderr, "%s: index entry %u is out of bounds\n", path, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool mapShard(const char* path, MappedShard& shard, bool verify_checksum) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ShardHeader)) {
+        fprintf(stderr, "%s is not a dataset shard\n", path);
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s\n", path);
+        return false;
+    }
+
+    // Evaluation walks the records front to back, let the kernel read ahead aggressively
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    if (!validateShard(path, (const char*)base, size, verify_checksum)) {
+        munmap(base, size);
+        return false;
+    }
+
+    const ShardHeader* header = (const ShardHeader*)base;
+    shard.base = base;
+    shard.size = size;
+    shard.header = header;
+    shard.entries = (const ShardEntry*)((const char*)base + sizeof(ShardHeader));
+    shard.names = (const char*)(shard.entries + header->capacity);
+    shard.data = (const uint8_t*)base + header->data_offset;
+    return true;
+}
+
+void unmapShard(MappedShard& shard) {
+    if (shard.base != NULL) {
+        munmap(shard.base, shard.size);
+    }
+    memset(&shard, 0, sizeof(shard));
+}
+
+const char* shardName(const MappedShard& shard, uint32_t i) {
+    return shard.names + shard.entries[i].name_offset;
+}
+
+void shardImage(const MappedShard& shard, uint32_t i, ImageData& imageData, int padding) {
+    const uint8_t* record = shard.data + shard.entries[i].offset;
+
+    if (shard.header->dtype == SHARD_DTYPE_U8) {
+        for (int f = 0; f < INPUT_FILTERS_1; f++) {
+            for (int r = 0; r < INPUT_ROWS_1; r++) {
+                const uint8_t* pixels = record + (f * INPUT_ROWS_1 + r) * INPUT_COLS_1;
+                for (int c = 0; c < INPUT_COLS_1; c++) {
+                    imageData.image[f][padding + r][padding + c] = (static_cast<float>(pixels[c]) - MEAN) / STD;
+                }
+            }
+        }
+        padImage(imageData, padding);
+    } else {
+        tensorImage((const float*)record, imageData, padding);
+    }
+}
+
+// A worker counts in locals and stores its tally once it is done, so neighbouring tallies never share a cache
+// line while the workers run. The totals are only summed after join.
+typedef struct ShardTally {
+    int test_set_size;
+    int correct_cases;
+    int unlabelled_cases;
+} ShardTally;
+
+static void shardWorker(const MappedShard* shard, std::atomic<uint32_t>* next, const Params* param, int padding, int batch_size,
+                        ShardTally* tally) {
+    ImageBatch batch;
+    allocateBatch(batch, batch_size);
+    int* predictions = new int[batch_size];
+    uint32_t count = shard->header->count;
+    int test_set_size = 0;
+    int correct_cases = 0;
+    int unlabelled_cases = 0;
+
+    for (;;) {
+        uint32_t start = next->fetch_add(batch_size);
+        if (start >= count) {
+            break;
+        }
+        uint32_t end = (start + batch_size < count) ? start + batch_size : count;
+
+        batch.size = 0;
+        for (uint32_t i = start; i < end; i++) {
+            shardImage(*shard, i, batch.images[batch.size], padding);
+            batch.labels[batch.size++] = shard->entries[i].label;
+        }
+
+        forwardBatch(batch, *param, predictions);
+        for (int b = 0; b < batch.size; b++) {
+            if (predictions[b] == batch.labels[b]) {
+                correct_cases++;
+            } else if (batch.labels[b] < 0) {
+                unlabelled_cases++;
+            }
+        }
+        test_set_size += batch.size;
+    }
+    tally->test_set_size = test_set_size;
+    tally->correct_cases = correct_cases;
+    tally->unlabelled_cases = unlabelled_cases;
+
+    delete[] predictions;
+    freeBatch(batch);
+}
+
+bool loadDatasetShard(const char* shardPath, int& test_set_size, int padding, const Params& param, int& correct_cases,
+                      int& unlabelled_cases, int num_threads, int batch_size) {
+    MappedShard shard;
+    if (!mapShard(shardPath, shard, true)) {
+        return false;
+    }
+
+    num_threads = hardwareThreads(num_threads);
+    std::atomic<uint32_t> next(0);
+    std::vector<ShardTally> tallies(num_threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) {
+        tallies[t].test_set_size = 0;
+        tallies[t].correct_cases = 0;
+        tallies[t].unlabelled_cases = 0;
+        workers.push_back(std::thread(shardWorker, &shard, &next, &param, padding, batch_size, &tallies[t]));
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].join();
+        test_set_size += tallies[t].test_set_size;
+        correct_cases += tallies[t].correct_cases;
+        unlabelled_cases += tallies[t].unlabelled_cases;
+    }
+
+    unmapShard(shard);
+    return true;
+}
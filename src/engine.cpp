@@ -0,0 +1,159 @@
+#include "../include/engine.h"
+#include "../include/autotune.h"
+#include "../include/winograd.h"
+
+Engine* loadEngine(const char* modelPath, int conv_algorithm, const TuningPlan* tuning) {
+    Engine* engine = new Engine();
+    Params* params;
+
+    // Shared and binary models are mapped in place, text files are parsed and packed
+    if (strncmp(modelPath, SHARED_MODEL_PREFIX, strlen(SHARED_MODEL_PREFIX)) == 0) {
+        if (!attachSharedModel(modelPath + strlen(SHARED_MODEL_PREFIX), engine->shared, true)) {
+            delete engine;
+            return NULL;
+        }
+        params = engine->shared.model.params;
+    } else if (isBinaryModel(modelPath)) {
+        if (!mapModel(modelPath, engine->model, true)) {
+            delete engine;
+            return NULL;
+        }
+        params = engine->model.params;
+    } else {
+        engine->owned = allocateParams();
+        if (!loadParams(modelPath, *engine->owned)) {
+            freeParams(engine->owned);
+            delete engine;
+            return NULL;
+        }
+        params = engine->owned;
+    }
+
+    if (conv_algorithm >= 0) {
+        params->conv_algorithm = conv_algorithm;
+    }
+    if (tuning != NULL) {
+        params->tuning = *tuning;
+    }
+
+    // The Winograd transforms trade exactness for speed, don't use them on weights they handle badly. A tuned
+    // engine always measures the error, autotune needs it to know whether Winograd is a candidate
+    bool tuned = params->conv_algorithm == CONV_TUNED;
+    if (params->conv_algorithm == CONV_FUSED_WINOGRAD || tuned) {
+        engine->winograd_error = winogradError(*params);
+        StageTuning& last = params->tuning.stages[TUNING_STAGES - 1];
+        bool winograd = !tuned || last.algorithm == CONV_FUSED_WINOGRAD;
+        if (winograd && engine->winograd_error > WINOGRAD_TOLERANCE) {
+            fprintf(stderr, "Winograd error %g above %g, falling back to the fused GEMM\n", engine->winograd_error,
+                    WINOGRAD_TOLERANCE);
+            if (tuned) {
+                last.algorithm = CONV_FUSED_GEMM;
+                last.block = GEMM_POOL_NC;
+            } else {
+                params->conv_algorithm = CONV_FUSED_GEMM;
+            }
+        }
+    }
+
+    engine->params = params;
+    return engine;
+}
+
+void freeEngine(Engine* engine) {
+    if (engine == NULL) {
+        return;
+    }
+    unmapModel(engine->model);
+    detachSharedModel(engine->shared);
+    freeParams(engine->owned);
+    delete engine;
+}
+
+bool engineOutdated(const Engine& engine) {
+    return sharedModelChanged(engine.shared);
+}
+
+Engine* reloadEngine(const Engine& engine) {
+    if (engine.shared.control == NULL) {
+        return NULL;
+    }
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s%s", SHARED_MODEL_PREFIX, engine.shared.name);
+    return loadEngine(path, engine.params->conv_algorithm, &engine.params->tuning);
+}
+
+Session* createSession(const Engine& engine, int max_batch) {
+    Session* session = new Session();
+    session->engine = &engine;
+    allocateBatch(session->batch, (max_batch > 0) ? max_batch : 1);
+    session->predictions = new int[session->batch.capacity];
+    session->decoder = createJpegDecoder();
+    return session;
+}
+
+void freeSession(Session* session) {
+    if (session == NULL) {
+        return;
+    }
+    freeJpegDecoder(session->decoder);
+    delete[] session->predictions;
+    freeBatch(session->batch);
+    delete session;
+}
+
+static void storeResult(const ImageData& imageData, int prediction, Classification& result) {
+    result.prediction = prediction;
+    memcpy(result.scores, imageData.layer_9, sizeof(result.scores));
+}
+
+bool classifyImage(Session& session, const unsigned char* data, size_t size, Classification& result) {
+    ImageData& imageData = session.batch.images[0];
+    if (!decodeImageBuffer(*session.decoder, data, size, INPUT_ROWS_1, INPUT_COLS_1, session.image)) {
+        result.prediction = -1;
+        return false;
+    }
+    preprocessMat(session.image, imageData, PADDING_1);
+
+    int prediction = forwardPass(imageData, *session.batch.workspace, *session.engine->params);
+    storeResult(imageData, prediction, result);
+    return true;
+}
+
+void classifyTensor(Session& session, const float* tensor, Classification& result) {
+    ImageData& imageData = session.batch.images[0];
+    tensorImage(tensor, imageData, PADDING_1);
+
+    int prediction = forwardPass(imageData, *session.batch.workspace, *session.engine->params);
+    storeResult(imageData, prediction, result);
+}
+
+int classifyImages(Session& session, const unsigned char* const* data, const size_t* sizes, int count, Classification* results) {
+    ImageBatch& batch = session.batch;
+    int decoded = 0;
+
+    for (int start = 0; start < count; start += batch.capacity) {
+        int end = (start + batch.capacity < count) ? start + batch.capacity : count;
+
+        // labels remembers which result each batch slot belongs to
+        batch.size = 0;
+        for (int i = start; i < end; i++) {
+            if (!decodeImageBuffer(*session.decoder, data[i], sizes[i], INPUT_ROWS_1, INPUT_COLS_1, session.image)) {
+                results[i].prediction = -1;
+                memset(results[i].scores, 0, sizeof(results[i].scores));
+                continue;
+            }
+            preprocessMat(session.image, batch.images[batch.size], PADDING_1);
+            batch.labels[batch.size++] = i;
+        }
+        if (batch.size == 0) {
+            continue;
+        }
+
+        forwardBatch(batch, *session.engine->params, session.predictions);
+        for (int b = 0; b < batch.size; b++) {
+            storeResult(batch.images[b], session.predictions[b], results[batch.labels[b]]);
+        }
+        decoded += batch.size;
+    }
+    return decoded;
+}
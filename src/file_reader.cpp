@@ -0,0 +1,580 @@
+#include "../include/file_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// liburing isn't required, the ring is driven through the raw system calls
+#if defined(CNN_HAVE_IO_URING) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define USE_IO_URING
+#endif
+
+// The read going on in one buffer
+typedef struct ReadSlot {
+    std::string path;
+    void* user;
+    int fd;
+    bool pending;     // submitted and not completed yet
+    bool opening;     // io_uring: the OPENAT is in flight, the READ comes after it
+    struct iovec iov; // the buffer, for IORING_OP_READV when it couldn't be registered
+    std::vector<unsigned char> overflow;
+} ReadSlot;
+
+#ifdef USE_IO_URING
+typedef struct Ring {
+    int fd;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    void* cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned to_submit; // SQEs written since the last io_uring_enter
+    bool fixed_buffers; // the buffers are registered, reads use IORING_OP_READ_FIXED
+    bool async_open;    // IORING_OP_OPENAT is supported (5.6+), opens block otherwise
+    bool broken;        // io_uring_enter failed, every read fails from then on
+} Ring;
+#endif
+
+struct FileReader {
+    int backend;
+    int depth;
+    int in_flight;
+    size_t buffer_bytes;
+    unsigned char* memory; // every buffer, one page aligned allocation
+    std::vector<ReadSlot> slots;
+    std::deque<FileRead> ready; // completions that never reached the kernel or the threads
+
+    std::mutex free_mutex;
+    std::vector<int> free_buffers;
+
+#ifdef USE_IO_URING
+    Ring ring;
+#endif
+
+    // FILE_READER_THREADS
+    std::mutex mutex;
+    std::condition_variable submitted;
+    std::condition_variable completed;
+    std::deque<int> requests;
+    std::deque<FileRead> completions;
+    bool stopping;
+    std::vector<std::thread> threads;
+};
+
+static unsigned char* bufferOf(const FileReader& reader, int buffer) {
+    return reader.memory + (size_t)buffer * reader.buffer_bytes;
+}
+
+// Completes a read that got the first got bytes of the file into its buffer. Reads of regular files only come
+// back short at the end of the file, so only a full buffer can leave something behind, which is read with
+// blocking preads into the slot's overflow. Returns 0 or an errno.
+static int finishRead(FileReader& reader, ReadSlot& slot, int buffer, size_t got, FileRead& read) {
+    read.data = bufferOf(reader, buffer);
+    read.size = got;
+    if (got < reader.buffer_bytes) {
+        return 0;
+    }
+
+    struct stat info;
+    if (fstat(slot.fd, &info) != 0) {
+        return errno;
+    }
+    size_t size = (size_t)info.st_size;
+    if (size <= got) {
+        return 0;
+    }
+
+    slot.overflow.resize(size);
+    memcpy(slot.overflow.data(), read.data, got);
+    while (got < size) {
+        ssize_t n = pread(slot.fd, slot.overflow.data() + got, size - got, got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    read.data = slot.overflow.data();
+    read.size = got;
+    return 0;
+}
+
+//-----IO_URING-----//
+
+#ifdef USE_IO_URING
+static int ringEnter(Ring& ring, unsigned min_complete) {
+    unsigned flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        int submitted = (int)syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, min_complete, flags, NULL, 0);
+        if (submitted >= 0) {
+            ring.to_submit -= submitted;
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        // The kernel is short of memory for requests or completions, the SQEs stay queued for the next call
+        if (errno == EAGAIN || errno == EBUSY) {
+            return 0;
+        }
+        return errno;
+    }
+}
+
+// Only this thread writes the SQ tail, the release store publishes the SQE to the kernel
+static void pushSqe(Ring& ring, const struct io_uring_sqe& sqe) {
+    unsigned tail = *ring.sq_tail;
+    unsigned index = tail & ring.sq_mask;
+    ring.sqes[index] = sqe;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.to_submit++;
+}
+
+static void queueRead(FileReader& reader, int buffer) {
+    Ring& ring = reader.ring;
+    ReadSlot& slot = reader.slots[buffer];
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.fd = slot.fd;
+    sqe.off = 0;
+    sqe.user_data = buffer;
+    if (ring.fixed_buffers) {
+        sqe.opcode = IORING_OP_READ_FIXED;
+        sqe.addr = (unsigned long)bufferOf(reader, buffer);
+        sqe.len = reader.buffer_bytes;
+        sqe.buf_index = buffer;
+    } else {
+        sqe.opcode = IORING_OP_READV;
+        sqe.addr = (unsigned long)&slot.iov;
+        sqe.len = 1;
+    }
+    pushSqe(ring, sqe);
+}
+
+// Turns every pending read into an error completion, the ring is unusable once io_uring_enter fails for good
+static void failRing(FileReader& reader, int error) {
+    fprintf(stderr, "io_uring_enter failed: %s\n", strerror(error));
+    reader.ring.broken = true;
+    for (size_t b = 0; b < reader.slots.size(); b++) {
+        ReadSlot& slot = reader.slots[b];
+        if (!slot.pending) {
+            continue;
+        }
+        FileRead read = {NULL, 0, error, (int)b, slot.user};
+        reader.ready.push_back(read);
+        slot.pending = false;
+        slot.opening = false;
+        if (slot.fd >= 0) {
+            close(slot.fd);
+            slot.fd = -1;
+        }
+    }
+}
+
+static void queueOpen(FileReader& reader, int buffer) {
+    ReadSlot& slot = reader.slots[buffer];
+    if (reader.ring.broken) {
+        FileRead read = {NULL, 0, EIO, buffer, slot.user};
+        reader.ready.push_back(read);
+        slot.pending = false;
+        return;
+    }
+    if (!reader.ring.async_open) {
+        slot.fd = open(slot.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (slot.fd < 0) {
+            FileRead read = {NULL, 0, errno, buffer, slot.user};
+            reader.ready.push_back(read);
+            slot.pending = false;
+            return;
+        }
+        queueRead(reader, buffer);
+        return;
+    }
+
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_OPENAT;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = (unsigned long)slot.path.c_str();
+    sqe.open_flags = O_RDONLY | O_CLOEXEC;
+    sqe.user_data = buffer;
+    slot.opening = true;
+    pushSqe(reader.ring, sqe);
+}
+
+static bool opSupported(int fd, int op) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, size);
+    bool supported = false;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        supported = op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+static void closeRing(Ring& ring) {
+    if (ring.sqes != NULL && ring.sqes != MAP_FAILED) {
+        munmap(ring.sqes, ring.sqes_size);
+    }
+    if (ring.cq_map != NULL && ring.cq_map != MAP_FAILED && ring.cq_map != ring.sq_map) {
+        munmap(ring.cq_map, ring.cq_map_size);
+    }
+    if (ring.sq_map != NULL && ring.sq_map != MAP_FAILED) {
+        munmap(ring.sq_map, ring.sq_map_size);
+    }
+    if (ring.fd >= 0) {
+        close(ring.fd);
+    }
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+static bool setupRing(FileReader& reader) {
+    Ring& ring = reader.ring;
+    memset(&ring, 0, sizeof(ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring.fd = (int)syscall(__NR_io_uring_setup, reader.depth, &params);
+    if (ring.fd < 0) {
+        return false;
+    }
+
+    ring.sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        ring.sq_map_size = (ring.cq_map_size > ring.sq_map_size) ? ring.cq_map_size : ring.sq_map_size;
+    }
+    ring.sq_map = mmap(NULL, ring.sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    ring.cq_map = single_mmap ? ring.sq_map
+                              : mmap(NULL, ring.cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                                     IORING_OFF_CQ_RING);
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = (struct io_uring_sqe*)mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                                           IORING_OFF_SQES);
+    if (ring.sq_map == MAP_FAILED || ring.cq_map == MAP_FAILED || ring.sqes == MAP_FAILED) {
+        closeRing(ring);
+        return false;
+    }
+
+    char* sq = (char*)ring.sq_map;
+    char* cq = (char*)ring.cq_map;
+    ring.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring.sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring.sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring.cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring.cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Registering pins the buffers once instead of on every read, it fails under a low RLIMIT_MEMLOCK on older kernels
+    std::vector<struct iovec> iovs(reader.slots.size());
+    for (size_t b = 0; b < iovs.size(); b++) {
+        iovs[b] = reader.slots[b].iov;
+    }
+    ring.fixed_buffers =
+        syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iovs.data(), (unsigned)iovs.size()) == 0;
+    ring.async_open = opSupported(ring.fd, IORING_OP_OPENAT);
+    return true;
+}
+
+static bool waitRing(FileReader& reader, FileRead& read) {
+    Ring& ring = reader.ring;
+    int error = (ring.to_submit > 0) ? ringEnter(ring, 0) : 0;
+    if (error != 0) {
+        failRing(reader, error);
+    }
+
+    for (;;) {
+        if (!reader.ready.empty()) {
+            read = reader.ready.front();
+            reader.ready.pop_front();
+            return true;
+        }
+
+        unsigned head = *ring.cq_head;
+        if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            error = ringEnter(ring, 1);
+            if (error != 0) {
+                failRing(reader, error);
+            }
+            continue;
+        }
+        struct io_uring_cqe cqe = ring.cqes[head & ring.cq_mask];
+        __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+        int buffer = (int)cqe.user_data;
+        ReadSlot& slot = reader.slots[buffer];
+        if (!slot.pending) {
+            continue; // failed by failRing already
+        }
+        FileRead done = {NULL, 0, 0, buffer, slot.user};
+        if (slot.opening) {
+            slot.opening = false;
+            if (cqe.res < 0) {
+                done.error = -cqe.res;
+                slot.pending = false;
+                reader.ready.push_back(done);
+            } else {
+                // Submitted right away, the read shouldn't wait for the next completion to be reaped
+                slot.fd = cqe.res;
+                queueRead(reader, buffer);
+                error = ringEnter(ring, 0);
+                if (error != 0) {
+                    failRing(reader, error);
+                }
+            }
+            continue;
+        }
+
+        done.error = (cqe.res < 0) ? -cqe.res : finishRead(reader, slot, buffer, cqe.res, done);
+        close(slot.fd);
+        slot.fd = -1;
+        slot.pending = false;
+        read = done;
+        return true;
+    }
+}
+#endif
+
+//-----THREADS-----//
+
+static void readWorker(FileReader* reader) {
+    std::unique_lock<std::mutex> lock(reader->mutex);
+    for (;;) {
+        while (reader->requests.empty() && !reader->stopping) {
+            reader->submitted.wait(lock);
+        }
+        if (reader->requests.empty()) {
+            break;
+        }
+        int buffer = reader->requests.front();
+        reader->requests.pop_front();
+        lock.unlock();
+
+        ReadSlot& slot = reader->slots[buffer];
+        FileRead read = {NULL, 0, 0, buffer, slot.user};
+        slot.fd = open(slot.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (slot.fd < 0) {
+            read.error = errno;
+        } else {
+            unsigned char* data = bufferOf(*reader, buffer);
+            size_t got = 0;
+            while (got < reader->buffer_bytes) {
+                ssize_t n = ::read(slot.fd, data + got, reader->buffer_bytes - got);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    read.error = (n < 0) ? errno : 0;
+                    break;
+                }
+                got += n;
+            }
+            if (read.error == 0) {
+                read.error = finishRead(*reader, slot, buffer, got, read);
+            }
+            close(slot.fd);
+            slot.fd = -1;
+        }
+
+        lock.lock();
+        reader->completions.push_back(read);
+        reader->completed.notify_one();
+    }
+}
+
+static bool waitThreads(FileReader& reader, FileRead& read) {
+    if (!reader.ready.empty()) {
+        read = reader.ready.front();
+        reader.ready.pop_front();
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(reader.mutex);
+    while (reader.completions.empty()) {
+        reader.completed.wait(lock);
+    }
+    read = reader.completions.front();
+    reader.completions.pop_front();
+    return true;
+}
+
+//-----READER-----//
+
+FileReader* createFileReader(int depth, int buffers, size_t buffer_bytes, int backend) {
+    FileReader* reader = new FileReader();
+    reader->depth = (depth > 0) ? depth : FILE_READER_DEPTH;
+    buffers = (buffers > reader->depth) ? buffers : reader->depth;
+    reader->in_flight = 0;
+    reader->buffer_bytes = (buffer_bytes > 0) ? buffer_bytes : FILE_READER_BUFFER_BYTES;
+    reader->stopping = false;
+
+    if (posix_memalign((void**)&reader->memory, 4096, buffers * reader->buffer_bytes) != 0) {
+        delete reader;
+        return NULL;
+    }
+    reader->slots.resize(buffers);
+    for (int b = 0; b < buffers; b++) {
+        ReadSlot& slot = reader->slots[b];
+        slot.user = NULL;
+        slot.fd = -1;
+        slot.pending = false;
+        slot.opening = false;
+        slot.iov.iov_base = bufferOf(*reader, b);
+        slot.iov.iov_len = reader->buffer_bytes;
+        reader->free_buffers.push_back(buffers - 1 - b);
+    }
+
+    reader->backend = FILE_READER_THREADS;
+#ifdef USE_IO_URING
+    reader->ring.fd = -1;
+    if (backend != FILE_READER_THREADS && setupRing(*reader)) {
+        reader->backend = FILE_READER_URING;
+    }
+#endif
+    if (backend == FILE_READER_URING && reader->backend != FILE_READER_URING) {
+        free(reader->memory);
+        delete reader;
+        return NULL;
+    }
+
+    if (reader->backend == FILE_READER_THREADS) {
+        for (int t = 0; t < reader->depth; t++) {
+            reader->threads.push_back(std::thread(readWorker, reader));
+        }
+    }
+    return reader;
+}
+
+void freeFileReader(FileReader* reader) {
+    if (reader == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(reader->mutex);
+        reader->stopping = true;
+        reader->submitted.notify_all();
+    }
+    for (size_t t = 0; t < reader->threads.size(); t++) {
+        reader->threads[t].join();
+    }
+#ifdef USE_IO_URING
+    if (reader->backend == FILE_READER_URING) {
+        closeRing(reader->ring);
+    }
+#endif
+
+    free(reader->memory);
+    delete reader;
+}
+
+int fileReaderBackend(const FileReader& reader) {
+    return reader.backend;
+}
+
+const char* fileReaderBackendName(int backend) {
+    switch (backend) {
+    case FILE_READER_URING:
+        return "io_uring";
+    case FILE_READER_THREADS:
+        return "threads";
+    default:
+        return "auto";
+    }
+}
+
+bool submitFileRead(FileReader& reader, const char* path, void* user) {
+    if (reader.in_flight >= reader.depth) {
+        return false;
+    }
+
+    int buffer;
+    {
+        std::lock_guard<std::mutex> lock(reader.free_mutex);
+        if (reader.free_buffers.empty()) {
+            return false;
+        }
+        buffer = reader.free_buffers.back();
+        reader.free_buffers.pop_back();
+    }
+
+    ReadSlot& slot = reader.slots[buffer];
+    slot.path = path;
+    slot.user = user;
+    slot.pending = true;
+    reader.in_flight++;
+
+#ifdef USE_IO_URING
+    if (reader.backend == FILE_READER_URING) {
+        queueOpen(reader, buffer);
+        return true;
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(reader.mutex);
+    reader.requests.push_back(buffer);
+    reader.submitted.notify_one();
+    return true;
+}
+
+bool waitFileRead(FileReader& reader, FileRead& read) {
+    if (reader.in_flight == 0) {
+        return false;
+    }
+
+    bool done;
+#ifdef USE_IO_URING
+    if (reader.backend == FILE_READER_URING) {
+        done = waitRing(reader, read);
+    } else
+#endif
+    {
+        done = waitThreads(reader, read);
+    }
+
+    if (done) {
+        reader.slots[read.buffer].pending = false;
+        reader.in_flight--;
+    }
+    return done;
+}
+
+void releaseFileRead(FileReader& reader, int buffer) {
+    // A file that didn't fit its buffer gives its overflow back too
+    std::vector<unsigned char>().swap(reader.slots[buffer].overflow);
+
+    std::lock_guard<std::mutex> lock(reader.free_mutex);
+    reader.free_buffers.push_back(buffer);
+}
@@ -0,0 +1,16 @@
+#include "../include/gemm.h"
+
+void packConvWeights(const float* weights, float* packed, int out_filters, int in_filters, int kernel_size) {
+    int K = in_filters * kernel_size * kernel_size;
+    int panels = ROUND_UP(out_filters, GEMM_MR) / GEMM_MR;
+
+    for (int p = 0; p < panels; p++) {
+        float* dst = packed + p * K * GEMM_MR;
+        for (int k = 0; k < K; k++) {
+            for (int i = 0; i < GEMM_MR; i++) {
+                int out_f = p * GEMM_MR + i;
+                dst[k * GEMM_MR + i] = (out_f < out_filters) ? weights[out_f * K + k] : 0;
+            }
+        }
+    }
+}
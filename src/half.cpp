@@ -0,0 +1,219 @@
+#include "../include/half.h"
+#include "../include/profile.h"
+#include "../include/simd.h"
+
+#include <math.h>
+
+static_assert(INPUT_FILTERS_5 * KERNEL_SIZE_5 * KERNEL_SIZE_5 <= COL_BUFFER_SIZE, "col_buffer too small for a receptive field");
+
+// Round to nearest even. Above 65504 rounds to Inf, below 2^-14 to the subnormals, 2^-24 apart
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000) {
+        return sign | 0x7e00;
+    }
+    if (magnitude >= 0x477ff000) {
+        return sign | 0x7c00;
+    }
+    if (magnitude < 0x38800000) {
+        return sign | (uint16_t)lrintf(fabsf(value) * 16777216.0f);
+    }
+    uint32_t rounded = magnitude + 0xfff + ((magnitude >> 13) & 1);
+    return sign | (uint16_t)((rounded - (112u << 23)) >> 13);
+}
+
+// Round to nearest even on the upper half of the fp32
+static uint16_t floatToBf16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return (uint16_t)((bits >> 16) | 0x40);
+    }
+    return (uint16_t)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+}
+
+// Only for the rounding error, the kernels widen in registers
+static float widen(uint16_t h, int format) {
+    if (format == HALF_BF16) {
+        uint32_t bits = (uint32_t)h << 16;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    int exponent = (h >> 10) & 0x1f;
+    int mantissa = h & 0x3ff;
+    float value = (exponent == 0)    ? ldexpf((float)mantissa, -24)
+                  : (exponent == 31) ? (mantissa ? NAN : INFINITY)
+                                     : ldexpf((float)(mantissa | 0x400), exponent - 25);
+    return (h & 0x8000) ? -value : value;
+}
+
+static float convert(const float* values, uint16_t* out, int n, int format) {
+    float max_error = 0;
+    for (int i = 0; i < n; i++) {
+        out[i] = (format == HALF_BF16) ? floatToBf16(values[i]) : floatToHalf(values[i]);
+        float error = fabsf(values[i] - widen(out[i], format));
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+    return max_error;
+}
+
+const char* halfFormatName(int format) {
+    return (format == HALF_BF16) ? "bf16" : "fp16";
+}
+
+float convertWeights(const Params& param, HalfParams& hparams, int format) {
+    const float* weights[6] = {&param.weights1[0][0][0][0], &param.weights2[0][0][0][0], &param.weights3[0][0][0][0],
+                               &param.weights4[0][0], &param.weights5[0][0], &param.weights6[0][0]};
+    uint16_t* out[6] = {&hparams.weights1[0][0], &hparams.weights2[0][0], &hparams.weights3[0][0],
+                        &hparams.weights4[0][0], &hparams.weights5[0][0], &hparams.weights6[0][0]};
+    const int sizes[6] = {(int)(sizeof(hparams.weights1) / sizeof(uint16_t)), (int)(sizeof(hparams.weights2) / sizeof(uint16_t)),
+                          (int)(sizeof(hparams.weights3) / sizeof(uint16_t)), (int)(sizeof(hparams.weights4) / sizeof(uint16_t)),
+                          (int)(sizeof(hparams.weights5) / sizeof(uint16_t)), (int)(sizeof(hparams.weights6) / sizeof(uint16_t))};
+    float max_error = 0;
+    for (int l = 0; l < 6; l++) {
+        float error = convert(weights[l], out[l], sizes[l], format);
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+
+    memcpy(hparams.biases1, param.biases1, sizeof(hparams.biases1));
+    memcpy(hparams.biases2, param.biases2, sizeof(hparams.biases2));
+    memcpy(hparams.biases3, param.biases3, sizeof(hparams.biases3));
+    memcpy(hparams.biases4, param.biases4, sizeof(hparams.biases4));
+    memcpy(hparams.biases5, param.biases5, sizeof(hparams.biases5));
+    memcpy(hparams.biases6, param.biases6, sizeof(hparams.biases6));
+    hparams.format = format;
+    return max_error;
+}
+
+typedef float (*DotHalf)(const uint16_t* a, const float* b, int n);
+
+static void convHalf(const float* input, int in_filters, int in_height, int in_width, const uint16_t* weights, DotHalf dot,
+                     const float* biases, int out_filters, int kernel_size, int stride, float* output, int out_height,
+                     int out_width, int out_pitch_rows, int out_pitch_cols, float* column) {
+    int K = in_filters * kernel_size * kernel_size;
+
+    for (int row = 0; row < out_height; row++) {
+        for (int col = 0; col < out_width; col++) {
+
+            // Gather the receptive field once, every filter then reads it from L1
+            int k = 0;
+            for (int in_f = 0; in_f < in_filters; in_f++) {
+                for (int i = 0; i < kernel_size; i++) {
+                    const float* src = input + (in_f * in_height + stride * row + i) * in_width + stride * col;
+                    for (int j = 0; j < kernel_size; j++) {
+                        column[k++] = src[j];
+                    }
+                }
+            }
+
+            for (int out_f = 0; out_f < out_filters; out_f++) {
+                float val = dot(weights + out_f * K, column, K) + biases[out_f];
+                output[(out_f * out_pitch_rows + row) * out_pitch_cols + col] = relu(val);
+            }
+        }
+    }
+}
+
+static void fcHalf(const float* input, const uint16_t* weights, DotHalf dot, const float* biases, float* output, int rows,
+                   int cols, bool apply_relu) {
+    for (int n = 0; n < rows; n++) {
+        float val = dot(weights + n * cols, input, cols) + biases[n];
+        output[n] = apply_relu ? relu(val) : val;
+    }
+}
+
+int forwardPassHalf(ImageData& inputData, Workspace& workspace, const HalfParams& hparams) {
+    PROFILE_SCOPE(PROFILE_FORWARD_HALF);
+    const KernelTable& kernels = activeKernels();
+    DotHalf dot = (hparams.format == HALF_BF16) ? kernels.dot_bf16 : kernels.dot_f16;
+    float* column = workspace.col_buffer;
+
+    convHalf(&inputData.image[0][0][0], INPUT_FILTERS_1, INPUT_ROWS_1 + 2 * PADDING_1, INPUT_COLS_1 + 2 * PADDING_1,
+             &hparams.weights1[0][0], dot, hparams.biases1, NUM_FILTERS_1, KERNEL_SIZE_1, STRIDE_1,
+             &workspace.layer_1[0][0][0], INPUT_ROWS_2, INPUT_COLS_2, INPUT_ROWS_2 + 2 * PADDING_2,
+             INPUT_COLS_2 + 2 * PADDING_2, column);
+    inputData.height = INPUT_ROWS_2 + 2 * PADDING_2;
+    inputData.width = INPUT_COLS_2 + 2 * PADDING_2;
+    inputData.filters = NUM_FILTERS_1;
+    layer_2_max_pool(inputData, workspace);
+
+    convHalf(&workspace.layer_2[0][0][0], INPUT_FILTERS_3, INPUT_ROWS_3 + 2 * PADDING_3, INPUT_COLS_3 + 2 * PADDING_3,
+             &hparams.weights2[0][0], dot, hparams.biases2, NUM_FILTERS_3, KERNEL_SIZE_3, STRIDE_3,
+             &workspace.layer_3[0][0][0], INPUT_ROWS_4, INPUT_COLS_4, INPUT_ROWS_4 + 2 * PADDING_4,
+             INPUT_COLS_4 + 2 * PADDING_4, column);
+    inputData.height = INPUT_ROWS_4 + 2 * PADDING_4;
+    inputData.width = INPUT_COLS_4 + 2 * PADDING_4;
+    inputData.filters = NUM_FILTERS_3;
+    layer_4_max_pool(inputData, workspace);
+
+    convHalf(&workspace.layer_4[0][0][0], INPUT_FILTERS_5, INPUT_ROWS_5 + 2 * PADDING_5, INPUT_COLS_5 + 2 * PADDING_5,
+             &hparams.weights3[0][0], dot, hparams.biases3, NUM_FILTERS_5, KERNEL_SIZE_5, STRIDE_5,
+             &workspace.layer_5[0][0][0], INPUT_ROWS_6, INPUT_COLS_6, INPUT_ROWS_6 + 2 * PADDING_6,
+             INPUT_COLS_6 + 2 * PADDING_6, column);
+    inputData.height = INPUT_ROWS_6 + 2 * PADDING_6;
+    inputData.width = INPUT_COLS_6 + 2 * PADDING_6;
+    inputData.filters = NUM_FILTERS_5;
+    layer_6_max_pool_flatten(inputData, workspace);
+
+    fcHalf(inputData.layer_6, &hparams.weights4[0][0], dot, hparams.biases4, inputData.layer_7, WEIGHT_ROWS_7, WEIGHT_COLS_7,
+           Layer7Fc::relu);
+    fcHalf(inputData.layer_7, &hparams.weights5[0][0], dot, hparams.biases5, inputData.layer_8, WEIGHT_ROWS_8, WEIGHT_COLS_8,
+           Layer8Fc::relu);
+    fcHalf(inputData.layer_8, &hparams.weights6[0][0], dot, hparams.biases6, inputData.layer_9, WEIGHT_ROWS_9, WEIGHT_COLS_9,
+           Layer9Fc::relu);
+
+    return predictedClass(inputData.layer_9);
+}
+
+void evaluateHalf(const char* folderPath, const Params& param, const HalfParams& hparams, int padding, HalfReport& report) {
+    std::vector<DatasetEntry> entries;
+    listDataset(folderPath, entries);
+
+    ImageData* imageData = new ImageData();
+    Workspace* workspace = allocateWorkspace();
+    cv::Mat image;
+    float logits[TOTAL_CLASSES];
+    memset(&report, 0, sizeof(report));
+    report.fp32_bytes = sizeof(param.weights1) + sizeof(param.weights2) + sizeof(param.weights3) + sizeof(param.weights4) +
+                        sizeof(param.weights5) + sizeof(param.weights6);
+    report.half_bytes = sizeof(hparams.weights1) + sizeof(hparams.weights2) + sizeof(hparams.weights3) +
+                        sizeof(hparams.weights4) + sizeof(hparams.weights5) + sizeof(hparams.weights6);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!preprocessImage(entries[i].path.c_str(), *imageData, image, padding)) {
+            fprintf(stderr, "Error: Could not read the image %s\n", entries[i].path.c_str());
+            continue;
+        }
+        int fp32 = forwardPass(*imageData, *workspace, param);
+        memcpy(logits, imageData->layer_9, sizeof(logits));
+
+        // forwardPass leaves the input intact but walks the shape down to the last layer
+        imageData->height = INPUT_ROWS_1 + 2 * padding;
+        imageData->width = INPUT_COLS_1 + 2 * padding;
+        imageData->filters = INPUT_FILTERS_1;
+        int half = forwardPassHalf(*imageData, *workspace, hparams);
+
+        for (int c = 0; c < TOTAL_CLASSES; c++) {
+            float error = fabsf(imageData->layer_9[c] - logits[c]);
+            if (error > report.max_logit_error) {
+                report.max_logit_error = error;
+            }
+        }
+        report.images++;
+        report.fp32_correct += (fp32 == entries[i].label);
+        report.half_correct += (half == entries[i].label);
+        report.agreement += (fp32 == half);
+    }
+
+    delete imageData;
+    freeWorkspace(workspace);
+}
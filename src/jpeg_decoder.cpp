@@ -0,0 +1,239 @@
+#include "../include/jpeg_decoder.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+#include <vector>
+
+// libjpeg reports fatal errors through error_exit, which must not return: jump back into decodeJpeg instead
+typedef struct JpegErrorManager {
+    struct jpeg_error_mgr pub;
+    jmp_buf escape;
+} JpegErrorManager;
+
+struct JpegDecoder {
+    struct jpeg_decompress_struct cinfo;
+    JpegErrorManager error;
+    cv::Mat scaled;                   // decoded image of a rotated JPEG, before its orientation is applied
+    std::vector<unsigned char> bytes; // file contents for decodeJpegFile
+};
+
+// Frees the calling thread's decoder when the thread exits
+typedef struct ThreadDecoder {
+    JpegDecoder* decoder;
+
+    ~ThreadDecoder() {
+        if (decoder != NULL) {
+            freeJpegDecoder(decoder);
+        }
+    }
+} ThreadDecoder;
+
+static thread_local ThreadDecoder thread_decoder = {NULL};
+
+static void errorExit(j_common_ptr cinfo) {
+    JpegErrorManager* error = (JpegErrorManager*)cinfo->err;
+    longjmp(error->escape, 1);
+}
+
+JpegDecoder* createJpegDecoder() {
+    JpegDecoder* decoder = new JpegDecoder;
+    decoder->cinfo.err = jpeg_std_error(&decoder->error.pub);
+    decoder->error.pub.error_exit = errorExit;
+    jpeg_create_decompress(&decoder->cinfo);
+
+    // Keep the APP1 (EXIF) segments for the orientation tag, every other marker is skipped
+    jpeg_save_markers(&decoder->cinfo, JPEG_APP0 + 1, 0xFFFF);
+    return decoder;
+}
+
+void freeJpegDecoder(JpegDecoder* decoder) {
+    jpeg_destroy_decompress(&decoder->cinfo);
+    delete decoder;
+}
+
+JpegDecoder& threadJpegDecoder() {
+    if (thread_decoder.decoder == NULL) {
+        thread_decoder.decoder = createJpegDecoder();
+    }
+    return *thread_decoder.decoder;
+}
+
+static unsigned read16(const JOCTET* data, bool little_endian) {
+    return little_endian ? data[0] | (data[1] << 8) : (data[0] << 8) | data[1];
+}
+
+static unsigned read32(const JOCTET* data, bool little_endian) {
+    return little_endian ? read16(data, true) | (read16(data + 2, true) << 16)
+                         : (read16(data, false) << 16) | read16(data + 2, false);
+}
+
+// Orientation tag (1-8) of the first IFD of the EXIF segment, 1 (upright) if there is none
+static int exifOrientation(j_decompress_ptr cinfo) {
+    for (jpeg_saved_marker_ptr marker = cinfo->marker_list; marker != NULL; marker = marker->next) {
+        if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 14 || memcmp(marker->data, "Exif\0\0", 6) != 0) {
+            continue;
+        }
+
+        // TIFF header: byte order ("II" or "MM"), 42, offset of the first IFD
+        const JOCTET* tiff = marker->data + 6;
+        unsigned size = marker->data_length - 6;
+        if (tiff[0] != tiff[1] || (tiff[0] != 'I' && tiff[0] != 'M')) {
+            continue;
+        }
+        bool little_endian = tiff[0] == 'I';
+        unsigned ifd = read32(tiff + 4, little_endian);
+        if (ifd > size - 2) {
+            continue;
+        }
+
+        // 12-byte entries: tag, type, count, value
+        unsigned entries = read16(tiff + ifd, little_endian);
+        for (unsigned e = 0; e < entries && ifd + 2 + (e + 1) * 12 <= size; e++) {
+            const JOCTET* entry = tiff + ifd + 2 + e * 12;
+            if (read16(entry, little_endian) == 0x0112) {
+                unsigned orientation = read16(entry + 8, little_endian);
+                return (orientation >= 1 && orientation <= 8) ? (int)orientation : 1;
+            }
+        }
+    }
+    return 1;
+}
+
+// Writes src turned upright according to its EXIF orientation into dst, the same transform cv::imread applies
+static void applyOrientation(const cv::Mat& src, int orientation, cv::Mat& dst) {
+    bool transposed = orientation >= 5;
+    int rows = transposed ? src.cols : src.rows;
+    int cols = transposed ? src.rows : src.cols;
+    dst.create(rows, cols, CV_8UC3);
+
+    for (int i = 0; i < rows; i++) {
+        unsigned char* out = dst.ptr(i);
+        for (int j = 0; j < cols; j++) {
+            // Source pixel (y, x) of dst(i, j)
+            int y, x;
+            switch (orientation) {
+            case 2: // mirrored horizontally
+                y = i, x = src.cols - 1 - j;
+                break;
+            case 3: // rotated 180
+                y = src.rows - 1 - i, x = src.cols - 1 - j;
+                break;
+            case 4: // mirrored vertically
+                y = src.rows - 1 - i, x = j;
+                break;
+            case 5: // transposed
+                y = j, x = i;
+                break;
+            case 6: // rotated 90 clockwise
+                y = src.rows - 1 - j, x = i;
+                break;
+            case 7: // transposed and rotated 180
+                y = src.rows - 1 - j, x = src.cols - 1 - i;
+                break;
+            default: // 8, rotated 90 counter-clockwise
+                y = j, x = src.cols - 1 - i;
+                break;
+            }
+            memcpy(out + 3 * j, src.ptr(y) + 3 * x, 3);
+        }
+    }
+}
+
+// Everything between jpeg_read_header and jpeg_finish_decompress. libjpeg errors longjmp out of here, so no
+// local may need a destructor.
+static void decodeScaled(JpegDecoder& decoder, int min_rows, int min_cols, cv::Mat& image) {
+    j_decompress_ptr cinfo = &decoder.cinfo;
+    jpeg_read_header(cinfo, TRUE);
+
+    // Orientations 5-8 swap the axes, the decoded columns become the rows of the upright image
+    int orientation = exifOrientation(cinfo);
+    int need_rows = (orientation >= 5) ? min_cols : min_rows;
+    int need_cols = (orientation >= 5) ? min_rows : min_cols;
+
+#ifdef JCS_EXTENSIONS
+    cinfo->out_color_space = JCS_EXT_BGR;
+#else
+    cinfo->out_color_space = JCS_RGB;
+#endif
+
+    // Smallest n/8 scale still covering the requested size, libjpeg rounds unsupported ones up and 8/8 is
+    // a full decode, so the loop always ends on a usable scale
+    cinfo->scale_denom = 8;
+    for (unsigned n = 1; n <= 8; n++) {
+        cinfo->scale_num = n;
+        jpeg_calc_output_dimensions(cinfo);
+        if ((int)cinfo->output_height >= need_rows && (int)cinfo->output_width >= need_cols) {
+            break;
+        }
+    }
+
+    jpeg_start_decompress(cinfo);
+    cv::Mat& decoded = (orientation == 1) ? image : decoder.scaled;
+    decoded.create(cinfo->output_height, cinfo->output_width, CV_8UC3);
+    while (cinfo->output_scanline < cinfo->output_height) {
+        JSAMPROW row = decoded.ptr(cinfo->output_scanline);
+        jpeg_read_scanlines(cinfo, &row, 1);
+#ifndef JCS_EXTENSIONS
+        for (JDIMENSION x = 0; x < cinfo->output_width; x++) {
+            JSAMPLE red = row[3 * x];
+            row[3 * x] = row[3 * x + 2];
+            row[3 * x + 2] = red;
+        }
+#endif
+    }
+    jpeg_finish_decompress(cinfo);
+
+    if (orientation != 1) {
+        applyOrientation(decoder.scaled, orientation, image);
+    }
+}
+
+bool decodeJpeg(JpegDecoder& decoder, const unsigned char* data, size_t size, int min_rows, int min_cols, cv::Mat& image) {
+    if (setjmp(decoder.error.escape)) {
+        // Resets the decompressor for the next image without releasing its permanent allocations
+        jpeg_abort_decompress(&decoder.cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(&decoder.cinfo, data, (unsigned long)size);
+    decodeScaled(decoder, min_rows, min_cols, image);
+    return true;
+}
+
+bool decodeJpegFile(JpegDecoder& decoder, const char* path, int min_rows, int min_cols, cv::Mat& image) {
+    // Read into the decoder's buffer instead of using jpeg_stdio_src, libjpeg-turbo won't switch a
+    // decompressor between memory and stdio sources
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(file);
+        return false;
+    }
+
+    decoder.bytes.resize(size);
+    bool ok = fread(decoder.bytes.data(), 1, size, file) == (size_t)size;
+    fclose(file);
+
+    return ok && decodeJpeg(decoder, decoder.bytes.data(), decoder.bytes.size(), min_rows, min_cols, image);
+}
+
+bool decodeImageBuffer(JpegDecoder& decoder, const unsigned char* data, size_t size, int min_rows, int min_cols, cv::Mat& image) {
+    if (decodeJpeg(decoder, data, size, min_rows, min_cols, image)) {
+        return true;
+    }
+    if (size == 0) {
+        return false;
+    }
+    image = cv::imdecode(cv::Mat(1, (int)size, CV_8UC1, (void*)data), cv::IMREAD_COLOR);
+    return !image.empty();
+}
@@ -0,0 +1,205 @@
+#include "../include/simd.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+static void gemmMicroKernel(int K, const float* a, const float* b, float* acc) {
+    // Four rows per pass keeps 8 accumulators + 2 B vectors inside the 16 ymm registers
+    for (int i = 0; i < GEMM_MR; i += 4) {
+        __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+        __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+        __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+        __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+
+        for (int k = 0; k < K; k++) {
+            const float* ak = a + k * GEMM_MR + i;
+            __m256 b0 = _mm256_loadu_ps(b + k * GEMM_NR);
+            __m256 b1 = _mm256_loadu_ps(b + k * GEMM_NR + 8);
+            __m256 a_val = _mm256_broadcast_ss(ak);
+            c00 = _mm256_fmadd_ps(a_val, b0, c00);
+            c01 = _mm256_fmadd_ps(a_val, b1, c01);
+            a_val = _mm256_broadcast_ss(ak + 1);
+            c10 = _mm256_fmadd_ps(a_val, b0, c10);
+            c11 = _mm256_fmadd_ps(a_val, b1, c11);
+            a_val = _mm256_broadcast_ss(ak + 2);
+            c20 = _mm256_fmadd_ps(a_val, b0, c20);
+            c21 = _mm256_fmadd_ps(a_val, b1, c21);
+            a_val = _mm256_broadcast_ss(ak + 3);
+            c30 = _mm256_fmadd_ps(a_val, b0, c30);
+            c31 = _mm256_fmadd_ps(a_val, b1, c31);
+        }
+
+        float* out = acc + i * GEMM_NR;
+        _mm256_storeu_ps(out, c00);
+        _mm256_storeu_ps(out + 8, c01);
+        _mm256_storeu_ps(out + GEMM_NR, c10);
+        _mm256_storeu_ps(out + GEMM_NR + 8, c11);
+        _mm256_storeu_ps(out + 2 * GEMM_NR, c20);
+        _mm256_storeu_ps(out + 2 * GEMM_NR + 8, c21);
+        _mm256_storeu_ps(out + 3 * GEMM_NR, c30);
+        _mm256_storeu_ps(out + 3 * GEMM_NR + 8, c31);
+    }
+}
+
+static float dot(const float* a, const float* b, int n) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    s0 = _mm256_add_ps(s0, s1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+
+    float sum = _mm_cvtss_f32(s);
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static int32_t dotS8(const int8_t* a, const int8_t* b, int n) {
+    __m256i sum = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m256i b16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a16, b16));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+
+    int32_t total = _mm_cvtsi128_si32(s);
+    for (; i < n; i++) {
+        total += (int32_t)a[i] * b[i];
+    }
+    return total;
+}
+
+// F16C widens fp16, bf16 is the upper half of an fp32
+static __m256 widenF16(__m128i h) {
+    return _mm256_cvtph_ps(h);
+}
+
+static __m256 widenBf16(__m128i h) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+}
+
+// 16 weights per step, a partial last step runs on zero padded copies
+template <__m256 (*Widen)(__m128i)>
+static float dotHalf(const uint16_t* a, const float* b, int n) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    uint16_t a_tail[16] = {0};
+    float b_tail[16] = {0};
+    for (int i = 0; i < n; i += 16) {
+        const uint16_t* ai = a + i;
+        const float* bi = b + i;
+        if (n - i < 16) {
+            memcpy(a_tail, ai, (n - i) * sizeof(uint16_t));
+            memcpy(b_tail, bi, (n - i) * sizeof(float));
+            ai = a_tail;
+            bi = b_tail;
+        }
+        s0 = _mm256_fmadd_ps(Widen(_mm_loadu_si128((const __m128i*)ai)), _mm256_loadu_ps(bi), s0);
+        s1 = _mm256_fmadd_ps(Widen(_mm_loadu_si128((const __m128i*)(ai + 8))), _mm256_loadu_ps(bi + 8), s1);
+    }
+    s0 = _mm256_add_ps(s0, s1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    return _mm_cvtss_f32(s);
+}
+
+static float dotF16(const uint16_t* a, const float* b, int n) {
+    return dotHalf<widenF16>(a, b, n);
+}
+
+static float dotBf16(const uint16_t* a, const float* b, int n) {
+    return dotHalf<widenBf16>(a, b, n);
+}
+
+static void nchwcConvTile(const float* input, const float* weights, int in_blocks, int in_block, int kernel_size,
+                          int block_stride, int row_stride, int pixel_stride, float* acc) {
+    // Four pixels per pass keeps 8 accumulators + 2 weight vectors inside the 16 ymm registers
+    for (int i = 0; i < NCHWC_TILE; i += 4) {
+        __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+        __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+        __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+        __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+
+        const float* w = weights;
+        for (int ib = 0; ib < in_blocks; ib++) {
+            for (int ki = 0; ki < kernel_size; ki++) {
+                for (int kj = 0; kj < kernel_size; kj++) {
+                    const float* x = input + ib * block_stride + ki * row_stride + kj * in_block + i * pixel_stride;
+                    for (int ci = 0; ci < in_block; ci++, w += NCHWC_BLOCK) {
+                        __m256 w0 = _mm256_loadu_ps(w);
+                        __m256 w1 = _mm256_loadu_ps(w + 8);
+                        __m256 x_val = _mm256_broadcast_ss(x + ci);
+                        c00 = _mm256_fmadd_ps(x_val, w0, c00);
+                        c01 = _mm256_fmadd_ps(x_val, w1, c01);
+                        x_val = _mm256_broadcast_ss(x + pixel_stride + ci);
+                        c10 = _mm256_fmadd_ps(x_val, w0, c10);
+                        c11 = _mm256_fmadd_ps(x_val, w1, c11);
+                        x_val = _mm256_broadcast_ss(x + 2 * pixel_stride + ci);
+                        c20 = _mm256_fmadd_ps(x_val, w0, c20);
+                        c21 = _mm256_fmadd_ps(x_val, w1, c21);
+                        x_val = _mm256_broadcast_ss(x + 3 * pixel_stride + ci);
+                        c30 = _mm256_fmadd_ps(x_val, w0, c30);
+                        c31 = _mm256_fmadd_ps(x_val, w1, c31);
+                    }
+                }
+            }
+        }
+
+        float* out = acc + i * NCHWC_BLOCK;
+        _mm256_storeu_ps(out, c00);
+        _mm256_storeu_ps(out + 8, c01);
+        _mm256_storeu_ps(out + NCHWC_BLOCK, c10);
+        _mm256_storeu_ps(out + NCHWC_BLOCK + 8, c11);
+        _mm256_storeu_ps(out + 2 * NCHWC_BLOCK, c20);
+        _mm256_storeu_ps(out + 2 * NCHWC_BLOCK + 8, c21);
+        _mm256_storeu_ps(out + 3 * NCHWC_BLOCK, c30);
+        _mm256_storeu_ps(out + 3 * NCHWC_BLOCK + 8, c31);
+    }
+}
+
+static void maxPool2x2Row(const float* row0, const float* row1, float* out, int out_cols) {
+    int c = 0;
+    for (; c + 8 <= out_cols; c += 8) {
+        __m256 lo = _mm256_max_ps(_mm256_loadu_ps(row0 + 2 * c), _mm256_loadu_ps(row1 + 2 * c));
+        __m256 hi = _mm256_max_ps(_mm256_loadu_ps(row0 + 2 * c + 8), _mm256_loadu_ps(row1 + 2 * c + 8));
+        // In-lane shuffles leave the pairs in 64-bit order 0 2 1 3, permute restores it
+        __m256 even = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 odd = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        __m256d max_val = _mm256_castps_pd(_mm256_max_ps(even, odd));
+        _mm256_storeu_ps(out + c, _mm256_castpd_ps(_mm256_permute4x64_pd(max_val, _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    for (; c < out_cols; c++) {
+        float max_val = row0[2 * c];
+        if (row0[2 * c + 1] > max_val) max_val = row0[2 * c + 1];
+        if (row1[2 * c] > max_val) max_val = row1[2 * c];
+        if (row1[2 * c + 1] > max_val) max_val = row1[2 * c + 1];
+        out[c] = max_val;
+    }
+}
+
+static void sparseBlocks(const float* x, int inputs, const int32_t* starts, const uint8_t* blocks, const float* values,
+                         float* sums) {
+    for (int j = 0; j < inputs; j++) {
+        if (x[j] == 0) {
+            continue;
+        }
+        __m128 x_val = _mm_set1_ps(x[j]);
+        for (int k = starts[j]; k < starts[j + 1]; k++) {
+            float* out = sums + blocks[k] * SPARSE_BLOCK;
+            _mm_store_ps(out, _mm_fmadd_ps(_mm_load_ps(values + k * SPARSE_BLOCK), x_val, _mm_load_ps(out)));
+        }
+    }
+}
+
+const KernelTable avx2_kernels = {"avx2", gemmMicroKernel, dot, dotS8, dotF16, dotBf16, nchwcConvTile, maxPool2x2Row,
+                                  sparseBlocks};
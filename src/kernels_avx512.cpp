@@ -0,0 +1,183 @@
+#include "../include/simd.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+static void gemmMicroKernel(int K, const float* a, const float* b, float* acc) {
+    // One zmm covers a full GEMM_NR row, so all 8 rows stay in registers
+    __m512 c0 = _mm512_setzero_ps(), c1 = _mm512_setzero_ps(), c2 = _mm512_setzero_ps(), c3 = _mm512_setzero_ps();
+    __m512 c4 = _mm512_setzero_ps(), c5 = _mm512_setzero_ps(), c6 = _mm512_setzero_ps(), c7 = _mm512_setzero_ps();
+
+    for (int k = 0; k < K; k++) {
+        const float* ak = a + k * GEMM_MR;
+        __m512 b_val = _mm512_loadu_ps(b + k * GEMM_NR);
+        c0 = _mm512_fmadd_ps(_mm512_set1_ps(ak[0]), b_val, c0);
+        c1 = _mm512_fmadd_ps(_mm512_set1_ps(ak[1]), b_val, c1);
+        c2 = _mm512_fmadd_ps(_mm512_set1_ps(ak[2]), b_val, c2);
+        c3 = _mm512_fmadd_ps(_mm512_set1_ps(ak[3]), b_val, c3);
+        c4 = _mm512_fmadd_ps(_mm512_set1_ps(ak[4]), b_val, c4);
+        c5 = _mm512_fmadd_ps(_mm512_set1_ps(ak[5]), b_val, c5);
+        c6 = _mm512_fmadd_ps(_mm512_set1_ps(ak[6]), b_val, c6);
+        c7 = _mm512_fmadd_ps(_mm512_set1_ps(ak[7]), b_val, c7);
+    }
+
+    _mm512_storeu_ps(acc, c0);
+    _mm512_storeu_ps(acc + GEMM_NR, c1);
+    _mm512_storeu_ps(acc + 2 * GEMM_NR, c2);
+    _mm512_storeu_ps(acc + 3 * GEMM_NR, c3);
+    _mm512_storeu_ps(acc + 4 * GEMM_NR, c4);
+    _mm512_storeu_ps(acc + 5 * GEMM_NR, c5);
+    _mm512_storeu_ps(acc + 6 * GEMM_NR, c6);
+    _mm512_storeu_ps(acc + 7 * GEMM_NR, c7);
+}
+
+static float dot(const float* a, const float* b, int n) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+    }
+    if (n - i >= 16) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+        i += 16;
+    }
+    if (i < n) {
+        __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), s1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+// -mavx512f implies AVX2, 512-bit byte widening would additionally need AVX512BW
+static int32_t dotS8(const int8_t* a, const int8_t* b, int n) {
+    __m256i sum = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m256i b16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a16, b16));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+
+    int32_t total = _mm_cvtsi128_si32(s);
+    for (; i < n; i++) {
+        total += (int32_t)a[i] * b[i];
+    }
+    return total;
+}
+
+// vcvtph2ps is part of AVX512F, bf16 is the upper half of an fp32. The AVX512_BF16 dot product would also
+// round the activations to bf16, widening keeps them exact
+static __m512 widenF16(__m256i h) {
+    return _mm512_cvtph_ps(h);
+}
+
+static __m512 widenBf16(__m256i h) {
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+}
+
+// 32 weights per step, a partial last step runs on zero padded copies
+template <__m512 (*Widen)(__m256i)>
+static float dotHalf(const uint16_t* a, const float* b, int n) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    uint16_t a_tail[32] = {0};
+    float b_tail[32] = {0};
+    for (int i = 0; i < n; i += 32) {
+        const uint16_t* ai = a + i;
+        const float* bi = b + i;
+        if (n - i < 32) {
+            memcpy(a_tail, ai, (n - i) * sizeof(uint16_t));
+            memcpy(b_tail, bi, (n - i) * sizeof(float));
+            ai = a_tail;
+            bi = b_tail;
+        }
+        s0 = _mm512_fmadd_ps(Widen(_mm256_loadu_si256((const __m256i*)ai)), _mm512_loadu_ps(bi), s0);
+        s1 = _mm512_fmadd_ps(Widen(_mm256_loadu_si256((const __m256i*)(ai + 16))), _mm512_loadu_ps(bi + 16), s1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+static float dotF16(const uint16_t* a, const float* b, int n) {
+    return dotHalf<widenF16>(a, b, n);
+}
+
+static float dotBf16(const uint16_t* a, const float* b, int n) {
+    return dotHalf<widenBf16>(a, b, n);
+}
+
+static void nchwcConvTile(const float* input, const float* weights, int in_blocks, int in_block, int kernel_size,
+                          int block_stride, int row_stride, int pixel_stride, float* acc) {
+    // One zmm covers a full NCHWC_BLOCK, so all 8 pixels stay in registers
+    __m512 c0 = _mm512_setzero_ps(), c1 = _mm512_setzero_ps(), c2 = _mm512_setzero_ps(), c3 = _mm512_setzero_ps();
+    __m512 c4 = _mm512_setzero_ps(), c5 = _mm512_setzero_ps(), c6 = _mm512_setzero_ps(), c7 = _mm512_setzero_ps();
+
+    const float* w = weights;
+    for (int ib = 0; ib < in_blocks; ib++) {
+        for (int ki = 0; ki < kernel_size; ki++) {
+            for (int kj = 0; kj < kernel_size; kj++) {
+                const float* x = input + ib * block_stride + ki * row_stride + kj * in_block;
+                for (int ci = 0; ci < in_block; ci++, w += NCHWC_BLOCK) {
+                    __m512 w_val = _mm512_loadu_ps(w);
+                    c0 = _mm512_fmadd_ps(_mm512_set1_ps(x[ci]), w_val, c0);
+                    c1 = _mm512_fmadd_ps(_mm512_set1_ps(x[pixel_stride + ci]), w_val, c1);
+                    c2 = _mm512_fmadd_ps(_mm512_set1_ps(x[2 * pixel_stride + ci]), w_val, c2);
+                    c3 = _mm512_fmadd_ps(_mm512_set1_ps(x[3 * pixel_stride + ci]), w_val, c3);
+                    c4 = _mm512_fmadd_ps(_mm512_set1_ps(x[4 * pixel_stride + ci]), w_val, c4);
+                    c5 = _mm512_fmadd_ps(_mm512_set1_ps(x[5 * pixel_stride + ci]), w_val, c5);
+                    c6 = _mm512_fmadd_ps(_mm512_set1_ps(x[6 * pixel_stride + ci]), w_val, c6);
+                    c7 = _mm512_fmadd_ps(_mm512_set1_ps(x[7 * pixel_stride + ci]), w_val, c7);
+                }
+            }
+        }
+    }
+
+    _mm512_storeu_ps(acc, c0);
+    _mm512_storeu_ps(acc + NCHWC_BLOCK, c1);
+    _mm512_storeu_ps(acc + 2 * NCHWC_BLOCK, c2);
+    _mm512_storeu_ps(acc + 3 * NCHWC_BLOCK, c3);
+    _mm512_storeu_ps(acc + 4 * NCHWC_BLOCK, c4);
+    _mm512_storeu_ps(acc + 5 * NCHWC_BLOCK, c5);
+    _mm512_storeu_ps(acc + 6 * NCHWC_BLOCK, c6);
+    _mm512_storeu_ps(acc + 7 * NCHWC_BLOCK, c7);
+}
+
+static void maxPool2x2Row(const float* row0, const float* row1, float* out, int out_cols) {
+    const __m512i even_idx = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd_idx = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+
+    int c = 0;
+    for (; c + 16 <= out_cols; c += 16) {
+        __m512 lo = _mm512_max_ps(_mm512_loadu_ps(row0 + 2 * c), _mm512_loadu_ps(row1 + 2 * c));
+        __m512 hi = _mm512_max_ps(_mm512_loadu_ps(row0 + 2 * c + 16), _mm512_loadu_ps(row1 + 2 * c + 16));
+        __m512 even = _mm512_permutex2var_ps(lo, even_idx, hi);
+        __m512 odd = _mm512_permutex2var_ps(lo, odd_idx, hi);
+        _mm512_storeu_ps(out + c, _mm512_max_ps(even, odd));
+    }
+    for (; c < out_cols; c++) {
+        float max_val = row0[2 * c];
+        if (row0[2 * c + 1] > max_val) max_val = row0[2 * c + 1];
+        if (row1[2 * c] > max_val) max_val = row1[2 * c];
+        if (row1[2 * c + 1] > max_val) max_val = row1[2 * c + 1];
+        out[c] = max_val;
+    }
+}
+
+static void sparseBlocks(const float* x, int inputs, const int32_t* starts, const uint8_t* blocks, const float* values,
+                         float* sums) {
+    for (int j = 0; j < inputs; j++) {
+        if (x[j] == 0) {
+            continue;
+        }
+        __m128 x_val = _mm_set1_ps(x[j]);
+        for (int k = starts[j]; k < starts[j + 1]; k++) {
+            float* out = sums + blocks[k] * SPARSE_BLOCK;
+            _mm_store_ps(out, _mm_add_ps(_mm_load_ps(out), _mm_mul_ps(_mm_load_ps(values + k * SPARSE_BLOCK), x_val)));
+        }
+    }
+}
+
+const KernelTable avx512_kernels = {"avx512", gemmMicroKernel, dot, dotS8, dotF16, dotBf16, nchwcConvTile, maxPool2x2Row,
+                                    sparseBlocks};
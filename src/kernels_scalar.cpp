@@ -0,0 +1,128 @@
+#include "../include/simd.h"
+
+#include <string.h>
+
+static void gemmMicroKernel(int K, const float* a, const float* b, float* acc) {
+    for (int i = 0; i < GEMM_MR * GEMM_NR; i++) {
+        acc[i] = 0;
+    }
+
+    for (int k = 0; k < K; k++) {
+        for (int i = 0; i < GEMM_MR; i++) {
+            float a_val = a[k * GEMM_MR + i];
+            for (int j = 0; j < GEMM_NR; j++) {
+                acc[i * GEMM_NR + j] += a_val * b[k * GEMM_NR + j];
+            }
+        }
+    }
+}
+
+static float dot(const float* a, const float* b, int n) {
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static int32_t dotS8(const int8_t* a, const int8_t* b, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += (int32_t)a[i] * b[i];
+    }
+    return sum;
+}
+
+// fp16 to fp32: the exponent and mantissa shifted into place, times 2^112 to rebias the exponent, which also
+// normalizes the subnormals. Inf and NaN get the all ones exponent instead
+static float halfToFloat(uint16_t h) {
+    uint32_t bits = (uint32_t)(h & 0x7fff) << 13;
+    float value;
+    if (bits >= 0x0f800000) {
+        bits |= 0x7f800000;
+        memcpy(&value, &bits, sizeof(value));
+    } else {
+        const uint32_t scale_bits = 0x77800000;
+        float scale;
+        memcpy(&value, &bits, sizeof(value));
+        memcpy(&scale, &scale_bits, sizeof(scale));
+        value *= scale;
+    }
+    return (h & 0x8000) ? -value : value;
+}
+
+// bf16 is the upper half of an fp32
+static float bf16ToFloat(uint16_t h) {
+    uint32_t bits = (uint32_t)h << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static float dotF16(const uint16_t* a, const float* b, int n) {
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += halfToFloat(a[i]) * b[i];
+    }
+    return sum;
+}
+
+static float dotBf16(const uint16_t* a, const float* b, int n) {
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += bf16ToFloat(a[i]) * b[i];
+    }
+    return sum;
+}
+
+static void nchwcConvTile(const float* input, const float* weights, int in_blocks, int in_block, int kernel_size,
+                          int block_stride, int row_stride, int pixel_stride, float* acc) {
+    for (int i = 0; i < NCHWC_TILE * NCHWC_BLOCK; i++) {
+        acc[i] = 0;
+    }
+
+    const float* w = weights;
+    for (int ib = 0; ib < in_blocks; ib++) {
+        for (int ki = 0; ki < kernel_size; ki++) {
+            for (int kj = 0; kj < kernel_size; kj++) {
+                const float* x = input + ib * block_stride + ki * row_stride + kj * in_block;
+                for (int ci = 0; ci < in_block; ci++, w += NCHWC_BLOCK) {
+                    for (int i = 0; i < NCHWC_TILE; i++) {
+                        float x_val = x[i * pixel_stride + ci];
+                        for (int o = 0; o < NCHWC_BLOCK; o++) {
+                            acc[i * NCHWC_BLOCK + o] += x_val * w[o];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void maxPool2x2Row(const float* row0, const float* row1, float* out, int out_cols) {
+    for (int c = 0; c < out_cols; c++) {
+        float max_val = row0[2 * c];
+        if (row0[2 * c + 1] > max_val) max_val = row0[2 * c + 1];
+        if (row1[2 * c] > max_val) max_val = row1[2 * c];
+        if (row1[2 * c + 1] > max_val) max_val = row1[2 * c + 1];
+        out[c] = max_val;
+    }
+}
+
+static void sparseBlocks(const float* x, int inputs, const int32_t* starts, const uint8_t* blocks, const float* values,
+                         float* sums) {
+    for (int j = 0; j < inputs; j++) {
+        if (x[j] == 0) {
+            continue;
+        }
+        for (int k = starts[j]; k < starts[j + 1]; k++) {
+            float* out = sums + blocks[k] * SPARSE_BLOCK;
+            for (int r = 0; r < SPARSE_BLOCK; r++) {
+                out[r] += values[k * SPARSE_BLOCK + r] * x[j];
+            }
+        }
+    }
+}
+
+const KernelTable scalar_kernels = {"scalar", gemmMicroKernel, dot, dotS8, dotF16, dotBf16, nchwcConvTile, maxPool2x2Row,
+                                    sparseBlocks};
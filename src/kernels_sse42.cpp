@@ -0,0 +1,200 @@
+#include "../include/simd.h"
+
+#include <nmmintrin.h>
+#include <string.h>
+
+static void gemmMicroKernel(int K, const float* a, const float* b, float* acc) {
+    // Two rows per pass keeps 8 accumulators + 4 B vectors inside the 16 xmm registers
+    for (int i = 0; i < GEMM_MR; i += 2) {
+        __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps(), c02 = _mm_setzero_ps(), c03 = _mm_setzero_ps();
+        __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps(), c12 = _mm_setzero_ps(), c13 = _mm_setzero_ps();
+
+        for (int k = 0; k < K; k++) {
+            const float* bk = b + k * GEMM_NR;
+            __m128 b0 = _mm_loadu_ps(bk), b1 = _mm_loadu_ps(bk + 4), b2 = _mm_loadu_ps(bk + 8), b3 = _mm_loadu_ps(bk + 12);
+            __m128 a0 = _mm_set1_ps(a[k * GEMM_MR + i]);
+            __m128 a1 = _mm_set1_ps(a[k * GEMM_MR + i + 1]);
+            c00 = _mm_add_ps(c00, _mm_mul_ps(a0, b0));
+            c01 = _mm_add_ps(c01, _mm_mul_ps(a0, b1));
+            c02 = _mm_add_ps(c02, _mm_mul_ps(a0, b2));
+            c03 = _mm_add_ps(c03, _mm_mul_ps(a0, b3));
+            c10 = _mm_add_ps(c10, _mm_mul_ps(a1, b0));
+            c11 = _mm_add_ps(c11, _mm_mul_ps(a1, b1));
+            c12 = _mm_add_ps(c12, _mm_mul_ps(a1, b2));
+            c13 = _mm_add_ps(c13, _mm_mul_ps(a1, b3));
+        }
+
+        float* row0 = acc + i * GEMM_NR;
+        float* row1 = row0 + GEMM_NR;
+        _mm_storeu_ps(row0, c00);
+        _mm_storeu_ps(row0 + 4, c01);
+        _mm_storeu_ps(row0 + 8, c02);
+        _mm_storeu_ps(row0 + 12, c03);
+        _mm_storeu_ps(row1, c10);
+        _mm_storeu_ps(row1 + 4, c11);
+        _mm_storeu_ps(row1 + 8, c12);
+        _mm_storeu_ps(row1 + 12, c13);
+    }
+}
+
+static float dot(const float* a, const float* b, int n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    s0 = _mm_add_ps(s0, s1);
+    s0 = _mm_hadd_ps(s0, s0);
+    s0 = _mm_hadd_ps(s0, s0);
+
+    float sum = _mm_cvtss_f32(s0);
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static int32_t dotS8(const int8_t* a, const int8_t* b, int n) {
+    __m128i sum = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a16 = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(a + i)));
+        __m128i b16 = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(b + i)));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a16, b16));
+    }
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+
+    int32_t total = _mm_cvtsi128_si32(sum);
+    for (; i < n; i++) {
+        total += (int32_t)a[i] * b[i];
+    }
+    return total;
+}
+
+// No F16C below AVX2: halfToFloat of kernels_scalar.cpp on the low 16 bits of each lane
+static __m128 widenF16(__m128i h) {
+    __m128i bits = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13);
+    __m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+    __m128 value = _mm_mul_ps(_mm_castsi128_ps(bits), _mm_castsi128_ps(_mm_set1_epi32(0x77800000)));
+    __m128 special = _mm_castsi128_ps(_mm_cmpgt_epi32(bits, _mm_set1_epi32(0x0f7fffff)));
+    value = _mm_blendv_ps(value, _mm_castsi128_ps(_mm_or_si128(bits, _mm_set1_epi32(0x7f800000))), special);
+    return _mm_or_ps(value, _mm_castsi128_ps(sign));
+}
+
+static __m128 widenBf16(__m128i h) {
+    return _mm_castsi128_ps(_mm_slli_epi32(h, 16));
+}
+
+// 8 weights per step, a partial last step runs on zero padded copies
+template <__m128 (*Widen)(__m128i)>
+static float dotHalf(const uint16_t* a, const float* b, int n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    uint16_t a_tail[8] = {0};
+    float b_tail[8] = {0};
+    for (int i = 0; i < n; i += 8) {
+        const uint16_t* ai = a + i;
+        const float* bi = b + i;
+        if (n - i < 8) {
+            memcpy(a_tail, ai, (n - i) * sizeof(uint16_t));
+            memcpy(b_tail, bi, (n - i) * sizeof(float));
+            ai = a_tail;
+            bi = b_tail;
+        }
+        __m128i h = _mm_loadu_si128((const __m128i*)ai);
+        s0 = _mm_add_ps(s0, _mm_mul_ps(Widen(_mm_cvtepu16_epi32(h)), _mm_loadu_ps(bi)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(Widen(_mm_cvtepu16_epi32(_mm_srli_si128(h, 8))), _mm_loadu_ps(bi + 4)));
+    }
+    __m128 s = _mm_add_ps(s0, s1);
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    return _mm_cvtss_f32(s);
+}
+
+static float dotF16(const uint16_t* a, const float* b, int n) {
+    return dotHalf<widenF16>(a, b, n);
+}
+
+static float dotBf16(const uint16_t* a, const float* b, int n) {
+    return dotHalf<widenBf16>(a, b, n);
+}
+
+static void nchwcConvTile(const float* input, const float* weights, int in_blocks, int in_block, int kernel_size,
+                          int block_stride, int row_stride, int pixel_stride, float* acc) {
+    // Two pixels per pass keeps 8 accumulators + 4 weight vectors inside the 16 xmm registers
+    for (int i = 0; i < NCHWC_TILE; i += 2) {
+        __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps(), c02 = _mm_setzero_ps(), c03 = _mm_setzero_ps();
+        __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps(), c12 = _mm_setzero_ps(), c13 = _mm_setzero_ps();
+
+        const float* w = weights;
+        for (int ib = 0; ib < in_blocks; ib++) {
+            for (int ki = 0; ki < kernel_size; ki++) {
+                for (int kj = 0; kj < kernel_size; kj++) {
+                    const float* x = input + ib * block_stride + ki * row_stride + kj * in_block + i * pixel_stride;
+                    for (int ci = 0; ci < in_block; ci++, w += NCHWC_BLOCK) {
+                        __m128 w0 = _mm_loadu_ps(w);
+                        __m128 w1 = _mm_loadu_ps(w + 4);
+                        __m128 w2 = _mm_loadu_ps(w + 8);
+                        __m128 w3 = _mm_loadu_ps(w + 12);
+                        __m128 x_val = _mm_set1_ps(x[ci]);
+                        c00 = _mm_add_ps(c00, _mm_mul_ps(x_val, w0));
+                        c01 = _mm_add_ps(c01, _mm_mul_ps(x_val, w1));
+                        c02 = _mm_add_ps(c02, _mm_mul_ps(x_val, w2));
+                        c03 = _mm_add_ps(c03, _mm_mul_ps(x_val, w3));
+                        x_val = _mm_set1_ps(x[pixel_stride + ci]);
+                        c10 = _mm_add_ps(c10, _mm_mul_ps(x_val, w0));
+                        c11 = _mm_add_ps(c11, _mm_mul_ps(x_val, w1));
+                        c12 = _mm_add_ps(c12, _mm_mul_ps(x_val, w2));
+                        c13 = _mm_add_ps(c13, _mm_mul_ps(x_val, w3));
+                    }
+                }
+            }
+        }
+
+        float* out = acc + i * NCHWC_BLOCK;
+        _mm_storeu_ps(out, c00);
+        _mm_storeu_ps(out + 4, c01);
+        _mm_storeu_ps(out + 8, c02);
+        _mm_storeu_ps(out + 12, c03);
+        _mm_storeu_ps(out + NCHWC_BLOCK, c10);
+        _mm_storeu_ps(out + NCHWC_BLOCK + 4, c11);
+        _mm_storeu_ps(out + NCHWC_BLOCK + 8, c12);
+        _mm_storeu_ps(out + NCHWC_BLOCK + 12, c13);
+    }
+}
+
+static void maxPool2x2Row(const float* row0, const float* row1, float* out, int out_cols) {
+    int c = 0;
+    for (; c + 4 <= out_cols; c += 4) {
+        __m128 lo = _mm_max_ps(_mm_loadu_ps(row0 + 2 * c), _mm_loadu_ps(row1 + 2 * c));
+        __m128 hi = _mm_max_ps(_mm_loadu_ps(row0 + 2 * c + 4), _mm_loadu_ps(row1 + 2 * c + 4));
+        __m128 even = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 odd = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(out + c, _mm_max_ps(even, odd));
+    }
+    for (; c < out_cols; c++) {
+        float max_val = row0[2 * c];
+        if (row0[2 * c + 1] > max_val) max_val = row0[2 * c + 1];
+        if (row1[2 * c] > max_val) max_val = row1[2 * c];
+        if (row1[2 * c + 1] > max_val) max_val = row1[2 * c + 1];
+        out[c] = max_val;
+    }
+}
+
+static void sparseBlocks(const float* x, int inputs, const int32_t* starts, const uint8_t* blocks, const float* values,
+                         float* sums) {
+    for (int j = 0; j < inputs; j++) {
+        if (x[j] == 0) {
+            continue;
+        }
+        __m128 x_val = _mm_set1_ps(x[j]);
+        for (int k = starts[j]; k < starts[j + 1]; k++) {
+            float* out = sums + blocks[k] * SPARSE_BLOCK;
+            _mm_store_ps(out, _mm_add_ps(_mm_load_ps(out), _mm_mul_ps(_mm_load_ps(values + k * SPARSE_BLOCK), x_val)));
+        }
+    }
+}
+
+const KernelTable sse42_kernels = {"sse4.2", gemmMicroKernel, dot, dotS8, dotF16, dotBf16, nchwcConvTile, maxPool2x2Row,
+                                   sparseBlocks};
@@ -0,0 +1,92 @@
+#include "../include/lenet.h"
+#include "../include/autotune.h"
+#include "../include/engine.h"
+
+#include <new>
+
+// lenet_result is filled in place of a Classification, the C handles are the C++ objects themselves
+static_assert(LENET_CLASSES == TOTAL_CLASSES, "lenet.h is out of date with network.h");
+static_assert(sizeof(lenet_result) == sizeof(Classification), "lenet_result must match Classification");
+static_assert(offsetof(lenet_result, scores) == offsetof(Classification, scores), "lenet_result must match Classification");
+static_assert((int)LENET_CONV_TUNED == (int)CONV_TUNED, "lenet_conv_algorithm must match ConvAlgorithm");
+
+// No C++ exception may cross into the C caller, the entry points below turn them into error returns
+
+lenet_engine* lenet_engine_load(const char* model_path, int conv_algorithm) {
+    try {
+        return (lenet_engine*)loadEngine(model_path, conv_algorithm, NULL);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Failed to load %s: %s\n", model_path, e.what());
+        return NULL;
+    }
+}
+
+lenet_engine* lenet_engine_load_tuned(const char* model_path, const char* tuning_cache) {
+    try {
+        TuningPlan plan;
+        bool cached = loadTuning((tuning_cache != NULL) ? tuning_cache : DEFAULT_TUNING_CACHE, tuningKey(), plan);
+        return (lenet_engine*)loadEngine(model_path, CONV_TUNED, cached ? &plan : NULL);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Failed to load %s: %s\n", model_path, e.what());
+        return NULL;
+    }
+}
+
+void lenet_engine_free(lenet_engine* engine) {
+    freeEngine((Engine*)engine);
+}
+
+int lenet_engine_outdated(const lenet_engine* engine) {
+    return engineOutdated(*(const Engine*)engine) ? 1 : 0;
+}
+
+lenet_session* lenet_session_create(const lenet_engine* engine, int max_batch) {
+    try {
+        return (lenet_session*)createSession(*(const Engine*)engine, max_batch);
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+void lenet_session_free(lenet_session* session) {
+    freeSession((Session*)session);
+}
+
+int lenet_classify_image(lenet_session* session, const void* data, size_t size, lenet_result* result) {
+    try {
+        return classifyImage(*(Session*)session, (const unsigned char*)data, size, *(Classification*)result) ? 0 : -1;
+    } catch (const std::exception&) {
+        result->class_index = -1;
+        return -1;
+    }
+}
+
+int lenet_classify_tensor(lenet_session* session, const float* tensor, lenet_result* result) {
+    try {
+        classifyTensor(*(Session*)session, tensor, *(Classification*)result);
+        return 0;
+    } catch (const std::exception&) {
+        result->class_index = -1;
+        return -1;
+    }
+}
+
+int lenet_classify_images(lenet_session* session, const void* const* data, const size_t* sizes, int count,
+                          lenet_result* results) {
+    try {
+        const unsigned char* const* images = (const unsigned char* const*)data;
+        return classifyImages(*(Session*)session, images, sizes, count, (Classification*)results);
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+void lenet_input_shape(int* channels, int* rows, int* cols) {
+    *channels = INPUT_FILTERS_1;
+    *rows = INPUT_ROWS_1;
+    *cols = INPUT_COLS_1;
+}
+
+const char* lenet_class_name(int class_index) {
+    return (class_index >= 0 && class_index < TOTAL_CLASSES) ? monkey_classes[class_index] : NULL;
+}
@@ -1,22 +1,352 @@
 #include "../include/cnn.h"
+#include "../include/autotune.h"
+#include "../include/dataset_shard.h"
+#include "../include/engine.h"
+#include "../include/half.h"
+#include "../include/pipeline.h"
+#include "../include/quant.h"
+#include "../include/server.h"
+#include "../include/sharded_eval.h"
+#include "../include/simd.h"
+#include "../include/sparse.h"
 
-int main() {
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+int main(int argc, char** argv) {
 
     int test_set_size = 0;
-    Params param;
+    int conv_algorithm = -1;
     ImageData inputImage;
     ImageData ouputImage;
     cv::Mat image;
     int true_positives = 0;
+    int unlabelled = 0;
+    int batch_size = 1;
+    int num_threads = 1;
+    bool pipelined = false;
+    const char* calibration_path = NULL;
+    bool calibrate_test_set = false;
+    float sparsity = -1;
+    int half_format = -1;
+    const char* shard_path = NULL;
+    const char* socket_path = NULL;
+    bool autotune_search = false;
+    const char* tuning_cache = DEFAULT_TUNING_CACHE;
+    bool eval_worker = false;
+    EvalConfig eval_config;
+    eval_config.shards = 0;
+    eval_config.workers = 0;
+    eval_config.max_attempts = EVAL_MAX_ATTEMPTS;
+    eval_config.timeout_s = 0;
+    PipelineConfig pipeline_config;
+    defaultPipelineConfig(pipeline_config);
+    ServerConfig server_config;
+    defaultServerConfig(server_config);
 
     const char* images_path = "../extern/test_data";
     const char* param_path = "../extern/parameters.txt";
 
-    loadParams(param_path, param);
-    loadDataset(images_path, inputImage, test_set_size, PADDING_1, param, image, true_positives);
+    // --conv=direct|gemm|fused|winograd|nchwc|tuned selects the convolution algorithm, --isa=<name> caps the SIMD kernels,
+    // --batch=N scores N images per forwardBatch call, --threads=N evaluates on N workers (0 = all cores),
+    // --pipeline[=R,D,I[,Q]] overlaps R reader, D decoder and I inference threads with queues of depth Q,
+    // --model=<file> loads a text parameter file or a binary model written by convert_params, --model=shm:<name>
+    // attaches to a model published by publish_model,
+    // --int8[=<dir>] calibrates INT8 inference on <dir> (default: the test set) and reports its drift from fp32,
+    // --shard=<file> evaluates a shard written by pack_dataset instead of decoding the test set (honours --threads/--batch),
+    // --serve=<socket> keeps the model loaded and classifies requests sent to a Unix socket (see server.h),
+    // --serve-config=B,W[,T] batches up to B requests, waiting at most W us for them, on T inference threads,
+    // --data=<folder|manifest> evaluates another folder of class subfolders or a manifest file (see dataset_scan.h),
+    // --io=uring|threads[,depth] picks how the --pipeline readers fetch files and how many reads each keeps in flight,
+    // --sparse[=S] prunes a fraction S of the layer 7 weight blocks (default: keep the model's zeros) and reports
+    // the sparse layer 7 against the dense model,
+    // --half=fp16|bf16 runs the model with 16 bit weights and reports its agreement with fp32,
+    // --eval-shards=S[,W] splits the evaluation into S shards run by W worker processes (default: one per core),
+    // --eval-launch=<command> starts the workers through a command prefix such as "ssh node1", round robin when
+    // repeated, --eval-timeout=T retries a shard that takes longer than T seconds (see sharded_eval.h),
+    // --autotune times the algorithms and blockings of every layer on this host and runs with the winners, saved to
+    // --tune-cache=<file> (default: lenet_tuning.txt), whose entry for this CPU is used on later runs without --conv
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--conv=direct") == 0) {
+            conv_algorithm = CONV_DIRECT;
+        } else if (strcmp(argv[i], "--conv=gemm") == 0) {
+            conv_algorithm = CONV_IM2COL_GEMM;
+        } else if (strcmp(argv[i], "--conv=fused") == 0) {
+            conv_algorithm = CONV_FUSED_GEMM;
+        } else if (strcmp(argv[i], "--conv=winograd") == 0) {
+            conv_algorithm = CONV_FUSED_WINOGRAD;
+        } else if (strcmp(argv[i], "--conv=nchwc") == 0) {
+            conv_algorithm = CONV_NCHWC;
+        } else if (strcmp(argv[i], "--conv=tuned") == 0) {
+            conv_algorithm = CONV_TUNED;
+        } else if (strcmp(argv[i], "--autotune") == 0) {
+            autotune_search = true;
+        } else if (strncmp(argv[i], "--tune-cache=", 13) == 0) {
+            tuning_cache = argv[i] + 13;
+        } else if (strcmp(argv[i], "--int8") == 0) {
+            calibrate_test_set = true;
+        } else if (strncmp(argv[i], "--int8=", 7) == 0) {
+            calibration_path = argv[i] + 7;
+        } else if (strcmp(argv[i], "--sparse") == 0) {
+            sparsity = 0;
+        } else if (strncmp(argv[i], "--sparse=", 9) == 0) {
+            sparsity = atof(argv[i] + 9);
+            if (sparsity < 0 || sparsity >= 1) {
+                fprintf(stderr, "Expected --sparse=<fraction of layer 7 blocks to prune, in [0, 1)>\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--half=fp16") == 0) {
+            half_format = HALF_FP16;
+        } else if (strcmp(argv[i], "--half=bf16") == 0) {
+            half_format = HALF_BF16;
+        } else if (strncmp(argv[i], "--model=", 8) == 0) {
+            param_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--data=", 7) == 0) {
+            images_path = argv[i] + 7;
+        } else if (strncmp(argv[i], "--shard=", 8) == 0) {
+            shard_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            socket_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--serve-config=", 15) == 0) {
+            if (sscanf(argv[i] + 15, "%d,%d,%d", &server_config.max_batch, &server_config.max_wait_us,
+                       &server_config.infer_threads) < 2 ||
+                server_config.max_batch < 1 || server_config.max_wait_us < 0 || server_config.infer_threads < 1) {
+                fprintf(stderr, "Expected --serve-config=max_batch,max_wait_us[,infer_threads]\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            batch_size = atoi(argv[i] + 8);
+            if (batch_size < 1) {
+                fprintf(stderr, "Batch size must be at least 1\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            char extra;
+            if (sscanf(argv[i] + 10, "%d%c", &num_threads, &extra) != 1 || num_threads < 0) {
+                fprintf(stderr, "Expected --threads=N with N >= 0 (0 = all cores)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            pipelined = true;
+        } else if (strncmp(argv[i], "--pipeline=", 11) == 0) {
+            pipelined = true;
+            if (sscanf(argv[i] + 11, "%d,%d,%d,%d", &pipeline_config.reader_threads, &pipeline_config.decoder_threads,
+                       &pipeline_config.infer_threads, &pipeline_config.queue_capacity) < 3 ||
+                pipeline_config.reader_threads < 1 || pipeline_config.decoder_threads < 1 || pipeline_config.infer_threads < 1 ||
+                pipeline_config.queue_capacity < 1) {
+                fprintf(stderr, "Expected --pipeline=readers,decoders,inferers[,queue_capacity]\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--io=", 5) == 0) {
+            const char* backend = argv[i] + 5;
+            const char* depth = strchr(backend, ',');
+            size_t length = (depth != NULL) ? (size_t)(depth - backend) : strlen(backend);
+            if (length == 5 && strncmp(backend, "uring", 5) == 0) {
+                pipeline_config.io_backend = FILE_READER_URING;
+            } else if (length == 7 && strncmp(backend, "threads", 7) == 0) {
+                pipeline_config.io_backend = FILE_READER_THREADS;
+            } else {
+                fprintf(stderr, "Expected --io=uring|threads[,depth]\n");
+                return 1;
+            }
+            if (depth != NULL && (pipeline_config.io_depth = atoi(depth + 1)) < 1) {
+                fprintf(stderr, "Expected --io=uring|threads[,depth]\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--eval-shards=", 14) == 0) {
+            int fields = sscanf(argv[i] + 14, "%d,%d", &eval_config.shards, &eval_config.workers);
+            if (fields < 1 || eval_config.shards < 1 || (fields == 2 && eval_config.workers < 1)) {
+                fprintf(stderr, "Expected --eval-shards=shards[,workers]\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--eval-launch=", 14) == 0) {
+            eval_config.launchers.push_back(argv[i] + 14);
+        } else if (strncmp(argv[i], "--eval-timeout=", 15) == 0) {
+            char extra;
+            if (sscanf(argv[i] + 15, "%d%c", &eval_config.timeout_s, &extra) != 1 || eval_config.timeout_s < 0) {
+                fprintf(stderr, "Expected --eval-timeout=seconds with seconds >= 0 (0 = no timeout)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--eval-worker") == 0) {
+            eval_worker = true;
+        } else if (strncmp(argv[i], "--isa=", 6) == 0 && !selectKernels(argv[i] + 6)) {
+            fprintf(stderr, "ISA %s is not supported on this CPU\n", argv[i] + 6);
+            return 1;
+        }
+    }
+    if (calibrate_test_set) {
+        calibration_path = images_path;
+    }
+
+    // The workers get the same arguments minus the coordinator's own, so they load the same model the same way.
+    // They don't autotune, timing on cores busy with each other, but use the plan cached for their host.
+    if (eval_config.shards > 0 && !eval_worker) {
+        if (eval_config.workers == 0) {
+            eval_config.workers = std::max(1, (int)std::thread::hardware_concurrency());
+        }
+        for (int i = 1; i < argc; i++) {
+            if (strncmp(argv[i], "--eval-", 7) != 0 && strcmp(argv[i], "--autotune") != 0) {
+                eval_config.worker_args.push_back(argv[i]);
+            }
+        }
+        eval_config.worker_args.push_back("--eval-worker");
+
+        EvalCounts counts;
+        EvalStats stats;
+        bool complete = runEvalCoordinator(eval_config, counts, stats);
+        printEvalCounts(counts, stats);
+        return complete ? 0 : 1;
+    }
+
+    // A worker's stdout is its connection to the coordinator, everything it prints goes to stderr
+    int protocol_fd = -1;
+    if (eval_worker) {
+        protocol_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    // Diagnostics go to stderr, stdout only carries the results scripts parse
+    fprintf(stderr, "Kernels = %s\n", activeKernels().isa);
+
+    // The plan cached for this CPU and ISA runs unless another algorithm is asked for, --autotune replaces it
+    std::string tuning_key = tuningKey();
+    TuningPlan plan;
+    bool cached = !autotune_search && loadTuning(tuning_cache, tuning_key, plan);
+    if (autotune_search || (cached && conv_algorithm < 0)) {
+        conv_algorithm = CONV_TUNED;
+    }
+
+    Engine* engine = loadEngine(param_path, conv_algorithm, cached ? &plan : NULL);
+    if (engine == NULL) {
+        return 1;
+    }
+    if (autotune_search) {
+        if (!autotune(*engine->params, engine->winograd_error <= WINOGRAD_TOLERANCE, plan)) {
+            freeEngine(engine);
+            return 1;
+        }
+        // An unwritable cache is reported, this run still uses the plan. The engine's plan is fixed once loaded,
+        // so the model is loaded again with the new one.
+        saveTuning(tuning_cache, tuning_key, plan);
+        freeEngine(engine);
+        engine = loadEngine(param_path, conv_algorithm, &plan);
+        if (engine == NULL) {
+            return 1;
+        }
+    }
+    if (engine->params->conv_algorithm == CONV_TUNED) {
+        fprintf(stderr, "Tuning = %s (%s %s)\n", formatTuningPlan(engine->params->tuning).c_str(),
+                autotune_search ? "saved to" : (cached ? "cached in" : "default, nothing cached in"), tuning_cache);
+    }
+    if (eval_worker) {
+        bool ok = runEvalWorker(STDIN_FILENO, protocol_fd, images_path, *engine->params);
+        freeEngine(engine);
+        return ok ? 0 : 1;
+    }
+    const Params& param = *engine->params;
+    if (engine->winograd_error > 0) {
+        fprintf(stderr, "Winograd Error = %g\n", engine->winograd_error);
+    }
+
+    if (socket_path != NULL) {
+        bool served = runServer(socket_path, *engine, server_config);
+        freeEngine(engine);
+        return served ? 0 : 1;
+    }
+
+    if (calibration_path != NULL) {
+        static QuantParams qparams;
+        QuantReport report;
+        quantizeWeights(param, qparams);
+        int calibrated = calibrateActivations(calibration_path, param, qparams, 0);
+        evaluateInt8(images_path, param, qparams, PADDING_1, report);
+
+        float fp32_accuracy = (float)report.fp32_correct / report.images * 100;
+        float int8_accuracy = (float)report.int8_correct / report.images * 100;
+        printf("Calibration Images = %d\n", calibrated);
+        printf("Total Images = %d\n", report.images);
+        printf("FP32 Accuracy = %f\n", fp32_accuracy);
+        printf("INT8 Accuracy = %f (drift %+f)\n", int8_accuracy, int8_accuracy - fp32_accuracy);
+        printf("Prediction Agreement = %f\n", (float)report.agreement / report.images * 100);
+
+        freeEngine(engine);
+        return 0;
+    }
+
+    if (sparsity >= 0) {
+        Params* pruned = allocateParams();
+        memcpy(pruned, &param, sizeof(Params));
+        static SparseFc sparse;
+        SparseReport report;
+        pruneWeights(*pruned, sparsity);
+        buildSparseFc(*pruned, sparse);
+        evaluateSparse(images_path, param, *pruned, sparse, PADDING_1, report);
+
+        float dense_accuracy = (float)report.dense_correct / report.images * 100;
+        float sparse_accuracy = (float)report.sparse_correct / report.images * 100;
+        printf("Total Images = %d\n", report.images);
+        printf("Layer 7 Weight Sparsity = %f (%f of the blocks)\n", report.weight_sparsity * 100, report.block_sparsity * 100);
+        printf("Layer 6 Activation Sparsity = %f\n", report.activation_sparsity * 100);
+        printf("Dense Accuracy = %f\n", dense_accuracy);
+        printf("Sparse Accuracy = %f (delta %+f)\n", sparse_accuracy, sparse_accuracy - dense_accuracy);
+        printf("Prediction Agreement = %f\n", (float)report.agreement / report.images * 100);
+        printf("Layer 7 Time = %.2f us dense, %.2f us sparse\n", report.dense_seconds / report.images * 1e6,
+               report.sparse_seconds / report.images * 1e6);
+
+        freeParams(pruned);
+        freeEngine(engine);
+        return 0;
+    }
+
+    if (half_format >= 0) {
+        static HalfParams hparams;
+        HalfReport report;
+        float weight_error = convertWeights(param, hparams, half_format);
+        evaluateHalf(images_path, param, hparams, PADDING_1, report);
+
+        float fp32_accuracy = (float)report.fp32_correct / report.images * 100;
+        float half_accuracy = (float)report.half_correct / report.images * 100;
+        printf("Total Images = %d\n", report.images);
+        printf("Weight Bytes = %zu fp32, %zu %s\n", report.fp32_bytes, report.half_bytes, halfFormatName(half_format));
+        printf("Max Weight Error = %g\n", weight_error);
+        printf("Max Logit Error = %g\n", report.max_logit_error);
+        printf("FP32 Accuracy = %f\n", fp32_accuracy);
+        printf("%s Accuracy = %f (drift %+f)\n", halfFormatName(half_format), half_accuracy, half_accuracy - fp32_accuracy);
+        printf("Prediction Agreement = %f\n", (float)report.agreement / report.images * 100);
+
+        freeEngine(engine);
+        return 0;
+    }
+
+    if (shard_path != NULL) {
+        if (!loadDatasetShard(shard_path, test_set_size, PADDING_1, param, true_positives, unlabelled, num_threads, batch_size)) {
+            freeEngine(engine);
+            return 1;
+        }
+    } else if (pipelined) {
+        PipelineStats stats;
+        loadDatasetPipelined(images_path, test_set_size, PADDING_1, param, true_positives, unlabelled, pipeline_config, &stats);
+        printPipelineStats(stats);
+    } else if (num_threads != 1) {
+        loadDatasetParallel(images_path, test_set_size, PADDING_1, param, true_positives, unlabelled, num_threads, batch_size);
+    } else if (batch_size > 1) {
+        ImageBatch batch;
+        allocateBatch(batch, batch_size);
+        loadDatasetBatched(images_path, batch, test_set_size, PADDING_1, param, image, true_positives, unlabelled);
+        freeBatch(batch);
+    } else {
+        loadDataset(images_path, inputImage, test_set_size, PADDING_1, param, image, true_positives, unlabelled);
+    }
 
     printf("Total Images = %d\n", test_set_size);
-    printf("Accuracy = %f\n", (float)true_positives / test_set_size * 100);
+    if (unlabelled > 0) {
+        printf("Unlabelled Images = %d\n", unlabelled);
+    }
+    // Same rule as printEvalCounts, images in no class folder have no right answer
+    int labelled = test_set_size - unlabelled;
+    printf("Accuracy = %f\n", (labelled > 0) ? (float)true_positives / labelled * 100 : 0.0f);
 
+    freeEngine(engine);
     return 0;
 }
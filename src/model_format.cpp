@@ -0,0 +1,226 @@
+#include "../include/model_format.h"
+#include "../include/autotune.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct ExpectedTensor {
+    const char* name;
+    uint32_t rank;
+    uint32_t dims[4];
+    size_t offset;
+    size_t bytes;
+} ExpectedTensor;
+
+#define PARAMS_TENSOR(field, rank, d0, d1, d2, d3)                                                                                 \
+    { #field, rank, {(uint32_t)(d0), (uint32_t)(d1), (uint32_t)(d2), (uint32_t)(d3)}, offsetof(Params, field), sizeof(Params::field) }
+
+// Every tensor of Params in file order, the loader insists on an exact match
+static const ExpectedTensor expected_tensors[] = {
+    PARAMS_TENSOR(weights1, 4, NUM_FILTERS_1, INPUT_FILTERS_1, KERNEL_SIZE_1, KERNEL_SIZE_1),
+    PARAMS_TENSOR(biases1, 1, NUM_FILTERS_1, 0, 0, 0),
+    PARAMS_TENSOR(weights2, 4, NUM_FILTERS_3, INPUT_FILTERS_3, KERNEL_SIZE_3, KERNEL_SIZE_3),
+    PARAMS_TENSOR(biases2, 1, NUM_FILTERS_3, 0, 0, 0),
+    PARAMS_TENSOR(weights3, 4, NUM_FILTERS_5, INPUT_FILTERS_5, KERNEL_SIZE_5, KERNEL_SIZE_5),
+    PARAMS_TENSOR(biases3, 1, NUM_FILTERS_5, 0, 0, 0),
+    PARAMS_TENSOR(weights4, 2, WEIGHT_ROWS_7, WEIGHT_COLS_7, 0, 0),
+    PARAMS_TENSOR(biases4, 1, NUM_FILTERS_7, 0, 0, 0),
+    PARAMS_TENSOR(weights5, 2, WEIGHT_ROWS_8, WEIGHT_COLS_8, 0, 0),
+    PARAMS_TENSOR(biases5, 1, NUM_FILTERS_8, 0, 0, 0),
+    PARAMS_TENSOR(weights6, 2, WEIGHT_ROWS_9, WEIGHT_COLS_9, 0, 0),
+    PARAMS_TENSOR(biases6, 1, NUM_FILTERS_9, 0, 0, 0),
+    PARAMS_TENSOR(packed1, 1, PACKED_WEIGHTS_SIZE(NUM_FILTERS_1, INPUT_FILTERS_1, KERNEL_SIZE_1), 0, 0, 0),
+    PARAMS_TENSOR(packed2, 1, PACKED_WEIGHTS_SIZE(NUM_FILTERS_3, INPUT_FILTERS_3, KERNEL_SIZE_3), 0, 0, 0),
+    PARAMS_TENSOR(packed3, 1, PACKED_WEIGHTS_SIZE(NUM_FILTERS_5, INPUT_FILTERS_5, KERNEL_SIZE_5), 0, 0, 0),
+    PARAMS_TENSOR(packed4, 1, PACKED_WEIGHTS_SIZE(WEIGHT_ROWS_7, WEIGHT_COLS_7, 1), 0, 0, 0),
+    PARAMS_TENSOR(packed5, 1, PACKED_WEIGHTS_SIZE(WEIGHT_ROWS_8, WEIGHT_COLS_8, 1), 0, 0, 0),
+    PARAMS_TENSOR(packed6, 1, PACKED_WEIGHTS_SIZE(WEIGHT_ROWS_9, WEIGHT_COLS_9, 1), 0, 0, 0),
+    PARAMS_TENSOR(winograd3, 1, WINOGRAD_WEIGHTS_SIZE(NUM_FILTERS_5, INPUT_FILTERS_5), 0, 0, 0),
+    PARAMS_TENSOR(blocked1, 1, BLOCKED_WEIGHTS_SIZE(NUM_FILTERS_1, INPUT_FILTERS_1, KERNEL_SIZE_1), 0, 0, 0),
+    PARAMS_TENSOR(blocked2, 1, BLOCKED_WEIGHTS_SIZE(NUM_FILTERS_3, INPUT_FILTERS_3, KERNEL_SIZE_3), 0, 0, 0),
+    PARAMS_TENSOR(blocked3, 1, BLOCKED_WEIGHTS_SIZE(NUM_FILTERS_5, INPUT_FILTERS_5, KERNEL_SIZE_5), 0, 0, 0),
+};
+
+#define EXPECTED_TENSOR_COUNT (sizeof(expected_tensors) / sizeof(expected_tensors[0]))
+
+static_assert(sizeof(ModelHeader) == 64, "ModelHeader must stay 64 bytes");
+static_assert(sizeof(TensorDesc) == 64, "TensorDesc must stay 64 bytes");
+static_assert(EXPECTED_TENSOR_COUNT <= MODEL_MAX_TENSORS, "Too many tensors for the header page");
+static_assert(sizeof(Params) % 8 == 0, "modelChecksum works on 8 byte words");
+
+static uint32_t headerSize() {
+    return ROUND_UP(sizeof(ModelHeader) + EXPECTED_TENSOR_COUNT * sizeof(TensorDesc), MODEL_PAGE_SIZE);
+}
+
+static void describeTensor(const ExpectedTensor& expected, TensorDesc& desc) {
+    memset(&desc, 0, sizeof(desc));
+    strncpy(desc.name, expected.name, sizeof(desc.name) - 1);
+    desc.rank = expected.rank;
+    memcpy(desc.dims, expected.dims, sizeof(desc.dims));
+    desc.offset = expected.offset;
+    desc.bytes = expected.bytes;
+}
+
+uint64_t modelChecksum(const void* data, size_t size) {
+    const uint64_t* words = (const uint64_t*)data;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size / 8; i++) {
+        hash ^= words[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool isBinaryModel(const char* path) {
+    char magic[8];
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, MODEL_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return binary;
+}
+
+size_t modelHeaderSize() {
+    return headerSize();
+}
+
+void writeModelHeader(const Params& params, void* header_page) {
+    memset(header_page, 0, headerSize());
+
+    ModelHeader* header = (ModelHeader*)header_page;
+    memcpy(header->magic, MODEL_MAGIC, sizeof(header->magic));
+    header->version = MODEL_VERSION;
+    header->dtype = MODEL_DTYPE_FP32;
+    header->tensor_count = EXPECTED_TENSOR_COUNT;
+    header->header_size = headerSize();
+    header->data_size = sizeof(Params);
+    header->checksum = modelChecksum(&params, sizeof(Params));
+    header->gemm_mr = GEMM_MR;
+    header->nchwc_block = NCHWC_BLOCK;
+    header->winograd_tile = WINOGRAD_TILE;
+
+    TensorDesc* table = (TensorDesc*)((char*)header_page + sizeof(ModelHeader));
+    for (size_t i = 0; i < EXPECTED_TENSOR_COUNT; i++) {
+        describeTensor(expected_tensors[i], table[i]);
+    }
+}
+
+bool saveModel(const char* path, const Params& params) {
+    uint32_t header_size = headerSize();
+    char* header_page = (char*)malloc(header_size);
+    writeModelHeader(params, header_page);
+
+    // Write a file of our own next to the target and rename over it, so a process mapping path never sees a half written
+    // model and a concurrent saveModel never writes into the same temporary file
+    std::string tmp_path = std::string(path) + ".tmp." + std::to_string((int)getpid());
+    FILE* file = fopen(tmp_path.c_str(), "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to create %s\n", tmp_path.c_str());
+        free(header_page);
+        return false;
+    }
+
+    bool ok = fwrite(header_page, 1, header_size, file) == header_size && fwrite(&params, 1, sizeof(Params), file) == sizeof(Params);
+    ok = (fclose(file) == 0) && ok;
+    free(header_page);
+
+    if (!ok || rename(tmp_path.c_str(), path) != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool validateModel(const char* path, const char* base, size_t size, bool verify_checksum) {
+    const ModelHeader* header = (const ModelHeader*)base;
+
+    if (size < sizeof(ModelHeader) || memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s is not a binary model\n", path);
+        return false;
+    }
+    if (header->version != MODEL_VERSION || header->dtype != MODEL_DTYPE_FP32) {
+        fprintf(stderr, "%s: unsupported model version %u / dtype %u\n", path, header->version, header->dtype);
+        return false;
+    }
+    if (header->tensor_count != EXPECTED_TENSOR_COUNT || header->header_size != headerSize() ||
+        header->data_size != sizeof(Params) || (uint64_t)header->header_size + header->data_size != size) {
+        fprintf(stderr, "%s: model layout does not match this build, regenerate it with convert_params\n", path);
+        return false;
+    }
+    if (header->gemm_mr != GEMM_MR || header->nchwc_block != NCHWC_BLOCK || header->winograd_tile != WINOGRAD_TILE) {
+        fprintf(stderr, "%s: packed for GEMM_MR %u, NCHWC_BLOCK %u, WINOGRAD_TILE %u, regenerate it with convert_params\n",
+                path, header->gemm_mr, header->nchwc_block, header->winograd_tile);
+        return false;
+    }
+
+    const TensorDesc* table = (const TensorDesc*)(base + sizeof(ModelHeader));
+    for (size_t i = 0; i < EXPECTED_TENSOR_COUNT; i++) {
+        TensorDesc expected;
+        describeTensor(expected_tensors[i], expected);
+        if (memcmp(&expected, &table[i], sizeof(TensorDesc)) != 0) {
+            fprintf(stderr, "%s: tensor %s does not match this build, regenerate it with convert_params\n", path,
+                    expected_tensors[i].name);
+            return false;
+        }
+    }
+
+    if (verify_checksum && modelChecksum(base + header->header_size, header->data_size) != header->checksum) {
+        fprintf(stderr, "%s: checksum mismatch\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool mapModelFd(int fd, const char* name, MappedModel& model, bool verify_checksum) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ModelHeader)) {
+        fprintf(stderr, "%s is not a binary model\n", name);
+        return false;
+    }
+
+    // Private and writable so the few non weight fields can be set without touching the file,
+    // the weight pages stay shared with the page cache or the shared memory object
+    size_t size = st.st_size;
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s\n", name);
+        return false;
+    }
+
+    if (!validateModel(name, (const char*)base, size, verify_checksum)) {
+        munmap(base, size);
+        return false;
+    }
+
+    model.base = base;
+    model.size = size;
+    model.params = (Params*)((char*)base + ((const ModelHeader*)base)->header_size);
+    model.params->conv_algorithm = CONV_NCHWC;
+    defaultTuningPlan(model.params->tuning);
+    return true;
+}
+
+bool mapModel(const char* path, MappedModel& model, bool verify_checksum) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    bool mapped = mapModelFd(fd, path, model, verify_checksum);
+    close(fd);
+    return mapped;
+}
+
+void unmapModel(MappedModel& model) {
+    if (model.base != NULL) {
+        munmap(model.base, model.size);
+    }
+    model.base = NULL;
+    model.size = 0;
+    model.params = NULL;
+}
@@ -0,0 +1,44 @@
+#include "../include/nchwc.h"
+
+void packBlockedWeights(const float* weights, float* blocked, int out_filters, int in_filters, int kernel_size, int in_block) {
+    int out_blocks = ROUND_UP(out_filters, NCHWC_BLOCK) / NCHWC_BLOCK;
+    int in_blocks = in_filters / in_block;
+    int k2 = kernel_size * kernel_size;
+
+    float* dst = blocked;
+    for (int ob = 0; ob < out_blocks; ob++) {
+        for (int ib = 0; ib < in_blocks; ib++) {
+            for (int k = 0; k < k2; k++) {
+                for (int ci = 0; ci < in_block; ci++) {
+                    int in_f = ib * in_block + ci;
+                    for (int o = 0; o < NCHWC_BLOCK; o++) {
+                        int out_f = ob * NCHWC_BLOCK + o;
+                        *dst++ = (out_f < out_filters) ? weights[(out_f * in_filters + in_f) * k2 + k] : 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void reorderToBlocked(const float* planes, float* blocked, int filters, int rows, int cols, int block) {
+    int pixels = rows * cols;
+    for (int f = 0; f < filters; f++) {
+        const float* src = planes + f * pixels;
+        float* dst = blocked + (f / block) * pixels * block + f % block;
+        for (int p = 0; p < pixels; p++) {
+            dst[p * block] = src[p];
+        }
+    }
+}
+
+void reorderFromBlocked(const float* blocked, float* planes, int filters, int rows, int cols, int block) {
+    int pixels = rows * cols;
+    for (int f = 0; f < filters; f++) {
+        const float* src = blocked + (f / block) * pixels * block + f % block;
+        float* dst = planes + f * pixels;
+        for (int p = 0; p < pixels; p++) {
+            dst[p] = src[p * block];
+        }
+    }
+}
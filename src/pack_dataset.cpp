@@ -0,0 +1,43 @@
+#include "../include/dataset_shard.h"
+
+// Packs a folder of class subfolders, or the images of a manifest, into a dataset shard for main --shard=<file>
+int main(int argc, char** argv) {
+    int dtype = SHARD_DTYPE_U8;
+    int num_threads = 0;
+    const char* paths[2];
+    int path_count = 0;
+
+    // --fp32 stores normalized floats instead of pixels (4x the size, nothing left to do on load),
+    // --threads=N decodes on N threads (0 = all cores)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fp32") == 0) {
+            dtype = SHARD_DTYPE_FP32;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            num_threads = atoi(argv[i] + 10);
+        } else if (argv[i][0] != '-' && path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            path_count = -1;
+            break;
+        }
+    }
+    if (path_count != 2) {
+        fprintf(stderr, "Usage: %s [--fp32] [--threads=N] <image folder|manifest> <shard file>\n", argv[0]);
+        return 1;
+    }
+
+    int packed = packDataset(paths[0], paths[1], dtype, num_threads);
+    if (packed < 0) {
+        return 1;
+    }
+
+    // Read it back through the same path the evaluation uses
+    MappedShard shard;
+    if (!mapShard(paths[1], shard, true)) {
+        return 1;
+    }
+    printf("Wrote %s (%d images, %zu bytes)\n", paths[1], packed, shard.size);
+    unmapShard(shard);
+
+    return 0;
+}
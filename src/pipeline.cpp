@@ -0,0 +1,329 @@
+#include "../include/pipeline.h"
+#include "../include/dataset_scan.h"
+#include "../include/jpeg_decoder.h"
+#include "../include/profile.h"
+#include "../include/sys_util.h"
+
+#include <thread>
+
+// A file read into one of its reader's buffers, which goes back to the reader once decoded
+typedef struct EncodedImage {
+    DatasetEntry entry;
+    const unsigned char* data;
+    size_t size;
+    FileReader* reader;
+    int buffer;
+} EncodedImage;
+
+typedef struct DecodedImage {
+    ImageData* slot;
+    int label;
+} DecodedImage;
+
+// Per-thread counters, merged into StageStats once the threads have joined
+typedef struct alignas(64) StageTimer {
+    long items;
+    long pops;
+    double busy;
+    double starved;
+    double blocked;
+    double depth_sum;
+    int correct_cases;
+    int unlabelled_cases;
+} StageTimer;
+
+typedef struct PipelineContext {
+    DatasetScan* scan;
+    std::atomic<int> readers_running;
+    std::atomic<int> decoders_running;
+    BoundedQueue<EncodedImage*>* encoded;
+    BoundedQueue<DecodedImage>* decoded;
+    BoundedQueue<ImageData*>* free_slots;
+    const Params* param;
+    int padding;
+} PipelineContext;
+
+template <typename T> static void pushBlocking(BoundedQueue<T>& queue, const T& value) {
+    while (!queue.tryPush(value)) {
+        std::this_thread::yield();
+    }
+}
+
+// Waits for the next item, returns false once the queue is drained and every upstream thread has finished
+template <typename T> static bool popInput(BoundedQueue<T>& queue, T& value, std::atomic<int>& upstream_running) {
+    for (;;) {
+        if (queue.tryPop(value)) {
+            return true;
+        }
+        if (upstream_running.load(std::memory_order_acquire) == 0) {
+            return queue.tryPop(value);
+        }
+        std::this_thread::yield();
+    }
+}
+
+static void readerStage(PipelineContext* ctx, FileReader* reader, StageTimer* timer) {
+    EncodedImage* next = NULL;
+    bool more = true;
+
+    for (;;) {
+        double t0 = now();
+
+        // Keep the reader full, it refuses once io_depth reads are in flight or every buffer waits to be decoded
+        while (more) {
+            if (next == NULL) {
+                next = new EncodedImage;
+                if (!nextDatasetEntry(*ctx->scan, next->entry)) {
+                    delete next;
+                    next = NULL;
+                    more = false;
+                    break;
+                }
+            }
+            if (!submitFileRead(*reader, next->entry.path.c_str(), next)) {
+                break;
+            }
+            next = NULL;
+        }
+
+        FileRead read;
+        if (!waitFileRead(*reader, read)) {
+            if (!more) {
+                break;
+            }
+            std::this_thread::yield();
+            timer->blocked += now() - t0;
+            continue;
+        }
+
+        double t1 = now();
+        EncodedImage* item = (EncodedImage*)read.user;
+        if (read.error != 0) {
+            fprintf(stderr, "Error: Could not read the image %s (%s)\n", item->entry.path.c_str(), strerror(read.error));
+            releaseFileRead(*reader, read.buffer);
+            delete item;
+            timer->busy += t1 - t0;
+            continue;
+        }
+        item->data = read.data;
+        item->size = read.size;
+        item->reader = reader;
+        item->buffer = read.buffer;
+
+        pushBlocking(*ctx->encoded, item);
+        timer->busy += t1 - t0;
+        timer->blocked += now() - t1;
+        timer->items++;
+    }
+
+    ctx->readers_running.fetch_sub(1, std::memory_order_release);
+}
+
+static void decoderStage(PipelineContext* ctx, StageTimer* timer) {
+    JpegDecoder* decoder = createJpegDecoder();
+    cv::Mat image;
+
+    for (;;) {
+        EncodedImage* item;
+        double t0 = now();
+        if (!popInput(*ctx->encoded, item, ctx->readers_running)) {
+            break;
+        }
+        timer->depth_sum += ctx->encoded->sizeApprox();
+        timer->pops++;
+
+        // Wait for a free ImageData, all of them being in flight means inference is behind
+        double t1 = now();
+        ImageData* slot;
+        while (!ctx->free_slots->tryPop(slot)) {
+            std::this_thread::yield();
+        }
+
+        double t2 = now();
+        bool readable;
+        {
+            PROFILE_SCOPE(PROFILE_DECODE);
+            readable = decodeImageBuffer(*decoder, item->data, item->size, INPUT_ROWS_1, INPUT_COLS_1, image);
+        }
+        releaseFileRead(*item->reader, item->buffer);
+        if (!readable) {
+            fprintf(stderr, "Error: Could not decode the image %s\n", item->entry.path.c_str());
+            pushBlocking(*ctx->free_slots, slot);
+            delete item;
+            timer->starved += t1 - t0;
+            timer->blocked += t2 - t1;
+            timer->busy += now() - t2;
+            continue;
+        }
+        preprocessMat(image, *slot, ctx->padding);
+
+        DecodedImage decoded = {slot, item->entry.label};
+        delete item;
+
+        double t3 = now();
+        pushBlocking(*ctx->decoded, decoded);
+        timer->starved += t1 - t0;
+        timer->blocked += (t2 - t1) + (now() - t3);
+        timer->busy += t3 - t2;
+        timer->items++;
+    }
+
+    freeJpegDecoder(decoder);
+    ctx->decoders_running.fetch_sub(1, std::memory_order_release);
+}
+
+static void inferStage(PipelineContext* ctx, StageTimer* timer) {
+    Workspace* workspace = allocateWorkspace();
+    for (;;) {
+        DecodedImage item;
+        double t0 = now();
+        if (!popInput(*ctx->decoded, item, ctx->decoders_running)) {
+            break;
+        }
+        timer->depth_sum += ctx->decoded->sizeApprox();
+        timer->pops++;
+
+        double t1 = now();
+        int res = forwardPass(*item.slot, *workspace, *ctx->param);
+        if (res == item.label) {
+            timer->correct_cases++;
+        } else if (item.label < 0) {
+            timer->unlabelled_cases++;
+        }
+        pushBlocking(*ctx->free_slots, item.slot);
+
+        timer->starved += t1 - t0;
+        timer->busy += now() - t1;
+        timer->items++;
+    }
+    freeWorkspace(workspace);
+}
+
+void defaultPipelineConfig(PipelineConfig& config) {
+    int cores = (int)std::thread::hardware_concurrency();
+    int workers = (cores > 3) ? cores - 1 : 2;
+
+    config.reader_threads = 1;
+    config.decoder_threads = workers / 2;
+    config.infer_threads = workers - workers / 2;
+    config.queue_capacity = 64;
+    config.io_depth = FILE_READER_DEPTH;
+    config.io_backend = FILE_READER_AUTO;
+}
+
+void loadDatasetPipelined(const char* folderPath, int& test_set_size, int padding, const Params& param, int& correct_cases,
+                          int& unlabelled_cases, const PipelineConfig& config, PipelineStats* stats) {
+    // Enough ImageData slots to fill the decoded queue while every decoder and inference thread holds one
+    int num_slots = config.queue_capacity + config.decoder_threads + config.infer_threads;
+    ImageData* slots = new ImageData[num_slots]();
+
+    BoundedQueue<EncodedImage*> encoded(config.queue_capacity);
+    BoundedQueue<DecodedImage> decoded(config.queue_capacity);
+    BoundedQueue<ImageData*> free_slots(num_slots);
+    for (int i = 0; i < num_slots; i++) {
+        free_slots.tryPush(&slots[i]);
+    }
+
+    PipelineContext ctx;
+    ctx.scan = startDatasetScan(folderPath, 0);
+    ctx.readers_running.store(config.reader_threads);
+    ctx.decoders_running.store(config.decoder_threads);
+    ctx.encoded = &encoded;
+    ctx.decoded = &decoded;
+    ctx.free_slots = &free_slots;
+    ctx.param = &param;
+    ctx.padding = padding;
+
+    // Besides the reads in flight, read buffers wait in the encoded queue and sit in the decoders
+    std::vector<FileReader*> readers(config.reader_threads);
+    int buffers = config.io_depth + config.queue_capacity + config.decoder_threads;
+    for (int r = 0; r < config.reader_threads; r++) {
+        readers[r] = createFileReader(config.io_depth, buffers, FILE_READER_BUFFER_BYTES, config.io_backend);
+        if (readers[r] == NULL) {
+            fprintf(stderr, "%s is not available, reading with threads\n", fileReaderBackendName(config.io_backend));
+            readers[r] = createFileReader(config.io_depth, buffers, FILE_READER_BUFFER_BYTES, FILE_READER_THREADS);
+        }
+    }
+
+    int stage_threads[PIPELINE_STAGES] = {config.reader_threads, config.decoder_threads, config.infer_threads};
+    int total_threads = stage_threads[0] + stage_threads[1] + stage_threads[2];
+    std::vector<StageTimer> timers(total_threads);
+    memset(timers.data(), 0, total_threads * sizeof(StageTimer));
+
+    // The stages already saturate the cores, keep OpenCV from spawning its own threads on top
+    int cv_threads = cv::getNumThreads();
+    cv::setNumThreads(1);
+
+    double start = now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < total_threads; t++) {
+        if (t < stage_threads[0]) {
+            threads.push_back(std::thread(readerStage, &ctx, readers[t], &timers[t]));
+        } else if (t < stage_threads[0] + stage_threads[1]) {
+            threads.push_back(std::thread(decoderStage, &ctx, &timers[t]));
+        } else {
+            threads.push_back(std::thread(inferStage, &ctx, &timers[t]));
+        }
+    }
+    for (int t = 0; t < total_threads; t++) {
+        threads[t].join();
+    }
+    double wall = now() - start;
+    finishDatasetScan(ctx.scan, NULL);
+    int io_backend = fileReaderBackend(*readers[0]);
+    for (int r = 0; r < config.reader_threads; r++) {
+        freeFileReader(readers[r]);
+    }
+
+    cv::setNumThreads(cv_threads);
+
+    const char* names[PIPELINE_STAGES] = {"read", "decode", "infer"};
+    int t = 0;
+    for (int s = 0; s < PIPELINE_STAGES; s++) {
+        StageStats stage = {names[s], stage_threads[s], 0, 0, 0, 0, 0};
+        long pops = 0;
+        double depth_sum = 0;
+        for (int i = 0; i < stage_threads[s]; i++, t++) {
+            stage.items += timers[t].items;
+            stage.busy_seconds += timers[t].busy;
+            stage.starved_seconds += timers[t].starved;
+            stage.blocked_seconds += timers[t].blocked;
+            pops += timers[t].pops;
+            depth_sum += timers[t].depth_sum;
+
+            // Only the inference stage scores images
+            if (s == PIPELINE_STAGES - 1) {
+                correct_cases += timers[t].correct_cases;
+                unlabelled_cases += timers[t].unlabelled_cases;
+                test_set_size += timers[t].items;
+            }
+        }
+        stage.input_depth = (pops > 0) ? depth_sum / pops : 0;
+
+        if (stats != NULL) {
+            stats->stages[s] = stage;
+        }
+    }
+    if (stats != NULL) {
+        stats->wall_seconds = wall;
+        stats->io_backend = io_backend;
+    }
+
+    delete[] slots;
+}
+
+void printPipelineStats(const PipelineStats& stats) {
+    fprintf(stderr, "%-8s %8s %8s %8s %9s %9s %12s\n", "Stage", "Threads", "Items", "Busy%", "Starved%", "Blocked%", "Queue depth");
+    for (int s = 0; s < PIPELINE_STAGES; s++) {
+        const StageStats& stage = stats.stages[s];
+        double capacity = stage.threads * stats.wall_seconds;
+        if (capacity <= 0) {
+            capacity = 1;
+        }
+        fprintf(stderr, "%-8s %8d %8ld %8.1f %9.1f %9.1f %12.1f\n", stage.name, stage.threads, stage.items,
+                100 * stage.busy_seconds / capacity, 100 * stage.starved_seconds / capacity, 100 * stage.blocked_seconds / capacity,
+                stage.input_depth);
+    }
+    fprintf(stderr, "Read backend = %s\n", fileReaderBackendName(stats.io_backend));
+    fprintf(stderr, "Wall time = %.3f s\n", stats.wall_seconds);
+}
@@ -0,0 +1,199 @@
+#include "../include/profile.h"
+
+#ifdef CNN_PROFILE
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static const char* const stage_names[PROFILE_STAGES] = {
+    "decode",
+    "resize",
+    "normalize",
+    "forwardPass",
+    "forwardBatch",
+    "forwardPassInt8",
+    "forwardPassHalf",
+    "layer_1_conv",
+    "layer_2_max_pool",
+    "layer_3_conv",
+    "layer_4_max_pool",
+    "layer_5_conv",
+    "layer_6_max_pool_flatten",
+    "layer_1_2_conv_pool",
+    "layer_3_4_conv_pool",
+    "layer_5_6_conv_pool_flatten",
+    "layer_7_fc",
+    "layer_7_fc_sparse",
+    "layer_8_fc",
+    "layer_9_fc",
+    "fc_batch",
+};
+
+// Totals of one stage on one thread. Only the owning thread writes them, the relaxed atomics let
+// profileReport read them while that thread is still running.
+typedef struct ProfileTotals {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> nanoseconds;
+    std::atomic<uint64_t> instructions;
+    std::atomic<uint64_t> cache_misses;
+} ProfileTotals;
+
+// One per thread that ever entered a PROFILE_SCOPE, never freed so the totals of exited threads are reported
+typedef struct ProfileSlab {
+    ProfileTotals totals[PROFILE_STAGES];
+    ProfileSlab* next;
+} ProfileSlab;
+
+// Lock-free list of every slab, threads push theirs on first use
+static std::atomic<ProfileSlab*> slabs(NULL);
+static std::atomic<bool> report_registered(false);
+static std::atomic<int> perf_errno(0); // first perf_event_open failure, 0 if none
+
+// perf_event group of the calling thread: instructions (leader) and cache misses, closed at thread exit
+typedef struct ThreadProfile {
+    ProfileSlab* slab;
+    int perf_fd;
+
+    ~ThreadProfile() {
+        if (perf_fd >= 0) {
+            close(perf_fd);
+        }
+    }
+} ThreadProfile;
+
+static thread_local ThreadProfile thread_profile = {NULL, -1};
+
+static int openCounter(uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void openCounters(ThreadProfile& profile) {
+    int leader = openCounter(PERF_COUNT_HW_INSTRUCTIONS, -1);
+    int misses = (leader >= 0) ? openCounter(PERF_COUNT_HW_CACHE_MISSES, leader) : -1;
+    if (misses < 0) {
+        int expected = 0;
+        perf_errno.compare_exchange_strong(expected, errno);
+        if (leader >= 0) {
+            close(leader);
+        }
+        return;
+    }
+    // The group is read and closed through the leader only
+    profile.perf_fd = leader;
+}
+
+static ThreadProfile& threadProfile() {
+    ThreadProfile& profile = thread_profile;
+    if (profile.slab != NULL) {
+        return profile;
+    }
+
+    profile.slab = new ProfileSlab();
+    ProfileSlab* head = slabs.load(std::memory_order_relaxed);
+    do {
+        profile.slab->next = head;
+    } while (!slabs.compare_exchange_weak(head, profile.slab, std::memory_order_release, std::memory_order_relaxed));
+
+    if (!report_registered.exchange(true)) {
+        atexit(profileReport);
+    }
+    openCounters(profile);
+    return profile;
+}
+
+void profileRead(ProfileSample& sample) {
+    ThreadProfile& profile = threadProfile();
+
+    // Counter values: nr, instructions, cache misses
+    uint64_t values[3] = {0, 0, 0};
+    if (profile.perf_fd >= 0 && read(profile.perf_fd, values, sizeof(values)) != (ssize_t)sizeof(values)) {
+        values[1] = values[2] = 0;
+    }
+    sample.instructions = values[1];
+    sample.cache_misses = values[2];
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sample.nanoseconds = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#if defined(__x86_64__) || defined(__i386__)
+    sample.cycles = __rdtsc();
+#else
+    sample.cycles = 0;
+#endif
+}
+
+static void add(std::atomic<uint64_t>& total, uint64_t value) {
+    // Single writer, so a plain load + store instead of a locked add
+    total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void profileRecord(int stage, const ProfileSample& start) {
+    ProfileSample end;
+    profileRead(end);
+
+    ProfileTotals& totals = threadProfile().slab->totals[stage];
+    add(totals.calls, 1);
+    add(totals.cycles, end.cycles - start.cycles);
+    add(totals.nanoseconds, end.nanoseconds - start.nanoseconds);
+    add(totals.instructions, end.instructions - start.instructions);
+    add(totals.cache_misses, end.cache_misses - start.cache_misses);
+}
+
+void profileReport() {
+    uint64_t calls[PROFILE_STAGES] = {0}, cycles[PROFILE_STAGES] = {0}, nanoseconds[PROFILE_STAGES] = {0};
+    uint64_t instructions[PROFILE_STAGES] = {0}, cache_misses[PROFILE_STAGES] = {0};
+    int threads = 0;
+
+    for (ProfileSlab* slab = slabs.load(std::memory_order_acquire); slab != NULL; slab = slab->next) {
+        for (int s = 0; s < PROFILE_STAGES; s++) {
+            calls[s] += slab->totals[s].calls.load(std::memory_order_relaxed);
+            cycles[s] += slab->totals[s].cycles.load(std::memory_order_relaxed);
+            nanoseconds[s] += slab->totals[s].nanoseconds.load(std::memory_order_relaxed);
+            instructions[s] += slab->totals[s].instructions.load(std::memory_order_relaxed);
+            cache_misses[s] += slab->totals[s].cache_misses.load(std::memory_order_relaxed);
+        }
+        threads++;
+    }
+
+    int error = perf_errno.load();
+    fprintf(stderr, "\nProfile = %d threads, perf counters %s%s\n", threads, error ? "unavailable: " : "on",
+            error ? strerror(error) : "");
+    fprintf(stderr, "%-28s %10s %12s %12s %14s %14s %12s\n", "stage", "calls", "total_ms", "avg_us", "avg_cycles",
+            "avg_instr", "avg_misses");
+    for (int s = 0; s < PROFILE_STAGES; s++) {
+        if (calls[s] == 0) {
+            continue;
+        }
+        double n = (double)calls[s];
+        fprintf(stderr, "%-28s %10llu %12.3f %12.3f %14.0f ", stage_names[s], (unsigned long long)calls[s],
+                nanoseconds[s] * 1e-6, nanoseconds[s] * 1e-3 / n, cycles[s] / n);
+        if (error) {
+            fprintf(stderr, "%14s %12s\n", "-", "-");
+        } else {
+            fprintf(stderr, "%14.0f %12.1f\n", instructions[s] / n, cache_misses[s] / n);
+        }
+    }
+}
+
+#endif // CNN_PROFILE
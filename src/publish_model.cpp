@@ -0,0 +1,47 @@
+#include "../include/engine.h"
+
+// Publishes a model into shared memory for main --model=shm:<name> and other engines on this host, or removes it
+int main(int argc, char** argv) {
+    bool remove = false;
+    const char* paths[2];
+    int path_count = 0;
+
+    // --remove unpublishes <name>, processes attached to it keep their weights until they detach
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--remove") == 0) {
+            remove = true;
+        } else if (argv[i][0] != '-' && path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            path_count = -1;
+            break;
+        }
+    }
+    if (path_count != (remove ? 1 : 2)) {
+        fprintf(stderr, "Usage: %s <parameters.txt|model.bin> <name>\n       %s --remove <name>\n", argv[0], argv[0]);
+        return 1;
+    }
+    if (remove) {
+        return unpublishSharedModel(paths[0]) ? 0 : 1;
+    }
+
+    Engine* engine = loadEngine(paths[0], -1, NULL);
+    if (engine == NULL) {
+        return 1;
+    }
+    uint64_t generation = publishSharedModel(paths[1], *engine->params);
+    freeEngine(engine);
+    if (generation == 0) {
+        return 1;
+    }
+
+    // Attach through the same path the workers use
+    SharedModel shared;
+    if (!attachSharedModel(paths[1], shared, true)) {
+        return 1;
+    }
+    printf("Published %s generation %llu (%zu bytes)\n", paths[1], (unsigned long long)shared.generation, shared.model.size);
+    detachSharedModel(shared);
+
+    return 0;
+}
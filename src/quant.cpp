@@ -0,0 +1,220 @@
+#include "../include/profile.h"
+#include "../include/quant.h"
+#include "../include/simd.h"
+
+#include <math.h>
+
+// The INT8 path has no im2col, so the quantized layer input and the gathered receptive field live in col_buffer
+#define QUANT_INPUT_SIZE (INPUT_FILTERS_1 * (INPUT_ROWS_1 + 2 * PADDING_1) * (INPUT_COLS_1 + 2 * PADDING_1))
+static_assert(QUANT_INPUT_SIZE + INPUT_COLS_7 <= COL_BUFFER_SIZE * sizeof(float), "col_buffer too small for INT8 scratch");
+static_assert(PADDING_2 == 0 && PADDING_4 == 0 && PADDING_6 == 0, "convInt8 writes unpadded outputs");
+
+static float maxAbs(const float* values, int n) {
+    float max_val = 0;
+    for (int i = 0; i < n; i++) {
+        float v = fabsf(values[i]);
+        if (v > max_val) {
+            max_val = v;
+        }
+    }
+    return max_val;
+}
+
+// Symmetric scale mapping [-max_val, max_val] onto [-127, 127]
+static float symmetricScale(float max_val) {
+    return (max_val > 0) ? max_val / 127 : 1;
+}
+
+static void quantize(const float* values, int8_t* out, int n, float scale) {
+    float inv_scale = 1 / scale;
+    for (int i = 0; i < n; i++) {
+        long q = lrintf(values[i] * inv_scale);
+        out[i] = (int8_t)((q > 127) ? 127 : (q < -127) ? -127 : q);
+    }
+}
+
+// Quantizes each row of a [rows][cols] matrix with its own scale
+static void quantizeRows(const float* weights, int8_t* out, float* scales, int rows, int cols) {
+    for (int r = 0; r < rows; r++) {
+        scales[r] = symmetricScale(maxAbs(weights + r * cols, cols));
+        quantize(weights + r * cols, out + r * cols, cols, scales[r]);
+    }
+}
+
+void quantizeWeights(const Params& param, QuantParams& qparams) {
+    quantizeRows(&param.weights1[0][0][0][0], &qparams.weights1[0][0], qparams.weight_scales1, NUM_FILTERS_1,
+                 INPUT_FILTERS_1 * KERNEL_SIZE_1 * KERNEL_SIZE_1);
+    quantizeRows(&param.weights2[0][0][0][0], &qparams.weights2[0][0], qparams.weight_scales2, NUM_FILTERS_3,
+                 INPUT_FILTERS_3 * KERNEL_SIZE_3 * KERNEL_SIZE_3);
+    quantizeRows(&param.weights3[0][0][0][0], &qparams.weights3[0][0], qparams.weight_scales3, NUM_FILTERS_5,
+                 INPUT_FILTERS_5 * KERNEL_SIZE_5 * KERNEL_SIZE_5);
+    quantizeRows(&param.weights4[0][0], &qparams.weights4[0][0], qparams.weight_scales4, WEIGHT_ROWS_7, WEIGHT_COLS_7);
+    quantizeRows(&param.weights5[0][0], &qparams.weights5[0][0], qparams.weight_scales5, WEIGHT_ROWS_8, WEIGHT_COLS_8);
+    quantizeRows(&param.weights6[0][0], &qparams.weights6[0][0], qparams.weight_scales6, WEIGHT_ROWS_9, WEIGHT_COLS_9);
+
+    for (int l = 0; l < QUANT_LAYERS; l++) {
+        qparams.input_scales[l] = 1;
+    }
+}
+
+int calibrateActivations(const char* folderPath, const Params& param, QuantParams& qparams, int max_images) {
+    std::vector<DatasetEntry> entries;
+    listDataset(folderPath, entries);
+
+    ImageData* imageData = new ImageData();
+    Workspace* workspace = allocateWorkspace();
+    cv::Mat image;
+    float max_val[QUANT_LAYERS] = {0};
+    int used = 0;
+
+    for (size_t i = 0; i < entries.size() && (max_images <= 0 || used < max_images); i++) {
+        if (!preprocessImage(entries[i].path.c_str(), *imageData, image, PADDING_1)) {
+            fprintf(stderr, "Error: Could not read the image %s\n", entries[i].path.c_str());
+            continue;
+        }
+        forwardPass(*imageData, *workspace, param);
+
+        // Layer inputs are kept intact by forwardPass, so they can be inspected afterwards
+        const float* inputs[QUANT_LAYERS] = {&imageData->image[0][0][0], &workspace->layer_2[0][0][0],
+                                             &workspace->layer_4[0][0][0], imageData->layer_6,
+                                             imageData->layer_7, imageData->layer_8};
+        const int sizes[QUANT_LAYERS] = {(int)(sizeof(imageData->image) / sizeof(float)),
+                                         (int)(sizeof(workspace->layer_2) / sizeof(float)),
+                                         (int)(sizeof(workspace->layer_4) / sizeof(float)),
+                                         INPUT_COLS_7, INPUT_COLS_8, INPUT_COLS_9};
+        for (int l = 0; l < QUANT_LAYERS; l++) {
+            float m = maxAbs(inputs[l], sizes[l]);
+            if (m > max_val[l]) {
+                max_val[l] = m;
+            }
+        }
+        used++;
+    }
+
+    for (int l = 0; l < QUANT_LAYERS; l++) {
+        qparams.input_scales[l] = symmetricScale(max_val[l]);
+    }
+
+    delete imageData;
+    freeWorkspace(workspace);
+    return used;
+}
+
+static void convInt8(const int8_t* input, int in_filters, int in_height, int in_width, const int8_t* weights,
+                     const float* weight_scales, float input_scale, const float* biases, int out_filters, int kernel_size,
+                     int stride, float* output, int out_height, int out_width, int out_pitch_rows, int out_pitch_cols,
+                     int8_t* column) {
+    const KernelTable& kernels = activeKernels();
+    int K = in_filters * kernel_size * kernel_size;
+
+    for (int row = 0; row < out_height; row++) {
+        for (int col = 0; col < out_width; col++) {
+
+            // Gather the receptive field once, every filter then reads it from L1
+            int k = 0;
+            for (int in_f = 0; in_f < in_filters; in_f++) {
+                for (int i = 0; i < kernel_size; i++) {
+                    const int8_t* src = input + (in_f * in_height + stride * row + i) * in_width + stride * col;
+                    for (int j = 0; j < kernel_size; j++) {
+                        column[k++] = src[j];
+                    }
+                }
+            }
+
+            for (int out_f = 0; out_f < out_filters; out_f++) {
+                int32_t acc = kernels.dot_s8(weights + out_f * K, column, K);
+                float val = acc * input_scale * weight_scales[out_f] + biases[out_f];
+                output[(out_f * out_pitch_rows + row) * out_pitch_cols + col] = relu(val);
+            }
+        }
+    }
+}
+
+static void fcInt8(const int8_t* input, const int8_t* weights, const float* weight_scales, float input_scale, const float* biases,
+                   float* output, int rows, int cols, bool apply_relu) {
+    const KernelTable& kernels = activeKernels();
+    for (int n = 0; n < rows; n++) {
+        float val = kernels.dot_s8(weights + n * cols, input, cols) * input_scale * weight_scales[n] + biases[n];
+        output[n] = apply_relu ? relu(val) : val;
+    }
+}
+
+int forwardPassInt8(ImageData& inputData, Workspace& workspace, const Params& param, const QuantParams& qparams) {
+    PROFILE_SCOPE(PROFILE_FORWARD_INT8);
+    int8_t* qinput = (int8_t*)workspace.col_buffer;
+    int8_t* column = qinput + QUANT_INPUT_SIZE;
+
+    quantize(&inputData.image[0][0][0], qinput, sizeof(inputData.image) / sizeof(float), qparams.input_scales[0]);
+    convInt8(qinput, INPUT_FILTERS_1, INPUT_ROWS_1 + 2 * PADDING_1, INPUT_COLS_1 + 2 * PADDING_1, &qparams.weights1[0][0],
+             qparams.weight_scales1, qparams.input_scales[0], param.biases1, NUM_FILTERS_1, KERNEL_SIZE_1, STRIDE_1,
+             &workspace.layer_1[0][0][0], INPUT_ROWS_2, INPUT_COLS_2, INPUT_ROWS_2 + 2 * PADDING_2,
+             INPUT_COLS_2 + 2 * PADDING_2, column);
+    inputData.height = INPUT_ROWS_2 + 2 * PADDING_2;
+    inputData.width = INPUT_COLS_2 + 2 * PADDING_2;
+    inputData.filters = NUM_FILTERS_1;
+    layer_2_max_pool(inputData, workspace);
+
+    quantize(&workspace.layer_2[0][0][0], qinput, sizeof(workspace.layer_2) / sizeof(float), qparams.input_scales[1]);
+    convInt8(qinput, INPUT_FILTERS_3, INPUT_ROWS_3 + 2 * PADDING_3, INPUT_COLS_3 + 2 * PADDING_3, &qparams.weights2[0][0],
+             qparams.weight_scales2, qparams.input_scales[1], param.biases2, NUM_FILTERS_3, KERNEL_SIZE_3, STRIDE_3,
+             &workspace.layer_3[0][0][0], INPUT_ROWS_4, INPUT_COLS_4, INPUT_ROWS_4 + 2 * PADDING_4,
+             INPUT_COLS_4 + 2 * PADDING_4, column);
+    inputData.height = INPUT_ROWS_4 + 2 * PADDING_4;
+    inputData.width = INPUT_COLS_4 + 2 * PADDING_4;
+    inputData.filters = NUM_FILTERS_3;
+    layer_4_max_pool(inputData, workspace);
+
+    quantize(&workspace.layer_4[0][0][0], qinput, sizeof(workspace.layer_4) / sizeof(float), qparams.input_scales[2]);
+    convInt8(qinput, INPUT_FILTERS_5, INPUT_ROWS_5 + 2 * PADDING_5, INPUT_COLS_5 + 2 * PADDING_5, &qparams.weights3[0][0],
+             qparams.weight_scales3, qparams.input_scales[2], param.biases3, NUM_FILTERS_5, KERNEL_SIZE_5, STRIDE_5,
+             &workspace.layer_5[0][0][0], INPUT_ROWS_6, INPUT_COLS_6, INPUT_ROWS_6 + 2 * PADDING_6,
+             INPUT_COLS_6 + 2 * PADDING_6, column);
+    inputData.height = INPUT_ROWS_6 + 2 * PADDING_6;
+    inputData.width = INPUT_COLS_6 + 2 * PADDING_6;
+    inputData.filters = NUM_FILTERS_5;
+    layer_6_max_pool_flatten(inputData, workspace);
+
+    quantize(inputData.layer_6, qinput, INPUT_COLS_7, qparams.input_scales[3]);
+    fcInt8(qinput, &qparams.weights4[0][0], qparams.weight_scales4, qparams.input_scales[3], param.biases4, inputData.layer_7,
+           WEIGHT_ROWS_7, WEIGHT_COLS_7, true);
+    quantize(inputData.layer_7, qinput, INPUT_COLS_8, qparams.input_scales[4]);
+    fcInt8(qinput, &qparams.weights5[0][0], qparams.weight_scales5, qparams.input_scales[4], param.biases5, inputData.layer_8,
+           WEIGHT_ROWS_8, WEIGHT_COLS_8, true);
+    quantize(inputData.layer_8, qinput, INPUT_COLS_9, qparams.input_scales[5]);
+    fcInt8(qinput, &qparams.weights6[0][0], qparams.weight_scales6, qparams.input_scales[5], param.biases6, inputData.layer_9,
+           WEIGHT_ROWS_9, WEIGHT_COLS_9, false);
+
+    return predictedClass(inputData.layer_9);
+}
+
+void evaluateInt8(const char* folderPath, const Params& param, const QuantParams& qparams, int padding, QuantReport& report) {
+    std::vector<DatasetEntry> entries;
+    listDataset(folderPath, entries);
+
+    ImageData* imageData = new ImageData();
+    Workspace* workspace = allocateWorkspace();
+    cv::Mat image;
+    memset(&report, 0, sizeof(report));
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!preprocessImage(entries[i].path.c_str(), *imageData, image, padding)) {
+            fprintf(stderr, "Error: Could not read the image %s\n", entries[i].path.c_str());
+            continue;
+        }
+        int fp32 = forwardPass(*imageData, *workspace, param);
+
+        // forwardPass leaves the input intact but walks the shape down to the last layer
+        imageData->height = INPUT_ROWS_1 + 2 * padding;
+        imageData->width = INPUT_COLS_1 + 2 * padding;
+        imageData->filters = INPUT_FILTERS_1;
+        int int8 = forwardPassInt8(*imageData, *workspace, param, qparams);
+
+        report.images++;
+        report.fp32_correct += (fp32 == entries[i].label);
+        report.int8_correct += (int8 == entries[i].label);
+        report.agreement += (fp32 == int8);
+    }
+
+    delete imageData;
+    freeWorkspace(workspace);
+}
@@ -0,0 +1,417 @@
+#include "../include/server.h"
+#include "../include/jpeg_decoder.h"
+#include "../include/sys_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// The server sleeps on condition variables rather than spinning like the pipeline queues, it is idle most of the time
+
+// A request handed from its connection thread to the inference threads, lives on the connection thread's stack
+typedef struct PendingRequest {
+    const ImageData* image; // preprocessed input
+    ServerResponse* response;
+    std::chrono::steady_clock::time_point arrival;
+    bool done;
+} PendingRequest;
+
+// The engine batches run on, replaced when the shared model it is attached to is published again
+typedef struct ServedModel {
+    const Engine* engine;
+    Engine* reloaded; // owned by the server, NULL for the engine runServer was given
+    int batches;      // running on it
+} ServedModel;
+
+typedef struct ServerState {
+    ServedModel* model;
+    ServerConfig config;
+    std::mutex mutex;
+    std::condition_variable queued;   // a request was queued, or stopping was set
+    std::condition_variable finished; // a batch was answered
+    std::condition_variable closed;   // a connection thread exited
+    std::deque<PendingRequest*> queue;
+    std::vector<int> clients; // sockets of the open connections
+    bool stopping;
+    long requests;
+    long batches;
+    int reloads;
+} ServerState;
+
+// Written by the SIGINT / SIGTERM handler to wake the accept loop
+static int stop_pipe[2] = {-1, -1};
+
+static void requestStop(int) {
+    int saved_errno = errno;
+    if (write(stop_pipe[1], "x", 1) < 0) {
+        // Nothing else can be done from a signal handler, a full pipe already holds a wake-up
+    }
+    errno = saved_errno;
+}
+
+// Frees a model once it is neither current nor running a batch, call with the mutex held
+static void retireModel(ServerState* state, ServedModel* model) {
+    if (model == state->model || model->batches > 0) {
+        return;
+    }
+    freeEngine(model->reloaded);
+    delete model;
+}
+
+void defaultServerConfig(ServerConfig& config) {
+    int cores = (int)std::thread::hardware_concurrency();
+    config.max_batch = 16;
+    config.max_wait_us = 2000;
+    config.infer_threads = (cores >= 8) ? cores / 4 : 1;
+}
+
+static void inferThread(ServerState* state) {
+    int max_batch = state->config.max_batch;
+    ImageBatch batch;
+    allocateBatch(batch, max_batch);
+    int* predictions = new int[max_batch];
+    PendingRequest** taken = new PendingRequest*[max_batch];
+
+    for (;;) {
+        int count = 0;
+        ServedModel* model = NULL;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            while (state->queue.empty() && !state->stopping) {
+                state->queued.wait(lock);
+            }
+            if (state->queue.empty()) {
+                break; // stopping and drained
+            }
+
+            // The oldest request sets the deadline, more may arrive until then
+            std::chrono::steady_clock::time_point deadline =
+                state->queue.front()->arrival + std::chrono::microseconds(state->config.max_wait_us);
+            while ((int)state->queue.size() < max_batch && !state->stopping) {
+                if (state->queued.wait_until(lock, deadline) == std::cv_status::timeout) {
+                    break;
+                }
+            }
+
+            // Another inference thread may have taken them while this one waited
+            while (count < max_batch && !state->queue.empty()) {
+                taken[count++] = state->queue.front();
+                state->queue.pop_front();
+            }
+            if (count > 0) {
+                model = state->model;
+                model->batches++;
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        batch.size = count;
+        for (int b = 0; b < count; b++) {
+            memcpy(batch.images[b].image, taken[b]->image->image, sizeof(batch.images[b].image));
+            batch.images[b].filters = taken[b]->image->filters;
+            batch.images[b].height = taken[b]->image->height;
+            batch.images[b].width = taken[b]->image->width;
+        }
+        forwardBatch(batch, *model->engine->params, predictions);
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            model->batches--;
+            retireModel(state, model);
+            for (int b = 0; b < count; b++) {
+                ServerResponse* response = taken[b]->response;
+                response->status = SERVER_OK;
+                response->prediction = predictions[b];
+                memcpy(response->scores, batch.images[b].layer_9, sizeof(response->scores));
+                taken[b]->done = true;
+            }
+            state->requests += count;
+            state->batches++;
+        }
+        state->finished.notify_all();
+    }
+
+    delete[] taken;
+    delete[] predictions;
+    freeBatch(batch);
+}
+
+// Queues image for the inference threads and waits for its answer
+static void submit(ServerState* state, const ImageData* image, ServerResponse& response) {
+    PendingRequest pending = {image, &response, std::chrono::steady_clock::now(), false};
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (state->stopping) {
+        response.status = SERVER_SHUTTING_DOWN;
+        return;
+    }
+    state->queue.push_back(&pending);
+    state->queued.notify_all();
+    while (!pending.done) {
+        state->finished.wait(lock);
+    }
+}
+
+// Decodes or copies the payload into imageData, returns the ServerStatus to answer with if it can't
+static int prepareImage(const ServerRequest& request, const std::vector<uchar>& payload, ImageData& imageData, cv::Mat& image) {
+    if (request.type == SERVER_REQUEST_ENCODED) {
+        if (!decodeImageBuffer(threadJpegDecoder(), payload.data(), payload.size(), INPUT_ROWS_1, INPUT_COLS_1, image)) {
+            return SERVER_BAD_IMAGE;
+        }
+        preprocessMat(image, imageData, PADDING_1);
+        return SERVER_OK;
+    }
+
+    if (request.type == SERVER_REQUEST_TENSOR && request.size == sizeof(float) * INPUT_FILTERS_1 * INPUT_ROWS_1 * INPUT_COLS_1) {
+        tensorImage((const float*)payload.data(), imageData, PADDING_1);
+        return SERVER_OK;
+    }
+    return SERVER_BAD_REQUEST;
+}
+
+static void connectionThread(ServerState* state, int fd) {
+    ImageData* imageData = new ImageData();
+    std::vector<uchar> payload;
+    cv::Mat image;
+
+    for (;;) {
+        ServerRequest request;
+        if (!readFully(fd, &request, sizeof(request))) {
+            break;
+        }
+
+        ServerResponse response;
+        memset(&response, 0, sizeof(response));
+        response.magic = SERVER_RESPONSE_MAGIC;
+        response.prediction = -1;
+
+        // Past a bad header there is no telling where the next request starts, answer and hang up
+        if (request.magic != SERVER_REQUEST_MAGIC || request.size > SERVER_MAX_PAYLOAD) {
+            response.status = SERVER_BAD_REQUEST;
+            writeFully(fd, &response, sizeof(response));
+            break;
+        }
+
+        payload.resize(request.size);
+        if (!readFully(fd, payload.data(), request.size)) {
+            break;
+        }
+
+        response.status = prepareImage(request, payload, *imageData, image);
+        if (response.status == SERVER_OK) {
+            submit(state, imageData, response);
+        }
+        if (!writeFully(fd, &response, sizeof(response))) {
+            break;
+        }
+    }
+
+    delete imageData;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (size_t i = 0; i < state->clients.size(); i++) {
+        if (state->clients[i] == fd) {
+            state->clients.erase(state->clients.begin() + i);
+            break;
+        }
+    }
+    close(fd);
+    state->closed.notify_all();
+}
+
+// Binds socketPath, replacing a stale socket file but never one a running server still listens on
+static int listenSocket(const char* socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socketPath);
+        return -1;
+    }
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+
+    int running = connectServer(socketPath);
+    if (running >= 0) {
+        fprintf(stderr, "A server is already listening on %s\n", socketPath);
+        close(running);
+        return -1;
+    }
+    unlink(socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", socketPath, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// Swaps in a new engine if the current one's shared model was published again, called from the accept loop only
+static void reloadModel(ServerState* state) {
+    const Engine* current = state->model->engine;
+    if (!engineOutdated(*current)) {
+        return;
+    }
+    Engine* engine = reloadEngine(*current);
+    if (engine == NULL) {
+        return; // keep serving the old weights, the next check tries again
+    }
+
+    ServedModel* model = new ServedModel();
+    model->engine = engine;
+    model->reloaded = engine;
+    model->batches = 0;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    ServedModel* previous = state->model;
+    state->model = model;
+    state->reloads++;
+    retireModel(state, previous);
+    fprintf(stderr, "Reloaded %s generation %llu\n", engine->shared.name, (unsigned long long)engine->shared.generation);
+}
+
+bool runServer(const char* socketPath, const Engine& engine, const ServerConfig& config) {
+    if (pipe2(stop_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        fprintf(stderr, "Failed to create the stop pipe\n");
+        return false;
+    }
+    int listen_fd = listenSocket(socketPath);
+    if (listen_fd < 0) {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        return false;
+    }
+
+    // No SA_RESTART: blocked reads see EINTR and retry, the accept loop wakes up on the pipe
+    struct sigaction action, old_int, old_term;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+
+    // Connection threads preprocess in parallel, keep OpenCV from spawning its own threads on top
+    int cv_threads = cv::getNumThreads();
+    cv::setNumThreads(1);
+
+    ServerState state;
+    state.model = new ServedModel();
+    state.model->engine = &engine;
+    state.model->reloaded = NULL;
+    state.model->batches = 0;
+    state.config = config;
+    state.stopping = false;
+    state.requests = 0;
+    state.batches = 0;
+    state.reloads = 0;
+
+    std::vector<std::thread> inferers;
+    for (int t = 0; t < config.infer_threads; t++) {
+        inferers.push_back(std::thread(inferThread, &state));
+    }
+    fprintf(stderr, "Serving on %s (batches of up to %d, %d us wait, %d inference threads)\n", socketPath, config.max_batch,
+            config.max_wait_us, config.infer_threads);
+
+    // Only a shared model can change under the server, otherwise poll has nothing to time out for
+    int poll_timeout = (engine.shared.control != NULL) ? SERVER_RELOAD_CHECK_MS : -1;
+    struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+    for (;;) {
+        int ready = poll(fds, 2, poll_timeout);
+        if (ready < 0 && errno != EINTR) {
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            break;
+        }
+        if (poll_timeout >= 0) {
+            reloadModel(&state);
+        }
+        if (ready <= 0 || !(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.clients.push_back(client);
+        std::thread(connectionThread, &state, client).detach();
+    }
+
+    close(listen_fd);
+    unlink(socketPath);
+
+    // Queued requests are still answered, then idle connections are woken from their reads and drained
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.stopping = true;
+        state.queued.notify_all();
+        for (size_t i = 0; i < state.clients.size(); i++) {
+            shutdown(state.clients[i], SHUT_RDWR);
+        }
+        while (!state.clients.empty()) {
+            state.closed.wait(lock);
+        }
+    }
+    for (size_t t = 0; t < inferers.size(); t++) {
+        inferers[t].join();
+    }
+
+    fprintf(stderr, "Served %ld requests in %ld batches (%.2f per batch)\n", state.requests, state.batches,
+            state.batches ? (double)state.requests / state.batches : 0.0);
+    if (state.reloads > 0) {
+        fprintf(stderr, "Reloaded the model %d times\n", state.reloads);
+    }
+    freeEngine(state.model->reloaded);
+    delete state.model;
+
+    cv::setNumThreads(cv_threads);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    return true;
+}
+
+int connectServer(const char* socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool classifyRemote(int fd, uint32_t type, const void* payload, uint32_t size, ServerResponse& response) {
+    ServerRequest request = {SERVER_REQUEST_MAGIC, type, size, 0};
+    return writeFully(fd, &request, sizeof(request)) && writeFully(fd, payload, size) &&
+           readFully(fd, &response, sizeof(response)) && response.magic == SERVER_RESPONSE_MAGIC;
+}
@@ -0,0 +1,414 @@
+#include "../include/sharded_eval.h"
+#include "../include/dataset_scan.h"
+#include "../include/sys_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <deque>
+
+// How often the coordinator wakes up to check the shard timeouts
+#define EVAL_TIMEOUT_CHECK_MS 1000
+
+int imageShard(const char* relativePath, int shard_count) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char* c = (const unsigned char*)relativePath; *c != 0; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return (int)(hash % (uint64_t)shard_count);
+}
+
+//-----WORKER-----//
+
+// The folder a dataset's paths are below: the folder itself, or the folder holding a manifest
+static std::string datasetRoot(const char* folderPath) {
+    std::string root(folderPath);
+    while (root.size() > 1 && root[root.size() - 1] == '/') {
+        root.erase(root.size() - 1);
+    }
+    struct stat st;
+    if (stat(root.c_str(), &st) == 0 && !S_ISDIR(st.st_mode)) {
+        size_t slash = root.rfind('/');
+        root = (slash == std::string::npos) ? std::string() : root.substr(0, slash);
+    }
+    return root;
+}
+
+// path below root, or all of path if it isn't below it
+static const char* relativePath(const std::string& path, const std::string& root) {
+    if (!root.empty() && path.size() > root.size() && path.compare(0, root.size(), root) == 0 && path[root.size()] == '/') {
+        return path.c_str() + root.size() + 1;
+    }
+    return path.c_str();
+}
+
+static void evaluateShard(const char* folderPath, const std::string& root, const EvalRequest& request, const Params& param,
+                          ImageData& imageData, Workspace& workspace, cv::Mat& image, EvalResult& result) {
+    memset(&result, 0, sizeof(result));
+    result.magic = EVAL_RESULT_MAGIC;
+    result.shard = request.shard;
+
+    DatasetScan* scan = startDatasetScan(folderPath, 0);
+    DatasetEntry entry;
+    while (nextDatasetEntry(*scan, entry)) {
+        if (imageShard(relativePath(entry.path, root), request.shard_count) != (int)request.shard) {
+            continue;
+        }
+        if (!preprocessImage(entry.path.c_str(), imageData, image, PADDING_1)) {
+            fprintf(stderr, "Error: Could not read the image %s\n", entry.path.c_str());
+            result.unreadable++;
+            continue;
+        }
+
+        int prediction = forwardPass(imageData, workspace, param);
+        result.images++;
+        if (entry.label < 0) {
+            result.unlabelled++;
+        } else {
+            result.confusion[entry.label][prediction]++;
+        }
+    }
+
+    // A folder that couldn't be read may have held images of this shard, let another attempt try
+    ScanStats stats;
+    finishDatasetScan(scan, &stats);
+    if (stats.errors > 0 || stats.directories == 0) {
+        result.status = EIO;
+    }
+}
+
+bool runEvalWorker(int in_fd, int out_fd, const char* folderPath, const Params& param) {
+    std::string root = datasetRoot(folderPath);
+    ImageData* imageData = new ImageData();
+    Workspace* workspace = allocateWorkspace();
+    cv::Mat image;
+    EvalRequest request;
+    EvalResult result;
+    bool ok = true;
+
+    while (readFully(in_fd, &request, sizeof(request))) {
+        if (request.magic != EVAL_REQUEST_MAGIC ||
+            (request.shard != EVAL_SHUTDOWN && (request.shard_count == 0 || request.shard >= request.shard_count))) {
+            fprintf(stderr, "Malformed evaluation request\n");
+            ok = false;
+            break;
+        }
+        if (request.shard == EVAL_SHUTDOWN) {
+            break;
+        }
+
+        evaluateShard(folderPath, root, request, param, *imageData, *workspace, image, result);
+        if (!writeFully(out_fd, &result, sizeof(result))) {
+            ok = false;
+            break;
+        }
+    }
+
+    delete imageData;
+    freeWorkspace(workspace);
+    return ok;
+}
+
+//-----COORDINATOR-----//
+
+typedef struct WorkerProcess {
+    pid_t pid;
+    int fd;          // coordinator end of the worker's stdin / stdout, -1 once the worker is gone
+    int shard;       // being evaluated, -1 if idle
+    double started;  // when shard was sent
+    size_t received; // bytes of result read so far
+    EvalResult result;
+} WorkerProcess;
+
+typedef struct Coordinator {
+    const EvalConfig* config;
+    std::string program; // this executable, the workers run it too
+    std::vector<WorkerProcess> workers;
+    std::deque<int> pending;   // shards waiting for a worker
+    std::vector<int> attempts; // failed attempts per shard
+    int finished;              // shards merged or given up
+    EvalCounts* counts;
+    EvalStats* stats;
+} Coordinator;
+
+// Quoted for /bin/sh, only needed when a launcher command line is built
+static std::string shellQuote(const std::string& arg) {
+    std::string quoted = "'";
+    for (size_t i = 0; i < arg.size(); i++) {
+        quoted += (arg[i] == '\'') ? std::string("'\\''") : std::string(1, arg[i]);
+    }
+    return quoted + "'";
+}
+
+static bool startWorker(Coordinator& coordinator, WorkerProcess& worker) {
+    const EvalConfig& config = *coordinator.config;
+
+    // Everything the child needs is built before fork, it only execs
+    std::vector<std::string> args;
+    if (config.launchers.empty()) {
+        args.push_back(coordinator.program);
+        args.insert(args.end(), config.worker_args.begin(), config.worker_args.end());
+    } else {
+        std::string command = config.launchers[coordinator.stats->workers_started % config.launchers.size()];
+        command += " " + shellQuote(coordinator.program);
+        for (size_t i = 0; i < config.worker_args.size(); i++) {
+            command += " " + shellQuote(config.worker_args[i]);
+        }
+        args.push_back("/bin/sh");
+        args.push_back("-c");
+        args.push_back(command);
+    }
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++) {
+        argv.push_back((char*)args[i].c_str());
+    }
+    argv.push_back(NULL);
+
+    // CLOEXEC keeps every worker from holding the sockets of the others, which would hide their exits
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        fprintf(stderr, "Failed to create a worker socket: %s\n", strerror(errno));
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        fprintf(stderr, "Failed to start a worker: %s\n", strerror(errno));
+        close(fds[0]);
+        return false;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    worker.pid = pid;
+    worker.fd = fds[0];
+    worker.shard = -1;
+    worker.received = 0;
+    coordinator.stats->workers_started++;
+    return true;
+}
+
+static void failShard(Coordinator& coordinator, int shard) {
+    coordinator.stats->retries++;
+    if (++coordinator.attempts[shard] < coordinator.config->max_attempts) {
+        coordinator.pending.push_back(shard);
+        return;
+    }
+    fprintf(stderr, "Shard %d failed %d times, leaving it out\n", shard, coordinator.attempts[shard]);
+    coordinator.stats->failed++;
+    coordinator.finished++;
+}
+
+// Kills a worker that exited, broke the protocol or timed out, its shard goes back in the queue
+static void failWorker(Coordinator& coordinator, WorkerProcess& worker, const char* reason) {
+    fprintf(stderr, "Evaluation worker %d %s\n", (int)worker.pid, reason);
+    close(worker.fd);
+    kill(worker.pid, SIGKILL);
+    waitpid(worker.pid, NULL, 0);
+    worker.fd = -1;
+    if (worker.shard >= 0) {
+        failShard(coordinator, worker.shard);
+    }
+    worker.shard = -1;
+}
+
+static void assignShard(Coordinator& coordinator, WorkerProcess& worker) {
+    worker.shard = coordinator.pending.front();
+    coordinator.pending.pop_front();
+    worker.started = now();
+    worker.received = 0;
+
+    // 16 bytes always fit an idle worker's socket buffer, MSG_NOSIGNAL turns a dead worker into an error return
+    EvalRequest request = {EVAL_REQUEST_MAGIC, (uint32_t)worker.shard, (uint32_t)coordinator.config->shards, 0};
+    if (send(worker.fd, &request, sizeof(request), MSG_NOSIGNAL) != (ssize_t)sizeof(request)) {
+        failWorker(coordinator, worker, "hung up");
+    }
+}
+
+static void mergeResult(EvalCounts& counts, const EvalResult& result) {
+    counts.images += result.images;
+    counts.unlabelled += result.unlabelled;
+    counts.unreadable += result.unreadable;
+    for (int label = 0; label < TOTAL_CLASSES; label++) {
+        for (int prediction = 0; prediction < TOTAL_CLASSES; prediction++) {
+            counts.confusion[label][prediction] += result.confusion[label][prediction];
+        }
+    }
+}
+
+static void readResult(Coordinator& coordinator, WorkerProcess& worker) {
+    ssize_t n = read(worker.fd, (char*)&worker.result + worker.received, sizeof(EvalResult) - worker.received);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0) {
+        failWorker(coordinator, worker, "exited");
+        return;
+    }
+    worker.received += n;
+    if (worker.received < sizeof(EvalResult)) {
+        return;
+    }
+
+    const EvalResult& result = worker.result;
+    if (result.magic != EVAL_RESULT_MAGIC || result.shard != (uint32_t)worker.shard) {
+        failWorker(coordinator, worker, "sent a malformed result");
+        return;
+    }
+    int shard = worker.shard;
+    worker.shard = -1;
+    if (result.status != 0) {
+        fprintf(stderr, "Shard %d: %s\n", shard, strerror(result.status));
+        failShard(coordinator, shard);
+        return;
+    }
+    mergeResult(*coordinator.counts, result);
+    coordinator.finished++;
+}
+
+bool runEvalCoordinator(const EvalConfig& config, EvalCounts& counts, EvalStats& stats) {
+    memset(&counts, 0, sizeof(counts));
+    memset(&stats, 0, sizeof(stats));
+    stats.shards = config.shards;
+
+    char program[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", program, sizeof(program) - 1);
+    if (length <= 0) {
+        fprintf(stderr, "Could not find this executable to start the workers\n");
+        return false;
+    }
+    program[length] = 0;
+
+    Coordinator coordinator;
+    coordinator.config = &config;
+    coordinator.program = program;
+    coordinator.workers.resize((config.workers < config.shards) ? config.workers : config.shards);
+    coordinator.attempts.assign(config.shards, 0);
+    coordinator.finished = 0;
+    coordinator.counts = &counts;
+    coordinator.stats = &stats;
+    for (int s = 0; s < config.shards; s++) {
+        coordinator.pending.push_back(s);
+    }
+    for (size_t w = 0; w < coordinator.workers.size(); w++) {
+        coordinator.workers[w].fd = -1;
+        coordinator.workers[w].shard = -1;
+    }
+
+    bool started = true;
+    std::vector<struct pollfd> fds;
+    std::vector<WorkerProcess*> polled;
+    while (started && coordinator.finished < config.shards) {
+        fds.clear();
+        polled.clear();
+        for (size_t w = 0; w < coordinator.workers.size(); w++) {
+            WorkerProcess& worker = coordinator.workers[w];
+
+            // A worker that failed is replaced as long as there are shards for it, a shard waits for a worker
+            if (worker.fd < 0 && !coordinator.pending.empty() && !(started = startWorker(coordinator, worker))) {
+                break;
+            }
+            if (worker.fd >= 0 && worker.shard < 0 && !coordinator.pending.empty()) {
+                assignShard(coordinator, worker);
+            }
+            if (worker.shard >= 0 && config.timeout_s > 0 && now() - worker.started > config.timeout_s) {
+                failWorker(coordinator, worker, "timed out");
+            }
+            if (worker.shard >= 0) {
+                struct pollfd fd = {worker.fd, POLLIN, 0};
+                fds.push_back(fd);
+                polled.push_back(&worker);
+            }
+        }
+        if (!started || fds.empty()) {
+            continue;
+        }
+
+        if (poll(fds.data(), fds.size(), (config.timeout_s > 0) ? EVAL_TIMEOUT_CHECK_MS : -1) < 0 && errno != EINTR) {
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            break;
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (fds[i].revents != 0) {
+                readResult(coordinator, *polled[i]);
+            }
+        }
+    }
+
+    // Idle workers exit on EVAL_SHUTDOWN, one still running a shard (coordinator gave up) is killed
+    for (size_t w = 0; w < coordinator.workers.size(); w++) {
+        WorkerProcess& worker = coordinator.workers[w];
+        if (worker.fd < 0) {
+            continue;
+        }
+        if (worker.shard >= 0) {
+            kill(worker.pid, SIGKILL);
+        } else {
+            EvalRequest request = {EVAL_REQUEST_MAGIC, EVAL_SHUTDOWN, (uint32_t)config.shards, 0};
+            send(worker.fd, &request, sizeof(request), MSG_NOSIGNAL);
+        }
+        close(worker.fd);
+        waitpid(worker.pid, NULL, 0);
+    }
+    return coordinator.finished == config.shards && stats.failed == 0;
+}
+
+void printEvalCounts(const EvalCounts& counts, const EvalStats& stats) {
+    long correct = 0;
+    for (int c = 0; c < TOTAL_CLASSES; c++) {
+        correct += counts.confusion[c][c];
+    }
+
+    printf("Shards = %d (%d workers started, %d failed attempts, %d shards missing)\n", stats.shards, stats.workers_started,
+           stats.retries, stats.failed);
+    printf("Total Images = %ld\n", counts.images);
+    if (counts.unreadable > 0) {
+        printf("Unreadable Images = %ld\n", counts.unreadable);
+    }
+    if (counts.unlabelled > 0) {
+        printf("Unlabelled Images = %ld\n", counts.unlabelled);
+    }
+    // Images in no class folder have no right answer, so they are left out of the accuracy
+    long labelled = counts.images - counts.unlabelled;
+    printf("Accuracy = %f\n", (labelled > 0) ? (float)correct / labelled * 100 : 0.0f);
+
+    printf("%-20s %8s %8s %9s\n", "Class", "Images", "Correct", "Accuracy");
+    for (int c = 0; c < TOTAL_CLASSES; c++) {
+        long images = 0;
+        for (int p = 0; p < TOTAL_CLASSES; p++) {
+            images += counts.confusion[c][p];
+        }
+        printf("%d %-18s %8ld %8ld %9.2f\n", c, monkey_classes[c], images, counts.confusion[c][c],
+               images ? (double)counts.confusion[c][c] / images * 100 : 0.0);
+    }
+    if (counts.unlabelled > 0) {
+        printf("%-20s %8ld %8d %9.2f\n", "(no class)", counts.unlabelled, 0, 0.0);
+    }
+
+    printf("Confusion matrix (rows: class, columns: prediction)\n");
+    printf("%-20s", "");
+    for (int p = 0; p < TOTAL_CLASSES; p++) {
+        printf(" %5d", p);
+    }
+    printf("\n");
+    for (int c = 0; c < TOTAL_CLASSES; c++) {
+        printf("%d %-18s", c, monkey_classes[c]);
+        for (int p = 0; p < TOTAL_CLASSES; p++) {
+            printf(" %5ld", counts.confusion[c][p]);
+        }
+        printf("\n");
+    }
+}
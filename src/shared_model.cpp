@@ -0,0 +1,205 @@
+#include "../include/shared_model.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A publish racing an attach can unlink the image between reading the generation and opening it
+#define SHARED_MODEL_ATTACH_RETRIES 8
+#define SHARED_MODEL_OBJECT_LENGTH (SHARED_MODEL_NAME_LENGTH + 32)
+
+static_assert(sizeof(SharedModelControl) == 64, "SharedModelControl must stay 64 bytes");
+
+static bool validName(const char* name) {
+    size_t length = strlen(name);
+    if (length == 0 || length >= SHARED_MODEL_NAME_LENGTH || name[0] == '.') {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_' && name[i] != '.') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void controlObject(const char* name, char* object) {
+    snprintf(object, SHARED_MODEL_OBJECT_LENGTH, "/%s", name);
+}
+
+static void imageObject(const char* name, uint64_t generation, char* object) {
+    snprintf(object, SHARED_MODEL_OBJECT_LENGTH, "/%s.%llu", name, (unsigned long long)generation);
+}
+
+// Creates the image object and fills it with the binary model of params, read-only once written
+static bool writeImage(const char* object, const Params& params) {
+    int fd = shm_open(object, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create shared memory %s: %s\n", object, strerror(errno));
+        return false;
+    }
+
+    // posix_fallocate rather than ftruncate: a full /dev/shm fails here instead of SIGBUS on the first write
+    size_t header_size = modelHeaderSize();
+    size_t size = header_size + sizeof(Params);
+    void* base = MAP_FAILED;
+    bool ok = posix_fallocate(fd, 0, size) == 0 &&
+              (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED;
+    if (ok) {
+        writeModelHeader(params, base);
+        memcpy((char*)base + header_size, &params, sizeof(Params));
+        munmap(base, size);
+        ok = fchmod(fd, 0444) == 0;
+    }
+    close(fd);
+
+    if (!ok) {
+        fprintf(stderr, "Failed to write shared memory %s\n", object);
+        shm_unlink(object);
+    }
+    return ok;
+}
+
+uint64_t publishSharedModel(const char* name, const Params& params) {
+    if (!validName(name)) {
+        fprintf(stderr, "Invalid shared model name %s\n", name);
+        return 0;
+    }
+    char control_name[SHARED_MODEL_OBJECT_LENGTH];
+    controlObject(name, control_name);
+    int control_fd = shm_open(control_name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (control_fd < 0) {
+        fprintf(stderr, "Failed to open shared memory %s: %s\n", control_name, strerror(errno));
+        return 0;
+    }
+
+    // Held until the new generation is visible, a second publisher waits here. A new control object is zero
+    // filled by ftruncate, generation 0
+    void* mapping = MAP_FAILED;
+    if (flock(control_fd, LOCK_EX) != 0 || ftruncate(control_fd, sizeof(SharedModelControl)) != 0 ||
+        (mapping = mmap(NULL, sizeof(SharedModelControl), PROT_READ | PROT_WRITE, MAP_SHARED, control_fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "Failed to set up shared memory %s: %s\n", control_name, strerror(errno));
+        close(control_fd);
+        return 0;
+    }
+    SharedModelControl* control = (SharedModelControl*)mapping;
+    memcpy(control->magic, SHARED_MODEL_MAGIC, sizeof(control->magic));
+
+    uint64_t previous = __atomic_load_n(&control->generation, __ATOMIC_ACQUIRE);
+    uint64_t generation = previous + 1;
+    char image[SHARED_MODEL_OBJECT_LENGTH];
+    imageObject(name, generation, image);
+
+    // Left behind by a publisher that died before bumping the generation
+    shm_unlink(image);
+
+    uint64_t published = 0;
+    if (writeImage(image, params)) {
+        __atomic_store_n(&control->generation, generation, __ATOMIC_RELEASE);
+        if (previous > 0) {
+            imageObject(name, previous, image);
+            shm_unlink(image);
+        }
+        published = generation;
+    }
+
+    munmap(mapping, sizeof(SharedModelControl));
+    close(control_fd);
+    return published;
+}
+
+bool unpublishSharedModel(const char* name) {
+    if (!validName(name)) {
+        fprintf(stderr, "Invalid shared model name %s\n", name);
+        return false;
+    }
+    char control_name[SHARED_MODEL_OBJECT_LENGTH];
+    controlObject(name, control_name);
+    int control_fd = shm_open(control_name, O_RDWR | O_CLOEXEC, 0);
+    if (control_fd < 0) {
+        fprintf(stderr, "No model is published as %s\n", name);
+        return false;
+    }
+
+    SharedModelControl control;
+    memset(&control, 0, sizeof(control));
+    if (flock(control_fd, LOCK_EX) == 0 && pread(control_fd, &control, sizeof(control), 0) == (ssize_t)sizeof(control) &&
+        control.generation > 0) {
+        char image[SHARED_MODEL_OBJECT_LENGTH];
+        imageObject(name, control.generation, image);
+        shm_unlink(image);
+    }
+    shm_unlink(control_name);
+    close(control_fd);
+    return true;
+}
+
+bool attachSharedModel(const char* name, SharedModel& shared, bool verify_checksum) {
+    memset(&shared, 0, sizeof(shared));
+    if (!validName(name)) {
+        fprintf(stderr, "Invalid shared model name %s\n", name);
+        return false;
+    }
+    strncpy(shared.name, name, sizeof(shared.name) - 1);
+
+    char control_name[SHARED_MODEL_OBJECT_LENGTH];
+    controlObject(name, control_name);
+    int control_fd = shm_open(control_name, O_RDONLY | O_CLOEXEC, 0);
+    if (control_fd < 0) {
+        fprintf(stderr, "No model is published as %s\n", name);
+        return false;
+    }
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (fstat(control_fd, &st) == 0 && st.st_size >= (off_t)sizeof(SharedModelControl)) {
+        mapping = mmap(NULL, sizeof(SharedModelControl), PROT_READ, MAP_SHARED, control_fd, 0);
+    }
+    close(control_fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "%s is not a shared model\n", name);
+        return false;
+    }
+    shared.control = (const SharedModelControl*)mapping;
+
+    for (int attempt = 0; attempt < SHARED_MODEL_ATTACH_RETRIES; attempt++) {
+        uint64_t generation = __atomic_load_n(&shared.control->generation, __ATOMIC_ACQUIRE);
+        if (generation == 0 || memcmp(shared.control->magic, SHARED_MODEL_MAGIC, sizeof(shared.control->magic)) != 0) {
+            break;
+        }
+
+        char image[SHARED_MODEL_OBJECT_LENGTH];
+        imageObject(name, generation, image);
+        int fd = shm_open(image, O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0) {
+            continue; // replaced since the generation was read
+        }
+        bool mapped = mapModelFd(fd, image, shared.model, verify_checksum);
+        close(fd);
+        if (!mapped) {
+            break;
+        }
+        shared.generation = generation;
+        return true;
+    }
+
+    fprintf(stderr, "Could not attach to the shared model %s\n", name);
+    detachSharedModel(shared);
+    return false;
+}
+
+bool sharedModelChanged(const SharedModel& shared) {
+    return shared.control != NULL && __atomic_load_n(&shared.control->generation, __ATOMIC_ACQUIRE) != shared.generation;
+}
+
+void detachSharedModel(SharedModel& shared) {
+    unmapModel(shared.model);
+    if (shared.control != NULL) {
+        munmap((void*)shared.control, sizeof(SharedModelControl));
+    }
+    shared.control = NULL;
+    shared.generation = 0;
+}
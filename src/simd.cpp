@@ -0,0 +1,58 @@
+#include "../include/simd.h"
+
+#include <string.h>
+
+static bool isaSupported(const KernelTable* table) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (strcmp(table->isa, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f");
+    }
+    if (strcmp(table->isa, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    }
+    if (strcmp(table->isa, "sse4.2") == 0) {
+        return __builtin_cpu_supports("sse4.2");
+    }
+#endif
+    return table == &scalar_kernels;
+}
+
+// Candidates from widest to narrowest
+static const KernelTable* const candidates[] = {
+#ifdef CNN_HAVE_AVX512
+    &avx512_kernels,
+#endif
+#ifdef CNN_HAVE_AVX2
+    &avx2_kernels,
+#endif
+#ifdef CNN_HAVE_SSE42
+    &sse42_kernels,
+#endif
+    &scalar_kernels,
+};
+
+static const KernelTable* detectKernels() {
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if (isaSupported(candidates[i])) {
+            return candidates[i];
+        }
+    }
+    return &scalar_kernels;
+}
+
+static const KernelTable* active_kernels = detectKernels();
+
+const KernelTable& activeKernels() {
+    return *active_kernels;
+}
+
+bool selectKernels(const char* isa) {
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if (strcmp(candidates[i]->isa, isa) == 0 && isaSupported(candidates[i])) {
+            active_kernels = candidates[i];
+            return true;
+        }
+    }
+    return false;
+}
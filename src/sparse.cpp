@@ -0,0 +1,144 @@
+#include "../include/sparse.h"
+#include "../include/gemm.h"
+#include "../include/layers.h"
+#include "../include/profile.h"
+#include "../include/sys_util.h"
+
+#include <algorithm>
+
+static float blockNorm(const Params& param, int block, int input) {
+    float sum = 0;
+    for (int r = 0; r < SPARSE_BLOCK; r++) {
+        float w = param.weights4[block * SPARSE_BLOCK + r][input];
+        sum += w * w;
+    }
+    return sum;
+}
+
+float weightSparsity(const Params& param) {
+    const float* weights = &param.weights4[0][0];
+    long zeros = 0;
+    for (int i = 0; i < WEIGHT_ROWS_7 * WEIGHT_COLS_7; i++) {
+        zeros += (weights[i] == 0);
+    }
+    return (float)zeros / (WEIGHT_ROWS_7 * WEIGHT_COLS_7);
+}
+
+float pruneWeights(Params& param, float sparsity) {
+    const int count = SPARSE_BLOCKS_7 * WEIGHT_COLS_7;
+    int pruned = (int)(sparsity * count);
+    pruned = (pruned < 0) ? 0 : (pruned > count) ? count : pruned;
+
+    // (norm, i) for block i = (i / WEIGHT_COLS_7, i % WEIGHT_COLS_7), the pruned ones come first after the partial sort
+    std::vector<std::pair<float, int> > norms(count);
+    for (int i = 0; i < count; i++) {
+        norms[i] = std::make_pair(blockNorm(param, i / WEIGHT_COLS_7, i % WEIGHT_COLS_7), i);
+    }
+    if (pruned > 0 && pruned < count) {
+        std::nth_element(norms.begin(), norms.begin() + pruned, norms.end());
+    }
+    for (int i = 0; i < pruned; i++) {
+        int block = norms[i].second / WEIGHT_COLS_7;
+        int input = norms[i].second % WEIGHT_COLS_7;
+        for (int r = 0; r < SPARSE_BLOCK; r++) {
+            param.weights4[block * SPARSE_BLOCK + r][input] = 0;
+        }
+    }
+
+    packConvWeights(&param.weights4[0][0], param.packed4, WEIGHT_ROWS_7, WEIGHT_COLS_7, 1);
+    return weightSparsity(param);
+}
+
+void buildSparseFc(const Params& param, SparseFc& sparse) {
+    int k = 0;
+    for (int j = 0; j < WEIGHT_COLS_7; j++) {
+        sparse.starts[j] = k;
+        for (int b = 0; b < SPARSE_BLOCKS_7; b++) {
+            if (blockNorm(param, b, j) == 0) {
+                continue;
+            }
+            for (int r = 0; r < SPARSE_BLOCK; r++) {
+                sparse.values[k * SPARSE_BLOCK + r] = param.weights4[b * SPARSE_BLOCK + r][j];
+            }
+            sparse.blocks[k++] = (uint8_t)b;
+        }
+    }
+    sparse.starts[WEIGHT_COLS_7] = k;
+    sparse.block_count = k;
+}
+
+void layer_7_fc_sparse(ImageData& imageData, const Params& param, const SparseFc& sparse) {
+    PROFILE_SCOPE(PROFILE_LAYER_7_FC_SPARSE);
+    alignas(64) float sums[WEIGHT_ROWS_7];
+    memcpy(sums, param.biases4, sizeof(sums));
+
+    // Input stationary: each nonzero input scatters into the output blocks it has weights for
+    activeKernels().sparse_blocks(imageData.layer_6, WEIGHT_COLS_7, sparse.starts, sparse.blocks, sparse.values, sums);
+
+    for (int n = 0; n < WEIGHT_ROWS_7; n++) {
+        imageData.layer_7[n] = Layer7Fc::relu ? relu(sums[n]) : sums[n];
+    }
+}
+
+int forwardPassSparse(ImageData& inputData, Workspace& workspace, const Params& param, const SparseFc& sparse) {
+    convStack(inputData, workspace, param);
+    layer_7_fc_sparse(inputData, param, sparse);
+    layer_8_fc(inputData, param);
+    layer_9_fc(inputData, param);
+
+    return predictedClass(inputData.layer_9);
+}
+
+void evaluateSparse(const char* folderPath, const Params& dense, const Params& pruned, const SparseFc& sparse, int padding,
+                    SparseReport& report) {
+    std::vector<DatasetEntry> entries;
+    listDataset(folderPath, entries);
+
+    ImageData* imageData = new ImageData();
+    Workspace* workspace = allocateWorkspace();
+    cv::Mat image;
+    long zero_inputs = 0;
+    memset(&report, 0, sizeof(report));
+    report.weight_sparsity = weightSparsity(pruned);
+    report.block_sparsity = 1 - (float)sparse.block_count / (SPARSE_BLOCKS_7 * WEIGHT_COLS_7);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!preprocessImage(entries[i].path.c_str(), *imageData, image, padding)) {
+            fprintf(stderr, "Error: Could not read the image %s\n", entries[i].path.c_str());
+            continue;
+        }
+
+        // Pruning only touches layer 7, both heads share the conv stack
+        convStack(*imageData, *workspace, dense);
+        for (int j = 0; j < INPUT_COLS_7; j++) {
+            zero_inputs += (imageData->layer_6[j] == 0);
+        }
+
+        double t0 = now();
+        layer_7_fc(*imageData, dense);
+        double t1 = now();
+        layer_8_fc(*imageData, dense);
+        layer_9_fc(*imageData, dense);
+        int fp32 = predictedClass(imageData->layer_9);
+
+        double t2 = now();
+        layer_7_fc_sparse(*imageData, pruned, sparse);
+        double t3 = now();
+        layer_8_fc(*imageData, pruned);
+        layer_9_fc(*imageData, pruned);
+        int sparse_prediction = predictedClass(imageData->layer_9);
+
+        report.images++;
+        report.dense_seconds += t1 - t0;
+        report.sparse_seconds += t3 - t2;
+        report.dense_correct += (fp32 == entries[i].label);
+        report.sparse_correct += (sparse_prediction == entries[i].label);
+        report.agreement += (fp32 == sparse_prediction);
+    }
+    if (report.images > 0) {
+        report.activation_sparsity = (float)zero_inputs / ((long)report.images * INPUT_COLS_7);
+    }
+
+    delete imageData;
+    freeWorkspace(workspace);
+}
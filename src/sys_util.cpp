@@ -0,0 +1,46 @@
+#include "../include/sys_util.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+
+bool readFully(int fd, void* data, size_t size) {
+    char* bytes = (char*)data;
+    while (size > 0) {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool writeFully(int fd, const void* data, size_t size) {
+    struct stat info;
+    bool socket = fstat(fd, &info) == 0 && S_ISSOCK(info.st_mode);
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t n = socket ? send(fd, bytes, size, MSG_NOSIGNAL) : write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
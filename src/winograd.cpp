@@ -0,0 +1,41 @@
+#include "../include/winograd.h"
+
+#include <stdlib.h>
+
+// G = [1 0 0; 1/2 1/2 1/2; 1/2 -1/2 1/2; 0 0 1], u = G g G^T
+static void transformFilter(const float* g, float* u) {
+    float tmp[WINOGRAD_TILE][3];
+    for (int j = 0; j < 3; j++) {
+        tmp[0][j] = g[j];
+        tmp[1][j] = 0.5f * (g[j] + g[3 + j] + g[6 + j]);
+        tmp[2][j] = 0.5f * (g[j] - g[3 + j] + g[6 + j]);
+        tmp[3][j] = g[6 + j];
+    }
+    for (int i = 0; i < WINOGRAD_TILE; i++) {
+        u[i * WINOGRAD_TILE + 0] = tmp[i][0];
+        u[i * WINOGRAD_TILE + 1] = 0.5f * (tmp[i][0] + tmp[i][1] + tmp[i][2]);
+        u[i * WINOGRAD_TILE + 2] = 0.5f * (tmp[i][0] - tmp[i][1] + tmp[i][2]);
+        u[i * WINOGRAD_TILE + 3] = tmp[i][2];
+    }
+}
+
+void winogradTransformWeights(const float* weights, float* transformed, int out_filters, int in_filters) {
+    // Regroup point-major so each point's [out][in] matrix can go through packConvWeights
+    float* points = (float*)malloc(sizeof(float) * WINOGRAD_POINTS * out_filters * in_filters);
+    float u[WINOGRAD_POINTS];
+
+    for (int out_f = 0; out_f < out_filters; out_f++) {
+        for (int in_f = 0; in_f < in_filters; in_f++) {
+            transformFilter(weights + (out_f * in_filters + in_f) * 9, u);
+            for (int xi = 0; xi < WINOGRAD_POINTS; xi++) {
+                points[(xi * out_filters + out_f) * in_filters + in_f] = u[xi];
+            }
+        }
+    }
+
+    int point_stride = PACKED_WEIGHTS_SIZE(out_filters, in_filters, 1);
+    for (int xi = 0; xi < WINOGRAD_POINTS; xi++) {
+        packConvWeights(points + xi * out_filters * in_filters, transformed + xi * point_stride, out_filters, in_filters, 1);
+    }
+    free(points);
+}
@@ -0,0 +1,107 @@
+#include "../include/autotune.h"
+#include "../include/cnn.h"
+
+//-------------------------------------------------------------CONV ALGORITHM CHECK-------------------------------------------//
+
+// Runs syntheticImage through forwardPass with every ConvAlgorithm, and CONV_TUNED with a few plans, on
+// deterministic random weights and compares layer_9 with CONV_DIRECT. Needs no model or dataset, exits non-zero
+// on a mismatch.
+
+// Allowed difference of a score, relative to the largest CONV_DIRECT score. The algorithms only reorder the sums,
+// Winograd adds rounding of its own.
+#define SCORE_TOLERANCE 1e-4f
+
+static const char* conv_names[] = {"direct", "gemm", "fused", "winograd", "nchwc", "tuned"};
+
+// Uniform in [-1, 1) / sqrt(fan_in), so the activations keep roughly the same scale through the layers
+static void fillWeights(float* values, size_t count, int fan_in, unsigned& seed) {
+    float scale = 1.0f / sqrtf((float)fan_in);
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        values[i] = ((float)((seed >> 8) & 0xffff) / 32768 - 1) * scale;
+    }
+}
+
+#define FILL(tensor, fan_in) fillWeights((float*)params->tensor, sizeof(params->tensor) / sizeof(float), fan_in, seed)
+
+static void randomParams(Params* params) {
+    unsigned seed = 1;
+    FILL(weights1, INPUT_FILTERS_1 * KERNEL_SIZE_1 * KERNEL_SIZE_1);
+    FILL(biases1, INPUT_FILTERS_1 * KERNEL_SIZE_1 * KERNEL_SIZE_1);
+    FILL(weights2, INPUT_FILTERS_3 * KERNEL_SIZE_3 * KERNEL_SIZE_3);
+    FILL(biases2, INPUT_FILTERS_3 * KERNEL_SIZE_3 * KERNEL_SIZE_3);
+    FILL(weights3, INPUT_FILTERS_5 * KERNEL_SIZE_5 * KERNEL_SIZE_5);
+    FILL(biases3, INPUT_FILTERS_5 * KERNEL_SIZE_5 * KERNEL_SIZE_5);
+    FILL(weights4, WEIGHT_COLS_7);
+    FILL(biases4, WEIGHT_COLS_7);
+    FILL(weights5, WEIGHT_COLS_8);
+    FILL(biases5, WEIGHT_COLS_8);
+    FILL(weights6, WEIGHT_COLS_9);
+    FILL(biases6, WEIGHT_COLS_9);
+    packParams(*params);
+}
+
+static void scores(Params* params, int conv_algorithm, ImageData& imageData, Workspace& workspace, float* layer_9) {
+    params->conv_algorithm = conv_algorithm;
+    syntheticImage(imageData);
+    forwardPass(imageData, workspace, *params);
+    memcpy(layer_9, imageData.layer_9, sizeof(imageData.layer_9));
+}
+
+// Largest difference to reference, relative to its largest score
+static float scoreError(const float* reference, const float* layer_9) {
+    float largest = 0;
+    float error = 0;
+    for (int c = 0; c < TOTAL_CLASSES; c++) {
+        largest = fmaxf(largest, fabsf(reference[c]));
+        error = fmaxf(error, fabsf(layer_9[c] - reference[c]));
+    }
+    return (largest > 0) ? error / largest : error;
+}
+
+static bool check(const char* name, const float* reference, const float* layer_9) {
+    float error = scoreError(reference, layer_9);
+    bool ok = error <= SCORE_TOLERANCE;
+    printf("%-72s %12g %s\n", name, error, ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+int main() {
+    Params* params = allocateParams();
+    randomParams(params);
+    ImageData* imageData = new ImageData();
+    Workspace* workspace = allocateWorkspace();
+
+    float reference[TOTAL_CLASSES];
+    float layer_9[TOTAL_CLASSES];
+    scores(params, CONV_DIRECT, *imageData, *workspace, reference);
+
+    bool ok = true;
+    for (int a = CONV_IM2COL_GEMM; a < CONV_TUNED; a++) {
+        scores(params, a, *imageData, *workspace, layer_9);
+        ok = check(conv_names[a], reference, layer_9) && ok;
+    }
+
+    // The default plan, every stage in NCHWc, and im2col at its smallest block with Winograd last
+    TuningPlan plans[3];
+    defaultTuningPlan(plans[0]);
+    plans[1] = plans[0];
+    plans[2] = plans[0];
+    for (int s = 0; s < TUNING_STAGES; s++) {
+        plans[1].stages[s].algorithm = CONV_NCHWC;
+        plans[2].stages[s].block = GEMM_POOL_NR;
+    }
+    plans[2].stages[TUNING_STAGES - 1].algorithm = CONV_FUSED_WINOGRAD;
+
+    for (int p = 0; p < 3; p++) {
+        params->tuning = plans[p];
+        scores(params, CONV_TUNED, *imageData, *workspace, layer_9);
+        std::string name = std::string(conv_names[CONV_TUNED]) + " " + formatTuningPlan(plans[p]);
+        ok = check(name.c_str(), reference, layer_9) && ok;
+    }
+
+    freeWorkspace(workspace);
+    delete imageData;
+    freeParams(params);
+    return ok ? 0 : 1;
+}